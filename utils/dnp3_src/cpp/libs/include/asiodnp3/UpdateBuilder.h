@@ -23,6 +23,8 @@
 
 #include "asiodnp3/Updates.h"
 
+#include <vector>
+
 namespace asiodnp3
 {
 
@@ -39,8 +41,21 @@ public:
 	UpdateBuilder& Update(const opendnp3::BinaryOutputStatus& meas, uint16_t index, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
 	UpdateBuilder& Update(const opendnp3::AnalogOutputStatus& meas, uint16_t index, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
 	UpdateBuilder& Update(const opendnp3::TimeAndInterval& meas, uint16_t index);
+	UpdateBuilder& UpdateRange(const opendnp3::Binary* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::DoubleBitBinary* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::Analog* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::Counter* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::FrozenCounter* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::BinaryOutputStatus* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
+	UpdateBuilder& UpdateRange(const opendnp3::AnalogOutputStatus* values, uint16_t start, uint16_t count, opendnp3::EventMode mode = opendnp3::EventMode::Detect);
 	UpdateBuilder& Modify(opendnp3::FlagsType type, uint16_t start, uint16_t stop, uint8_t flags);
 
+	/**
+	* Add an arbitrary update, applied to the database on the outstation's strand in order with the others
+	*/
+	void Add(const update_func_t& fun);
+	void Add(update_func_t&& fun);
+
 	Updates Build() const;
 
 private:
@@ -48,7 +63,8 @@ private:
 	template <class T>
 	UpdateBuilder& AddMeas(const T& meas, uint16_t index, opendnp3::EventMode mode);
 
-	void Add(const update_func_t& fun);
+	template <class T>
+	UpdateBuilder& AddRange(const T* values, uint16_t start, uint16_t count, opendnp3::EventMode mode);
 
 	std::shared_ptr<shared_updates_t> updates;
 };
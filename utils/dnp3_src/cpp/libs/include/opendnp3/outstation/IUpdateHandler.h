@@ -117,6 +117,114 @@ public:
 	*/
 	virtual bool Modify(FlagsType type, uint16_t start, uint16_t stop, uint8_t flags) = 0;
 
+	/**
+	* Update a range of Binary measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const Binary* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of DoubleBitBinary measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const DoubleBitBinary* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of Analog measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const Analog* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of Counter measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const Counter* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of FrozenCounter measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const FrozenCounter* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of BinaryOutputStatus measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const BinaryOutputStatus* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+	/**
+	* Update a range of AnalogOutputStatus measurements with consecutive indices
+	* @param values measurements to be processed, one for each index
+	* @param start index of the first measurement
+	* @param count number of measurements
+	* @param mode Describes how event generation is handled for this method
+	* @return the number of measurements that exist and were updated
+	*/
+	virtual uint16_t UpdateRange(const AnalogOutputStatus* values, uint16_t start, uint16_t count, EventMode mode = EventMode::Detect)
+	{
+		return UpdateEach(values, start, count, mode);
+	}
+
+private:
+
+	// default implementation of the range updates, one measurement at a time
+	template <class T>
+	uint16_t UpdateEach(const T* values, uint16_t start, uint16_t count, EventMode mode)
+	{
+		uint16_t updated = 0;
+		for (uint32_t i = 0; i < count && start + i <= 0xFFFF; ++i)
+		{
+			if (this->Update(values[i], static_cast<uint16_t>(start + i), mode))
+			{
+				++updated;
+			}
+		}
+		return updated;
+	}
+
 };
 
 }
@@ -66,6 +66,41 @@ UpdateBuilder& UpdateBuilder::Update(const opendnp3::AnalogOutputStatus& meas, u
 	return this->AddMeas(meas, index, mode);
 }
 
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::Binary* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::DoubleBitBinary* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::Analog* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::Counter* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::FrozenCounter* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::BinaryOutputStatus* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
+UpdateBuilder& UpdateBuilder::UpdateRange(const opendnp3::AnalogOutputStatus* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	return this->AddRange(values, start, count, mode);
+}
+
 UpdateBuilder& UpdateBuilder::Update(const opendnp3::TimeAndInterval& meas, uint16_t index)
 {
 	this->Add([ = ](IUpdateHandler & handler)
@@ -94,6 +129,17 @@ UpdateBuilder& UpdateBuilder::AddMeas(const T& meas, uint16_t index, opendnp3::E
 	return *this;
 }
 
+template <class T>
+UpdateBuilder& UpdateBuilder::AddRange(const T* values, uint16_t start, uint16_t count, opendnp3::EventMode mode)
+{
+	// the whole range is a single update, applied with one call into the handler
+	this->Add([copy = std::vector<T>(values, values + count), start, mode](IUpdateHandler & handler)
+	{
+		handler.UpdateRange(copy.data(), start, static_cast<uint16_t>(copy.size()), mode);
+	});
+	return *this;
+}
+
 void UpdateBuilder::Add(const update_func_t& fun)
 {
 	if (!this->updates)
@@ -104,4 +150,14 @@ void UpdateBuilder::Add(const update_func_t& fun)
 	updates->push_back(fun);
 }
 
+void UpdateBuilder::Add(update_func_t&& fun)
+{
+	if (!this->updates)
+	{
+		this->updates = std::make_shared<shared_updates_t>();
+	}
+
+	updates->push_back(std::move(fun));
+}
+
 }
@@ -24,6 +24,8 @@
 #include <openpal/serialization/Format.h>
 #include <openpal/serialization/Serializer.h>
 
+#include <cstring>
+
 namespace opendnp3
 {
 
@@ -79,6 +81,34 @@ public:
 		}
 	}
 
+	/**
+	* Write values that are already serialized
+	*
+	* @param objects the serialized values, serializer.Size() bytes each
+	* @param num the number of values
+	* @return the number of values that fit and were written
+	*/
+	uint32_t WriteSerialized(const uint8_t* objects, uint32_t num)
+	{
+		if (!isValid || (count > IndexType::Max))
+		{
+			return 0;
+		}
+
+		const uint32_t maxForIndex = IndexType::Max + 1 - count;
+		const uint32_t maxForSpace = pPosition->Size() / serializer.Size();
+
+		uint32_t written = (num < maxForIndex) ? num : maxForIndex;
+		written = (written < maxForSpace) ? written : maxForSpace;
+
+		const uint32_t numBytes = written * serializer.Size();
+		memcpy(*pPosition, objects, numBytes);
+		pPosition->Advance(numBytes);
+		count += written;
+
+		return written;
+	}
+
 	bool IsValid() const
 	{
 		return isValid;
@@ -22,6 +22,8 @@
 
 #include <openpal/serialization/Serialization.h>
 
+#include <cstring>
+
 namespace opendnp3
 {
 
@@ -61,17 +63,81 @@ uint16_t CRC::crcTable[256] =
 	0x91AF, 0xA7F1, 0xFD13, 0xCB4D, 0x48D7, 0x7E89, 0x246B, 0x1235
 };
 
-uint16_t CRC::CalcCrc(const uint8_t* input, uint32_t length)
+uint16_t CRC::sliceTable[8][256];
+
+// Entry k of the slice table is the CRC of a byte followed by k zero bytes, so that
+// the CRC of 8 bytes is the xor of one lookup per byte. It is built from crcTable,
+// which is constant initialized, before main() is entered
+const bool CRC::sliceTableReady = CRC::InitSliceTable();
+
+bool CRC::InitSliceTable()
+{
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		sliceTable[0][i] = crcTable[i];
+	}
+
+	for (uint32_t k = 1; k < 8; ++k)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint16_t prev = sliceTable[k - 1][i];
+			sliceTable[k][i] = crcTable[prev & 0xFF] ^ (prev >> 8);
+		}
+	}
+
+	return true;
+}
+
+template <bool copy>
+uint16_t CRC::Calc(const uint8_t* input, uint8_t* output, uint32_t length)
 {
-	uint16_t CRC = 0;
+	uint16_t crc = 0;
+
+	// slice-by-8, the 16 bits of the running CRC only affect the first 2 bytes of each slice
+	while (length >= 8)
+	{
+		crc = sliceTable[7][(crc ^ input[0]) & 0xFF] ^
+		      sliceTable[6][((crc >> 8) ^ input[1]) & 0xFF] ^
+		      sliceTable[5][input[2]] ^
+		      sliceTable[4][input[3]] ^
+		      sliceTable[3][input[4]] ^
+		      sliceTable[2][input[5]] ^
+		      sliceTable[1][input[6]] ^
+		      sliceTable[0][input[7]];
+
+		if (copy)
+		{
+			memcpy(output, input, 8);
+			output += 8;
+		}
+
+		input += 8;
+		length -= 8;
+	}
 
 	for (uint32_t i = 0; i < length; ++i)
 	{
-		uint8_t index = (CRC ^ input[i]) & 0xFF;
-		CRC = crcTable[index] ^ (CRC >> 8);
+		if (copy)
+		{
+			output[i] = input[i];
+		}
+
+		uint8_t index = (crc ^ input[i]) & 0xFF;
+		crc = crcTable[index] ^ (crc >> 8);
 	}
 
-	return ~CRC;
+	return ~crc;
+}
+
+uint16_t CRC::CalcCrc(const uint8_t* input, uint32_t length)
+{
+	return Calc<false>(input, nullptr, length);
+}
+
+uint16_t CRC::CalcCrcAndCopy(const uint8_t* input, uint8_t* output, uint32_t length)
+{
+	return Calc<true>(input, output, length);
 }
 
 uint16_t CRC::CalcCrc(const openpal::RSlice& view)
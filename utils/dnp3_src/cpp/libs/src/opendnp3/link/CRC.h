@@ -36,14 +36,29 @@ public:
 
 	static uint16_t CalcCrc(const openpal::RSlice& view);
 
+	/**
+	* Copies length bytes from input to output and returns the CRC of the bytes, in a single pass.
+	* The buffers must not overlap.
+	*/
+	static uint16_t CalcCrcAndCopy(const uint8_t* input, uint8_t* output, uint32_t length);
+
 	static void AddCrc(uint8_t* input, uint32_t length);
 
 	static bool IsCorrectCRC(const uint8_t* input, uint32_t length);
 
 private:
 
+	template <bool copy>
+	static uint16_t Calc(const uint8_t* input, uint8_t* output, uint32_t length);
+
 	static uint16_t crcTable[256]; //Precomputed CRC lookup table
 
+	static uint16_t sliceTable[8][256]; // crcTable extended to process 8 bytes per iteration
+
+	static bool InitSliceTable();
+
+	static const bool sliceTableReady;
+
 };
 
 }
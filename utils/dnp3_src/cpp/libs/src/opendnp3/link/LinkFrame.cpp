@@ -74,6 +74,25 @@ bool LinkFrame::ValidateBodyCRC(const uint8_t* pBody, uint32_t length)
 	return true;
 }
 
+bool LinkFrame::ValidateAndReadUserData(const uint8_t* pSrc, uint8_t* pDest, uint32_t length)
+{
+	while (length > 0)
+	{
+		uint32_t max = LPDU_DATA_BLOCK_SIZE;
+		uint32_t num = (length <= max) ? length : max;
+
+		if (CRC::CalcCrcAndCopy(pSrc, pDest, num) != UInt16::Read(pSrc + num))
+		{
+			return false;
+		}
+
+		pSrc += (num + 2);
+		pDest += num;
+		length -= num;
+	}
+	return true;
+}
+
 uint32_t LinkFrame::CalcFrameSize(uint8_t dataLength)
 {
 	return LPDU_HEADER_SIZE + CalcUserDataSize(dataLength);
@@ -188,8 +207,7 @@ void LinkFrame::WriteUserData(const uint8_t* pSrc, uint8_t* pDest, uint8_t lengt
 	{
 		uint8_t max = LPDU_DATA_BLOCK_SIZE;
 		uint8_t num = length > max ? max : length;
-		memcpy(pDest, pSrc, num);
-		CRC::AddCrc(pDest, num);
+		UInt16::Write(pDest + num, CRC::CalcCrcAndCopy(pSrc, pDest, num));
 		pSrc += num;
 		pDest += (num + 2);
 		length -= num;
@@ -73,6 +73,13 @@ public:
 	@return True if the body CRC is correct */
 	static bool ValidateBodyCRC(const uint8_t* apBody, uint32_t aLength);
 
+	/** Reads data from src to dest removing the 2 byte CRC checks every 16 data bytes, validating them in the same pass
+	@param pSrc Source buffer with crc checks. Must begin at data, not header
+	@param pDest Destination buffer to which the data is extracted. Must not overlap the source
+	@param length Length of user data to read to the dest buffer. The source buffer must be larger b/c of crc bytes.
+	@return True if the body CRC is correct. Otherwise dest holds a partial copy */
+	static bool ValidateAndReadUserData(const uint8_t* pSrc, uint8_t* pDest, uint32_t length);
+
 	// @return Total frame size based on user data length
 	static uint32_t CalcFrameSize(uint8_t dataLength);
 
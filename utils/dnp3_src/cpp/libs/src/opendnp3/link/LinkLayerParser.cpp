@@ -173,9 +173,9 @@ void LinkLayerParser::PushFrame(IFrameSink& sink)
 
 void LinkLayerParser::TransferUserData()
 {
+	// the user data was copied when its CRCs were validated
 	uint32_t len = header.GetLength() - LPDU_MIN_LENGTH;
-	LinkFrame::ReadUserData(buffer.ReadBuffer() + LPDU_HEADER_SIZE, rxBuffer, len);
-	userData = RSlice(rxBuffer, len);
+	userData = RSlice(userDataBuffer, len);
 }
 
 bool LinkLayerParser::ReadHeader()
@@ -203,7 +203,7 @@ bool LinkLayerParser::ReadHeader()
 bool LinkLayerParser::ValidateBody()
 {
 	uint32_t len = header.GetLength() - LPDU_MIN_LENGTH;
-	if (LinkFrame::ValidateBodyCRC(buffer.ReadBuffer() + LPDU_HEADER_SIZE, len))
+	if (LinkFrame::ValidateAndReadUserData(buffer.ReadBuffer() + LPDU_HEADER_SIZE, userDataBuffer, len))
 	{
 		FORMAT_LOG_BLOCK(logger, flags::LINK_RX,
 		                 "Function: %s Dest: %u Source: %u Length: %u",
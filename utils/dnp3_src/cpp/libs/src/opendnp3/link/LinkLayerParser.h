@@ -99,6 +99,9 @@ private:
 
 	// facade over the rxBuffer that provides ability to "shift" as data is read
 	ShiftableBuffer buffer;
+
+	// user data of the last frame, copied out of the rxBuffer as its CRCs are validated
+	uint8_t userDataBuffer[LPDU_MAX_USER_DATA_SIZE];
 };
 
 }
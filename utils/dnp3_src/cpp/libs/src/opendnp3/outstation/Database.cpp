@@ -21,6 +21,7 @@
 #include "Database.h"
 
 #include <openpal/logging/LogMacros.h>
+#include <openpal/util/Limits.h>
 
 #include <assert.h>
 
@@ -80,6 +81,7 @@ bool Database::Update(const TimeAndInterval& value, uint16_t index)
 	if (view.Contains(rawIndex))
 	{
 		view[rawIndex].value = value;
+		buffers.buffers.GetImage<TimeAndIntervalSpec>().Invalidate(rawIndex, view[rawIndex].selection.selected);
 		return true;
 	}
 	else
@@ -88,6 +90,41 @@ bool Database::Update(const TimeAndInterval& value, uint16_t index)
 	}
 }
 
+uint16_t Database::UpdateRange(const Binary* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<BinarySpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const DoubleBitBinary* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<DoubleBitBinarySpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const Analog* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<AnalogSpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const Counter* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<CounterSpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const FrozenCounter* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<FrozenCounterSpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const BinaryOutputStatus* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<BinaryOutputStatusSpec>(values, start, count, mode);
+}
+
+uint16_t Database::UpdateRange(const AnalogOutputStatus* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	return this->UpdateRangeEvent<AnalogOutputStatusSpec>(values, start, count, mode);
+}
+
 bool Database::Modify(FlagsType type, uint16_t start, uint16_t stop, uint8_t flags)
 {
 	switch (type)
@@ -152,7 +189,7 @@ bool Database::UpdateEvent(const typename Spec::meas_t& value, uint16_t index, E
 
 	if (view.Contains(rawIndex))
 	{
-		this->UpdateAny(view[rawIndex], value, mode);
+		this->UpdateAny(view[rawIndex], buffers.buffers.GetImage<Spec>(), rawIndex, value, mode);
 		return true;
 	}
 	else
@@ -162,7 +199,47 @@ bool Database::UpdateEvent(const typename Spec::meas_t& value, uint16_t index, E
 }
 
 template <class Spec>
-bool Database::UpdateAny(Cell<Spec>& cell, const typename Spec::meas_t& value, EventMode mode)
+uint16_t Database::UpdateRangeEvent(const typename Spec::meas_t* values, uint16_t start, uint16_t count, EventMode mode)
+{
+	auto view = buffers.buffers.GetArrayView<Spec>();
+	auto& image = buffers.buffers.GetImage<Spec>();
+
+	if (count == 0 || view.IsEmpty())
+	{
+		return 0;
+	}
+
+	const uint16_t stop = (count - 1 > openpal::MaxValue<uint16_t>() - start) ? openpal::MaxValue<uint16_t>() : start + count - 1;
+	uint16_t updated = 0;
+
+	if (indexMode == IndexMode::Contiguous)
+	{
+		// raw and virtual indices are the same
+		for (uint32_t i = start; i <= stop && view.Contains(static_cast<uint16_t>(i)); ++i)
+		{
+			this->UpdateAny(view[i], image, static_cast<uint16_t>(i), values[i - start], mode);
+			++updated;
+		}
+	}
+	else
+	{
+		// the range is searched for once, and the points in it are visited in order
+		auto range = IndexSearch::FindRawRange(view, Range::From(start, stop));
+		if (range.IsValid())
+		{
+			for (uint32_t i = range.start; i <= range.stop; ++i)
+			{
+				this->UpdateAny(view[i], image, static_cast<uint16_t>(i), values[view[i].config.vIndex - start], mode);
+				++updated;
+			}
+		}
+	}
+
+	return updated;
+}
+
+template <class Spec>
+bool Database::UpdateAny(Cell<Spec>& cell, StaticImage<Spec>& image, uint16_t rawIndex, const typename Spec::meas_t& value, EventMode mode)
 {
 	EventClass ec;
 	if (ConvertToEventClass(cell.config.clazz, ec))
@@ -189,6 +266,7 @@ bool Database::UpdateAny(Cell<Spec>& cell, const typename Spec::meas_t& value, E
 	}
 
 	cell.value = value;
+	image.Invalidate(rawIndex, cell.selection.selected);
 	return true;
 }
 
@@ -199,6 +277,7 @@ bool Database::Modify(uint16_t start, uint16_t stop, uint8_t flags)
 	auto rawStop = GetRawIndex<Spec>(stop);
 
 	auto view = buffers.buffers.GetArrayView<Spec>();
+	auto& image = buffers.buffers.GetImage<Spec>();
 
 	if (view.Contains(rawStart) && view.Contains(rawStop) && (rawStart <= rawStop))
 	{
@@ -206,7 +285,7 @@ bool Database::Modify(uint16_t start, uint16_t stop, uint8_t flags)
 		{
 			auto copy = view[i].value;
 			copy.flags = flags;
-			this->UpdateAny(view[i], copy, EventMode::Detect);
+			this->UpdateAny(view[i], image, i, copy, EventMode::Detect);
 		}
 
 		return true;
@@ -52,6 +52,14 @@ public:
 	virtual bool Update(const TimeAndInterval&, uint16_t) override;
 	virtual bool Modify(FlagsType type, uint16_t start, uint16_t stop, uint8_t flags) override;
 
+	virtual uint16_t UpdateRange(const Binary*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const DoubleBitBinary*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const Analog*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const Counter*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const FrozenCounter*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const BinaryOutputStatus*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+	virtual uint16_t UpdateRange(const AnalogOutputStatus*, uint16_t, uint16_t, EventMode = EventMode::Detect) override;
+
 	// ------- Misc ---------------
 
 	IResponseLoader& GetResponseLoader() override final
@@ -89,7 +97,10 @@ private:
 	bool UpdateEvent(const typename Spec::meas_t& value, uint16_t index, EventMode mode);
 
 	template <class Spec>
-	bool UpdateAny(Cell<Spec>& cell, const typename Spec::meas_t& value, EventMode mode);
+	uint16_t UpdateRangeEvent(const typename Spec::meas_t* values, uint16_t start, uint16_t count, EventMode mode);
+
+	template <class Spec>
+	bool UpdateAny(Cell<Spec>& cell, StaticImage<Spec>& image, uint16_t rawIndex, const typename Spec::meas_t& value, EventMode mode);
 
 	template <class Spec>
 	bool Modify(uint16_t start, uint16_t stop, uint8_t flags);
@@ -94,6 +94,7 @@ private:
 				view[i].selection.selected = false;
 			}
 			ranges.Clear<Spec>();
+			buffers.GetImage<Spec>().ClearSelection();
 		}
 	}
 
@@ -242,7 +243,7 @@ bool DatabaseBuffers::LoadType(HeaderWriter& writer)
 				auto writeFun = GetStaticWriter(view[range.start].selection.variation);
 
 				// start writing a header, the invoked function will advance the range appropriately
-				spaceRemaining = writeFun(view, writer, range);
+				spaceRemaining = writeFun(view, buffers.GetImage<T>(), writer, range);
 			}
 			else
 			{
@@ -253,6 +254,11 @@ bool DatabaseBuffers::LoadType(HeaderWriter& writer)
 
 		ranges.Set<T>(range);
 
+		if (!range.IsValid())
+		{
+			buffers.GetImage<T>().ClearSelection();
+		}
+
 		return spaceRemaining;
 	}
 	else
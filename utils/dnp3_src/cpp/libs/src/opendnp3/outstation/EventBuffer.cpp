@@ -28,20 +28,22 @@ namespace opendnp3
 EventBuffer::EventBuffer(const EventBufferConfig& config_) :
 	overflow(false),
 	config(config_),
-	events(config_.TotalEvents())
+	events(config_.TotalEvents()),
+	nextSequence(0)
 {
 
 }
 
 void EventBuffer::Unselect()
 {
-	auto unselect = [this](SOERecord & record)
+	auto pNode = selection.Head();
+
+	while (pNode)
 	{
-		if (record.selected)
-		{
-			selectedCounts.Decrement(record.clazz, record.type);
-			record.selected = false;
-		}
+		auto& record = pNode->value;
+
+		selectedCounts.Decrement(record.clazz, record.type);
+		record.selected = false;
 
 		if (record.written)
 		{
@@ -49,10 +51,10 @@ void EventBuffer::Unselect()
 			record.written = false;
 		}
 
-		return this->selectedCounts.TotatCount() > 0;
-	};
+		pNode = SelectionList::Next(pNode);
+	}
 
-	events.While(unselect);
+	selection.Clear();
 }
 
 IINField EventBuffer::SelectAll(GroupVariation gv)
@@ -182,7 +184,7 @@ bool EventBuffer::HasAnySelection() const
 
 bool EventBuffer::Load(HeaderWriter& writer)
 {
-	return EventWriter::Write(writer, *this, events.Iterate());
+	return EventWriter::Write(writer, *this, SelectionIterator::From(selection.Head()));
 }
 
 bool EventBuffer::HasMoreUnwrittenEvents() const
@@ -216,21 +218,50 @@ bool EventBuffer::IsOverflown()
 
 IINField EventBuffer::SelectByClass(const ClassField& field, uint32_t max)
 {
+	typedef SOEList<&SOERecord::classLinks> ClassList;
+
 	uint32_t num = 0;
-	auto iter = events.Iterate();
 	const uint32_t remaining = totalCounts.NumOfClass(field) - selectedCounts.NumOfClass(field);
 
-	while (iter.HasNext() && (num < remaining) && (num < max))
+	// walk the lists of the requested classes together, oldest event first
+	openpal::ListNode<SOERecord>* heads[3] =
 	{
-		auto pNode = iter.Next();
-		if (field.HasEventType(pNode->value.clazz))
+		field.HasClass1() ? eventsOfClass[0].Head() : nullptr,
+		field.HasClass2() ? eventsOfClass[1].Head() : nullptr,
+		field.HasClass3() ? eventsOfClass[2].Head() : nullptr
+	};
+
+	SelectionList run;
+
+	while ((num < remaining) && (num < max))
+	{
+		int oldest = -1;
+		for (int i = 0; i < 3; ++i)
+		{
+			if (heads[i] && ((oldest < 0) || IsBefore(heads[i]->value, heads[oldest]->value)))
+			{
+				oldest = i;
+			}
+		}
+
+		if (oldest < 0)
+		{
+			break;
+		}
+
+		auto pNode = heads[oldest];
+		heads[oldest] = ClassList::Next(pNode);
+
+		if (!pNode->value.selected)
 		{
 			pNode->value.SelectDefault();
-			selectedCounts.Increment(pNode->value.clazz, pNode->value.type);
+			this->Select(pNode, run);
 			++num;
 		}
 	}
 
+	selection.Merge(run);
+
 	return IINField();
 }
 
@@ -251,17 +282,12 @@ void EventBuffer::RemoveFromCounts(const SOERecord& record)
 
 bool EventBuffer::RemoveOldestEventOfType(EventType type)
 {
-	// find the first event of this type in the SOE, and discard it
-	auto isMatch = [type](const SOERecord & rec)
-	{
-		return rec.type == type;
-	};
-	auto pNode = events.RemoveFirst(isMatch);
+	// the first event of this type is the oldest one in the SOE, discard it
+	auto pNode = eventsOfType[static_cast<uint8_t>(type)].Head();
 
 	if (pNode)
 	{
-		this->RemoveFromCounts(pNode->value);
-		pNode->value.Reset();
+		this->Remove(pNode);
 		return true;
 	}
 	else
@@ -270,6 +296,30 @@ bool EventBuffer::RemoveOldestEventOfType(EventType type)
 	}
 }
 
+void EventBuffer::Remove(openpal::ListNode<SOERecord>* node)
+{
+	auto& record = node->value;
+
+	this->RemoveFromCounts(record);
+
+	eventsOfType[static_cast<uint8_t>(record.type)].Remove(node);
+	eventsOfClass[static_cast<uint8_t>(record.clazz)].Remove(node);
+
+	if (record.selected)
+	{
+		selection.Remove(node);
+	}
+
+	record.Reset();
+	events.Remove(node);
+}
+
+void EventBuffer::Select(openpal::ListNode<SOERecord>* node, SelectionList& run)
+{
+	selectedCounts.Increment(node->value.clazz, node->value.type);
+	run.Append(node);
+}
+
 void EventBuffer::SelectAllByClass(const ClassField& field)
 {
 	this->SelectByClass(field, openpal::MaxValue<uint32_t>());
@@ -277,20 +327,19 @@ void EventBuffer::SelectAllByClass(const ClassField& field)
 
 void EventBuffer::ClearWritten()
 {
-	auto written = [this](const SOERecord & record)
+	auto pNode = selection.Head();
+
+	while (pNode)
 	{
-		if (record.written)
-		{
-			this->RemoveFromCounts(record);
-			return true;
-		}
-		else
+		auto pNext = SelectionList::Next(pNode);
+
+		if (pNode->value.written)
 		{
-			return false;
+			this->Remove(pNode);
 		}
-	};
 
-	events.RemoveAll(written);
+		pNode = pNext;
+	}
 }
 
 bool EventBuffer::IsTypeOverflown(EventType type) const
@@ -27,7 +27,7 @@
 #include "opendnp3/outstation/IEventRecorder.h"
 #include "opendnp3/outstation/EventCount.h"
 #include "opendnp3/outstation/EventBufferConfig.h"
-#include "opendnp3/outstation/SOERecord.h"
+#include "opendnp3/outstation/SOEList.h"
 
 #include <openpal/container/LinkedList.h>
 
@@ -40,9 +40,11 @@ namespace opendnp3
 	arbitrary parts of the list depending on what the user asks for in terms
 	of event type or Class1/2/3.
 
-	At worst, selection is O(n) in the SOE length but it has some type/class
-	tracking to avoid looping over the SOE list when there are no more events matching
-	the selection criteria.
+	Every record is also threaded on a list of the events of its type and
+	on a list of the events of its class, so that selection only visits the
+	events it can select, and the selected events are kept on their own list,
+	in SOE order, so that writing, unselecting and clearing them never walks
+	the events that are waiting in the buffer.
 */
 
 class EventBuffer : public IEventReceiver, public IEventSelector, public IResponseLoader, private IEventRecorder
@@ -145,6 +147,10 @@ private:
 
 	bool RemoveOldestEventOfType(EventType type);
 
+	void Remove(openpal::ListNode<SOERecord>* node);
+
+	void Select(openpal::ListNode<SOERecord>* node, SelectionList& run);
+
 	template <class Spec>
 	void UpdateAny(const Event<Spec>& evt);
 
@@ -157,6 +163,13 @@ private:
 
 	openpal::LinkedList<SOERecord, uint32_t> events;
 
+	// ---- indices over the SOE
+
+	uint32_t nextSequence;
+	SOEList<&SOERecord::typeLinks> eventsOfType[NUM_OUTSTATION_EVENT_TYPES];
+	SOEList<&SOERecord::classLinks> eventsOfClass[3];
+	SelectionList selection;
+
 	// ---- trakcers
 
 	EventCount totalCounts;
@@ -181,8 +194,19 @@ void EventBuffer::UpdateAny(const Event<Spec>& evt)
 			RemoveOldestEventOfType(Spec::EventTypeEnum);
 		}
 
-		// Add the event, the Reset() ensures that selected/written == false
-		events.Add(SOERecord(evt.value, evt.index, evt.clazz, evt.variation))->value.Reset();
+		auto node = events.Add(SOERecord(evt.value, evt.index, evt.clazz, evt.variation));
+		if (!node)
+		{
+			// the buffer is full of events of other types
+			this->overflow = true;
+			return;
+		}
+
+		// the Reset() ensures that selected/written == false
+		node->value.Reset();
+		node->value.sequence = nextSequence++;
+		eventsOfType[static_cast<uint8_t>(Spec::EventTypeEnum)].Append(node);
+		eventsOfClass[static_cast<uint8_t>(evt.clazz)].Append(node);
 		totalCounts.Increment(evt.clazz, Spec::EventTypeEnum);
 	}
 }
@@ -191,14 +215,14 @@ template <class Spec>
 uint32_t EventBuffer::GenericSelectByType(uint32_t max, bool useDefault, typename Spec::event_variation_t var)
 {
 	uint32_t num = 0;
-	auto iter = events.Iterate();
 	const uint32_t remaining = totalCounts.NumOfType(Spec::EventTypeEnum) - selectedCounts.NumOfType(Spec::EventTypeEnum);
 
-	while (iter.HasNext() && (num < remaining) && (num < max))
-	{
-		auto pNode = iter.Next();
+	SelectionList run;
+	auto pNode = eventsOfType[static_cast<uint8_t>(Spec::EventTypeEnum)].Head();
 
-		if (pNode->value.type == Spec::EventTypeEnum)
+	while (pNode && (num < remaining) && (num < max))
+	{
+		if (!pNode->value.selected)
 		{
 			if (useDefault)
 			{
@@ -209,11 +233,15 @@ uint32_t EventBuffer::GenericSelectByType(uint32_t max, bool useDefault, typenam
 				pNode->value.Select(var);
 			}
 
-			selectedCounts.Increment(pNode->value.clazz, pNode->value.type);
+			this->Select(pNode, run);
 			++num;
 		}
+
+		pNode = SOEList<&SOERecord::typeLinks>::Next(pNode);
 	}
 
+	selection.Merge(run);
+
 	return num;
 }
 
@@ -22,10 +22,9 @@
 #define OPENDNP3_EVENTWRITER_H
 
 #include <openpal/util/Uncopyable.h>
-#include <openpal/container/LinkedList.h>
 
 #include "opendnp3/app/HeaderWriter.h"
-#include "opendnp3/outstation/SOERecord.h"
+#include "opendnp3/outstation/SOEList.h"
 #include "opendnp3/outstation/IEventRecorder.h"
 
 namespace opendnp3
@@ -35,7 +34,7 @@ class EventWriter : openpal::StaticOnly
 {
 public:
 
-	static bool Write(HeaderWriter& writer, IEventRecorder& recorder, openpal::LinkedListIterator<SOERecord> iterator);
+	static bool Write(HeaderWriter& writer, IEventRecorder& recorder, SelectionIterator iterator);
 
 private:
 
@@ -43,11 +42,11 @@ private:
 	{
 	public:
 
-		Result(bool isFragmentFull_, openpal::LinkedListIterator<SOERecord> location_) : isFragmentFull(isFragmentFull_), location(location_)
+		Result(bool isFragmentFull_, SelectionIterator location_) : isFragmentFull(isFragmentFull_), location(location_)
 		{}
 
 		bool isFragmentFull;
-		openpal::LinkedListIterator<SOERecord> location;
+		SelectionIterator location;
 
 
 	private:
@@ -74,7 +73,7 @@ private:
 	template <class Spec>
 	static Result WriteTypeWithSerializer(HeaderWriter& writer, IEventRecorder& recorder, openpal::ListNode<SOERecord>* pLocation, opendnp3::DNP3Serializer<typename Spec::meas_t> serializer, typename Spec::event_variation_t variation)
 	{
-		auto iter = openpal::LinkedListIterator<SOERecord>::From(pLocation);
+		auto iter = SelectionIterator::From(pLocation);
 
 		auto header = writer.IterateOverCountWithPrefix<openpal::UInt16, typename Spec::meas_t>(QualifierCode::UINT16_CNT_UINT16_INDEX, serializer);
 
@@ -96,7 +95,7 @@ private:
 					}
 					else
 					{
-						auto location = openpal::LinkedListIterator<SOERecord>::From(pCurrent);
+						auto location = SelectionIterator::From(pCurrent);
 						return Result(true, location);
 					}
 				}
@@ -109,14 +108,14 @@ private:
 			}
 		}
 
-		auto location = openpal::LinkedListIterator<SOERecord>::From(pCurrent);
+		auto location = SelectionIterator::From(pCurrent);
 		return Result(false, location);
 	}
 
 	template <class Spec, class CTOType>
 	static Result WriteCTOTypeWithSerializer(HeaderWriter& writer, IEventRecorder& recorder, openpal::ListNode<SOERecord>* pLocation, opendnp3::DNP3Serializer<typename Spec::meas_t> serializer, typename Spec::event_variation_t variation)
 	{
-		auto iter = openpal::LinkedListIterator<SOERecord>::From(pLocation);
+		auto iter = SelectionIterator::From(pLocation);
 
 		CTOType cto;
 		cto.time = pLocation->value.GetTime();
@@ -157,7 +156,7 @@ private:
 							}
 							else
 							{
-								auto location = openpal::LinkedListIterator<SOERecord>::From(pCurrent);
+								auto location = SelectionIterator::From(pCurrent);
 								return Result(true, location);
 							}
 						}
@@ -171,7 +170,7 @@ private:
 			}
 		}
 
-		auto location = openpal::LinkedListIterator<SOERecord>::From(pCurrent);
+		auto location = SelectionIterator::From(pCurrent);
 		return Result(false, location);
 	}
 
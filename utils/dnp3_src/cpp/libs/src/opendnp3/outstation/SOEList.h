@@ -0,0 +1,211 @@
+/*
+ * Licensed to Green Energy Corp (www.greenenergycorp.com) under one or
+ * more contributor license agreements. See the NOTICE file distributed
+ * with this work for additional information regarding copyright ownership.
+ * Green Energy Corp licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except in
+ * compliance with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This project was forked on 01/01/2013 by Automatak, LLC and modifications
+ * may have been made to this file. Automatak, LLC licenses these modifications
+ * to you under the terms of the License.
+ */
+#ifndef OPENDNP3_SOELIST_H
+#define OPENDNP3_SOELIST_H
+
+#include "opendnp3/outstation/SOERecord.h"
+
+namespace opendnp3
+{
+
+// true if record a is older than record b. Sequence numbers wrap around
+inline bool IsBefore(const SOERecord& a, const SOERecord& b)
+{
+	return static_cast<int32_t>(a.sequence - b.sequence) < 0;
+}
+
+/*
+	A doubly linked list of SOE records threaded through one of the
+	SOELinks members of the records, so that a record can be on several
+	lists at once without any allocation. The nodes are owned by the
+	SOE list of the EventBuffer.
+*/
+template <SOELinks SOERecord::* links>
+class SOEList
+{
+public:
+
+	typedef openpal::ListNode<SOERecord> node_t;
+
+	node_t* Head() const
+	{
+		return head;
+	}
+
+	bool IsEmpty() const
+	{
+		return head == nullptr;
+	}
+
+	static node_t* Next(node_t* node)
+	{
+		return (node->value.*links).next;
+	}
+
+	void Append(node_t* node)
+	{
+		(node->value.*links).prev = tail;
+		(node->value.*links).next = nullptr;
+
+		if (tail)
+		{
+			(tail->value.*links).next = node;
+		}
+		else
+		{
+			head = node;
+		}
+
+		tail = node;
+	}
+
+	void Remove(node_t* node)
+	{
+		auto& l = node->value.*links;
+
+		if (l.prev)
+		{
+			(l.prev->value.*links).next = l.next;
+		}
+		else
+		{
+			head = l.next;
+		}
+
+		if (l.next)
+		{
+			(l.next->value.*links).prev = l.prev;
+		}
+		else
+		{
+			tail = l.prev;
+		}
+
+		l.prev = l.next = nullptr;
+	}
+
+	void Clear()
+	{
+		head = tail = nullptr;
+	}
+
+	// Moves the records of a list in SOE order into this one, also in SOE order.
+	// O(1) when the other list only has newer records, linear otherwise
+	void Merge(SOEList& other)
+	{
+		if (other.IsEmpty())
+		{
+			return;
+		}
+
+		if (this->IsEmpty() || IsBefore(tail->value, other.head->value))
+		{
+			if (tail)
+			{
+				(tail->value.*links).next = other.head;
+				(other.head->value.*links).prev = tail;
+			}
+			else
+			{
+				head = other.head;
+			}
+			tail = other.tail;
+			other.Clear();
+			return;
+		}
+
+		auto a = head;
+		auto b = other.head;
+		this->Clear();
+		other.Clear();
+
+		while (a || b)
+		{
+			node_t* next;
+			if (b == nullptr || (a && IsBefore(a->value, b->value)))
+			{
+				next = a;
+				a = Next(a);
+			}
+			else
+			{
+				next = b;
+				b = Next(b);
+			}
+			this->Append(next);
+		}
+	}
+
+private:
+
+	node_t* head = nullptr;
+	node_t* tail = nullptr;
+};
+
+// Iterates over the records of a SOEList, with the same interface as openpal::LinkedListIterator
+template <SOELinks SOERecord::* links>
+class SOEListIterator
+{
+public:
+
+	static SOEListIterator Undefined()
+	{
+		return SOEListIterator(nullptr);
+	}
+
+	static SOEListIterator From(openpal::ListNode<SOERecord>* pStart)
+	{
+		return SOEListIterator(pStart);
+	}
+
+	bool HasNext() const
+	{
+		return (pCurrent != nullptr);
+	}
+
+	openpal::ListNode<SOERecord>* Next()
+	{
+		if (pCurrent == nullptr)
+		{
+			return nullptr;
+		}
+		else
+		{
+			auto pRet = pCurrent;
+			pCurrent = SOEList<links>::Next(pCurrent);
+			return pRet;
+		}
+	}
+
+private:
+
+	SOEListIterator(openpal::ListNode<SOERecord>* pStart) : pCurrent(pStart)
+	{}
+
+	openpal::ListNode<SOERecord>* pCurrent;
+};
+
+typedef SOEList<&SOERecord::selectionLinks> SelectionList;
+typedef SOEListIterator<&SOERecord::selectionLinks> SelectionIterator;
+
+}
+
+#endif
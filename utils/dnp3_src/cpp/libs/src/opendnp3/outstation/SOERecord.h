@@ -26,6 +26,7 @@
 #include "opendnp3/app/SecurityStat.h"
 
 #include <openpal/serialization/UInt48Type.h>
+#include <openpal/container/LinkedList.h>
 
 
 namespace opendnp3
@@ -63,6 +64,15 @@ union EventValue
 	ValueAndVariation<SecurityStatSpec> securityStat;
 };
 
+class SOERecord;
+
+// Links of a record on one of the lists kept alongside the SOE, see SOEList
+struct SOELinks
+{
+	openpal::ListNode<SOERecord>* prev = nullptr;
+	openpal::ListNode<SOERecord>* next = nullptr;
+};
+
 class SOERecord
 {
 public:
@@ -107,6 +117,13 @@ public:
 	bool written;
 	void Reset();
 
+	// position in the SOE, used to keep the lists below in SOE order
+	uint32_t sequence = 0;
+
+	SOELinks typeLinks;			// events of the same type
+	SOELinks classLinks;		// events of the same class
+	SOELinks selectionLinks;	// selected events
+
 	DNPTime GetTime() const
 	{
 		return time;
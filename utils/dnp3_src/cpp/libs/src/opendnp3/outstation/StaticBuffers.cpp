@@ -31,7 +31,15 @@ StaticBuffers::StaticBuffers(const DatabaseSizes& dbSizes) :
 	frozenCounters(dbSizes.numFrozenCounter),
 	binaryOutputStatii(dbSizes.numBinaryOutputStatus),
 	analogOutputStatii(dbSizes.numAnalogOutputStatus),
-	timeAndIntervals(dbSizes.numTimeAndInterval)
+	timeAndIntervals(dbSizes.numTimeAndInterval),
+	binaryImage(dbSizes.numBinary),
+	doubleBinaryImage(dbSizes.numDoubleBinary),
+	analogImage(dbSizes.numAnalog),
+	counterImage(dbSizes.numCounter),
+	frozenCounterImage(dbSizes.numFrozenCounter),
+	binaryOutputStatusImage(dbSizes.numBinaryOutputStatus),
+	analogOutputStatusImage(dbSizes.numAnalogOutputStatus),
+	timeAndIntervalImage(dbSizes.numTimeAndInterval)
 {
 	this->SetDefaultIndices<BinarySpec>();
 	this->SetDefaultIndices<DoubleBitBinarySpec>();
@@ -105,6 +113,54 @@ openpal::ArrayView<Cell<TimeAndIntervalSpec>, uint16_t> StaticBuffers::GetArrayV
 	return timeAndIntervals.ToView();
 }
 
+template <>
+StaticImage<BinarySpec>& StaticBuffers::GetImage()
+{
+	return binaryImage;
+}
+
+template <>
+StaticImage<DoubleBitBinarySpec>& StaticBuffers::GetImage()
+{
+	return doubleBinaryImage;
+}
+
+template <>
+StaticImage<CounterSpec>& StaticBuffers::GetImage()
+{
+	return counterImage;
+}
+
+template <>
+StaticImage<FrozenCounterSpec>& StaticBuffers::GetImage()
+{
+	return frozenCounterImage;
+}
+
+template <>
+StaticImage<AnalogSpec>& StaticBuffers::GetImage()
+{
+	return analogImage;
+}
+
+template <>
+StaticImage<BinaryOutputStatusSpec>& StaticBuffers::GetImage()
+{
+	return binaryOutputStatusImage;
+}
+
+template <>
+StaticImage<AnalogOutputStatusSpec>& StaticBuffers::GetImage()
+{
+	return analogOutputStatusImage;
+}
+
+template <>
+StaticImage<TimeAndIntervalSpec>& StaticBuffers::GetImage()
+{
+	return timeAndIntervalImage;
+}
+
 }
 
 
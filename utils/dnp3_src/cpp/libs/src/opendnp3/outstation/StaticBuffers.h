@@ -25,6 +25,7 @@
 
 #include "opendnp3/outstation/Cell.h"
 #include "opendnp3/outstation/DatabaseSizes.h"
+#include "opendnp3/outstation/StaticImage.h"
 
 #include <openpal/container/Array.h>
 #include <openpal/util/Uncopyable.h>
@@ -49,6 +50,10 @@ public:
 	template <class Spec>
 	openpal::ArrayView<Cell<Spec>, uint16_t> GetArrayView();
 
+	// specializations in cpp file
+	template <class Spec>
+	StaticImage<Spec>& GetImage();
+
 private:
 
 	template <class Spec>
@@ -69,6 +74,15 @@ private:
 	openpal::Array<Cell<BinaryOutputStatusSpec>, uint16_t> binaryOutputStatii;
 	openpal::Array<Cell<AnalogOutputStatusSpec>, uint16_t> analogOutputStatii;
 	openpal::Array<Cell<TimeAndIntervalSpec>, uint16_t> timeAndIntervals;
+
+	StaticImage<BinarySpec> binaryImage;
+	StaticImage<DoubleBitBinarySpec> doubleBinaryImage;
+	StaticImage<AnalogSpec> analogImage;
+	StaticImage<CounterSpec> counterImage;
+	StaticImage<FrozenCounterSpec> frozenCounterImage;
+	StaticImage<BinaryOutputStatusSpec> binaryOutputStatusImage;
+	StaticImage<AnalogOutputStatusSpec> analogOutputStatusImage;
+	StaticImage<TimeAndIntervalSpec> timeAndIntervalImage;
 };
 
 }
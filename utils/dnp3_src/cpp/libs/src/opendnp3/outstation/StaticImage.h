@@ -0,0 +1,155 @@
+/*
+ * Licensed to Green Energy Corp (www.greenenergycorp.com) under one or
+ * more contributor license agreements. See the NOTICE file distributed
+ * with this work for additional information regarding copyright ownership.
+ * Green Energy Corp licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except in
+ * compliance with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This project was forked on 01/01/2013 by Automatak, LLC and modifications
+ * may have been made to this file. Automatak, LLC licenses these modifications
+ * to you under the terms of the License.
+ */
+#ifndef OPENDNP3_STATICIMAGE_H
+#define OPENDNP3_STATICIMAGE_H
+
+#include "opendnp3/outstation/Cell.h"
+
+#include <openpal/container/Array.h>
+#include <openpal/container/WSlice.h>
+#include <openpal/serialization/Serializer.h>
+#include <openpal/util/Uncopyable.h>
+
+namespace opendnp3
+{
+
+/**
+* The static values of one type, already serialized, so that static reads (e.g. integrity polls)
+* copy the objects instead of serializing every value again.
+*
+* The points are grouped in blocks. A block holds the objects of all of its points serialized with
+* a single variation, and is invalidated whenever one of its points is updated.
+*/
+template <class Spec>
+class StaticImage : private openpal::Uncopyable
+{
+public:
+
+	/// number of points in a block
+	static const uint16_t BLOCK_SIZE = 64;
+
+	/// size of the largest static object a block can hold (g50v4)
+	static const uint32_t MAX_OBJECT_SIZE = 11;
+
+	struct Block
+	{
+		Block() : valid(false), changedWhileSelected(false), variation(Spec::DefaultStaticVariation)
+		{}
+
+		// the objects are the current values serialized with the variation
+		bool valid;
+
+		// a selected point was updated, so the selected values may differ from the current ones
+		bool changedWhileSelected;
+
+		typename Spec::static_variation_t variation;
+	};
+
+	explicit StaticImage(uint16_t size) :
+		size(size),
+		blocks(NumBlocks(size)),
+		objects(static_cast<uint32_t>(NumBlocks(size)) * BLOCK_SIZE * MAX_OBJECT_SIZE)
+	{}
+
+	/// A point was updated
+	void Invalidate(uint16_t index, bool selected)
+	{
+		auto& block = blocks[index / BLOCK_SIZE];
+		block.valid = false;
+		if (selected)
+		{
+			block.changedWhileSelected = true;
+		}
+	}
+
+	/// Nothing is selected anymore, so the selected values no longer matter
+	void ClearSelection()
+	{
+		for (uint16_t i = 0; i < blocks.Size(); ++i)
+		{
+			blocks[i].changedWhileSelected = false;
+		}
+	}
+
+	Block& GetBlock(uint16_t index)
+	{
+		return blocks[index / BLOCK_SIZE];
+	}
+
+	uint16_t BlockStart(uint16_t index) const
+	{
+		return index - (index % BLOCK_SIZE);
+	}
+
+	uint16_t BlockStop(uint16_t index) const
+	{
+		const uint32_t stop = static_cast<uint32_t>(BlockStart(index)) + BLOCK_SIZE - 1;
+		return (stop < size) ? static_cast<uint16_t>(stop) : (size - 1);
+	}
+
+	/// The object of a point in a valid block, followed by the objects of the points after it in the block
+	const uint8_t* GetObjects(uint16_t index, uint32_t objectSize) const
+	{
+		return &objects[(index / BLOCK_SIZE) * BLOCK_SIZE * MAX_OBJECT_SIZE + (index % BLOCK_SIZE) * objectSize];
+	}
+
+	/**
+	* Serialize the current values of the block of a point
+	*
+	* @return false if the objects of the variation are too big for the image
+	*/
+	bool Build(openpal::ArrayView<Cell<Spec>, uint16_t>& view, uint16_t index, const openpal::Serializer<typename Spec::meas_t>& serializer, typename Spec::static_variation_t variation)
+	{
+		if (serializer.Size() > MAX_OBJECT_SIZE)
+		{
+			return false;
+		}
+
+		const uint16_t start = BlockStart(index);
+		const uint16_t stop = BlockStop(index);
+
+		openpal::WSlice dest(&objects[(index / BLOCK_SIZE) * BLOCK_SIZE * MAX_OBJECT_SIZE], BLOCK_SIZE * MAX_OBJECT_SIZE);
+		for (uint32_t i = start; i <= stop; ++i)
+		{
+			serializer.Write(view[i].value, dest);
+		}
+
+		auto& block = GetBlock(index);
+		block.valid = true;
+		block.variation = variation;
+		return true;
+	}
+
+private:
+
+	static uint16_t NumBlocks(uint16_t size)
+	{
+		return static_cast<uint16_t>((static_cast<uint32_t>(size) + BLOCK_SIZE - 1) / BLOCK_SIZE);
+	}
+
+	uint16_t size;
+	openpal::Array<Block, uint16_t> blocks;
+	openpal::Array<uint8_t, uint32_t> objects;
+};
+
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include "opendnp3/app/MeasurementTypeSpecs.h"
 #include "opendnp3/app/SecurityStat.h"
 #include "opendnp3/outstation/Cell.h"
+#include "opendnp3/outstation/StaticImage.h"
 
 #include "opendnp3/gen/StaticBinaryVariation.h"
 #include "opendnp3/gen/StaticDoubleBinaryVariation.h"
@@ -43,7 +44,7 @@ namespace opendnp3
 template <class Spec>
 struct StaticWriter
 {
-	typedef bool (*Function)(openpal::ArrayView<Cell<Spec>, uint16_t>& view, HeaderWriter& writer, Range& range);
+	typedef bool (*Function)(openpal::ArrayView<Cell<Spec>, uint16_t>& view, StaticImage<Spec>& image, HeaderWriter& writer, Range& range);
 };
 
 StaticWriter<BinarySpec>::Function GetStaticWriter(StaticBinaryVariation variation);
@@ -64,27 +65,80 @@ StaticWriter<TimeAndIntervalSpec>::Function GetStaticWriter(StaticTimeAndInterva
 
 StaticWriter<SecurityStatSpec>::Function GetStaticWriter(StaticSecurityStatVariation variation);
 
+template <class Spec>
+inline bool IsNextInHeader(const Cell<Spec>& cell, typename Spec::static_variation_t variation, uint16_t nextIndex)
+{
+	return cell.selection.selected && (cell.selection.variation == variation) && (cell.config.vIndex == nextIndex);
+}
+
+/**
+* Decide if the objects of a run of selected points in a block can be copied from the image,
+* building the block if needed
+*/
+template <class Spec>
+bool UseImage(openpal::ArrayView<Cell<Spec>, uint16_t>& view, StaticImage<Spec>& image, const openpal::Serializer<typename Spec::meas_t>& serializer, uint16_t start, uint32_t num, typename Spec::static_variation_t variation)
+{
+	auto& block = image.GetBlock(start);
+
+	if (block.changedWhileSelected)
+	{
+		// the selected values may be older than the image
+		return false;
+	}
+
+	if (block.valid && (block.variation == variation))
+	{
+		return true;
+	}
+
+	// only (re)build blocks that are read entirely
+	const bool wholeBlock = (start == image.BlockStart(start)) && (start + num - 1 == image.BlockStop(start));
+	return wholeBlock && image.Build(view, start, serializer, variation);
+}
+
+template <class Spec, class IndexType>
+uint32_t WriteEach(openpal::ArrayView<Cell<Spec>, uint16_t>& view, RangeWriteIterator<IndexType, typename Spec::meas_t>& iterator, uint16_t start, uint32_t num)
+{
+	for (uint32_t i = 0; i < num; ++i)
+	{
+		if (!iterator.Write(view[start + i].selection.value))
+		{
+			return i;
+		}
+	}
+
+	return num;
+}
+
 template <class Spec, class IndexType >
-bool LoadWithRangeIterator(openpal::ArrayView<Cell<Spec>, uint16_t>& view, RangeWriteIterator<IndexType, typename Spec::meas_t>& iterator, Range& range)
+bool LoadWithRangeIterator(openpal::ArrayView<Cell<Spec>, uint16_t>& view, StaticImage<Spec>& image, const openpal::Serializer<typename Spec::meas_t>& serializer, RangeWriteIterator<IndexType, typename Spec::meas_t>& iterator, Range& range)
 {
-	const Cell<Spec>& start = view[range.start];
-	uint16_t nextIndex = start.config.vIndex;
+	const auto variation = view[range.start].selection.variation;
+	uint16_t nextIndex = view[range.start].config.vIndex;
 
-	while (
-	    range.IsValid() &&
-	    view[range.start].selection.selected &&
-	    (view[range.start].selection.variation == start.selection.variation) &&
-	    (view[range.start].config.vIndex == nextIndex)
-	)
+	while (range.IsValid() && IsNextInHeader(view[range.start], variation, nextIndex))
 	{
-		if (iterator.Write(view[range.start].selection.value))
+		// the points of the header that are in the current block of the image
+		const uint16_t stop = (range.stop < image.BlockStop(range.start)) ? range.stop : image.BlockStop(range.start);
+		uint32_t num = 1;
+		while ((range.start + num <= stop) && IsNextInHeader(view[range.start + num], variation, nextIndex + num))
+		{
+			++num;
+		}
+
+		const uint32_t written = UseImage(view, image, serializer, range.start, num, variation) ?
+		                         iterator.WriteSerialized(image.GetObjects(range.start, serializer.Size()), num) :
+		                         WriteEach(view, iterator, range.start, num);
+
+		for (uint32_t i = 0; i < written; ++i)
 		{
 			// deselect the value and advance the range
 			view[range.start].selection.selected = false;
 			range.Advance();
 			++nextIndex;
 		}
-		else
+
+		if (written < num)
 		{
 			return false;
 		}
@@ -124,7 +178,7 @@ bool LoadWithBitfieldIterator(openpal::ArrayView<Cell<Spec>, uint16_t>& view, Bi
 }
 
 template <class Spec, class GV>
-bool WriteSingleBitfield(openpal::ArrayView<Cell<Spec>, uint16_t>& view, HeaderWriter& writer, Range& range)
+bool WriteSingleBitfield(openpal::ArrayView<Cell<Spec>, uint16_t>& view, StaticImage<Spec>& image, HeaderWriter& writer, Range& range)
 {
 	auto start = view[range.start].config.vIndex;
 	auto stop = view[range.stop].config.vIndex;
@@ -144,7 +198,7 @@ bool WriteSingleBitfield(openpal::ArrayView<Cell<Spec>, uint16_t>& view, HeaderW
 
 
 template <class Spec, class Serializer>
-bool WriteWithSerializer(openpal::ArrayView<Cell<Spec>, uint16_t>& view, HeaderWriter& writer, Range& range)
+bool WriteWithSerializer(openpal::ArrayView<Cell<Spec>, uint16_t>& view, StaticImage<Spec>& image, HeaderWriter& writer, Range& range)
 {
 	auto start = view[range.start].config.vIndex;
 	auto stop = view[range.stop].config.vIndex;
@@ -153,12 +207,12 @@ bool WriteWithSerializer(openpal::ArrayView<Cell<Spec>, uint16_t>& view, HeaderW
 	if (mapped.IsOneByte())
 	{
 		auto iter = writer.IterateOverRange<openpal::UInt8, typename Serializer::Target>(QualifierCode::UINT8_START_STOP, Serializer::Inst(), static_cast<uint8_t>(mapped.start));
-		return LoadWithRangeIterator<Spec, openpal::UInt8>(view, iter, range);
+		return LoadWithRangeIterator<Spec, openpal::UInt8>(view, image, Serializer::Inst(), iter, range);
 	}
 	else
 	{
 		auto iter = writer.IterateOverRange<openpal::UInt16, typename Serializer::Target>(QualifierCode::UINT16_START_STOP, Serializer::Inst(), mapped.start);
-		return LoadWithRangeIterator<Spec, openpal::UInt16>(view, iter, range);
+		return LoadWithRangeIterator<Spec, openpal::UInt16>(view, image, Serializer::Inst(), iter, range);
 	}
 }
 
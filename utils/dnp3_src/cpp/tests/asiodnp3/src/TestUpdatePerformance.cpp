@@ -0,0 +1,107 @@
+/*
+ * Licensed to Green Energy Corp (www.greenenergycorp.com) under one or
+ * more contributor license agreements. See the NOTICE file distributed
+ * with this work for additional information regarding copyright ownership.
+ * Green Energy Corp licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except in
+ * compliance with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This project was forked on 01/01/2013 by Automatak, LLC and modifications
+ * may have been made to this file. Automatak, LLC licenses these modifications
+ * to you under the terms of the License.
+ */
+
+#include <catch.hpp>
+
+#include <asiodnp3/UpdateBuilder.h>
+
+#include <opendnp3/outstation/Database.h>
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using namespace opendnp3;
+using namespace asiodnp3;
+
+#define SUITE(name) "UpdatePerformanceTestSuite - " name
+
+namespace
+{
+
+class NullEventReceiver final : public IEventReceiver
+{
+public:
+
+	void Update(const Event<BinarySpec>& evt) override {}
+	void Update(const Event<DoubleBitBinarySpec>& evt) override {}
+	void Update(const Event<AnalogSpec>& evt) override {}
+	void Update(const Event<CounterSpec>& evt) override {}
+	void Update(const Event<FrozenCounterSpec>& evt) override {}
+	void Update(const Event<BinaryOutputStatusSpec>& evt) override {}
+	void Update(const Event<AnalogOutputStatusSpec>& evt) override {}
+};
+
+template <class Fun>
+uint64_t PointsPerSecond(uint64_t points, Fun fun)
+{
+	const auto start = std::chrono::steady_clock::now();
+	fun();
+	const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+	return (points * 1000000) / std::max<int64_t>(microseconds.count(), 1);
+}
+
+}
+
+// compares building and applying one update per point against one update per range
+TEST_CASE(SUITE("RangeVersusSinglePointUpdates"))
+{
+	const uint16_t NUM_POINTS = 1024;
+	const int NUM_ITERATIONS = 200;
+
+	NullEventReceiver receiver;
+	Database db(DatabaseSizes::AnalogOnly(NUM_POINTS), receiver, IndexMode::Contiguous, StaticTypeBitField::AllTypes());
+
+	std::vector<Analog> values(NUM_POINTS);
+
+	const auto single = PointsPerSecond(static_cast<uint64_t>(NUM_POINTS) * NUM_ITERATIONS, [&]()
+	{
+		for (int i = 0; i < NUM_ITERATIONS; ++i)
+		{
+			UpdateBuilder builder;
+			for (uint16_t j = 0; j < NUM_POINTS; ++j)
+			{
+				values[j] = Analog(i + j, 0x01);
+				builder.Update(values[j], j);
+			}
+			builder.Build().Apply(db);
+		}
+	});
+
+	const auto range = PointsPerSecond(static_cast<uint64_t>(NUM_POINTS) * NUM_ITERATIONS, [&]()
+	{
+		for (int i = 0; i < NUM_ITERATIONS; ++i)
+		{
+			UpdateBuilder builder;
+			for (uint16_t j = 0; j < NUM_POINTS; ++j)
+			{
+				values[j] = Analog(i + j + 1, 0x01);
+			}
+			builder.UpdateRange(values.data(), 0, NUM_POINTS);
+			builder.Build().Apply(db);
+		}
+	});
+
+	std::cout << "single point updates: " << single << " points per/sec" << std::endl;
+	std::cout << "range updates: " << range << " points per/sec" << std::endl;
+
+	REQUIRE(db.GetConfigView().analogs[NUM_POINTS - 1].value.value == NUM_ITERATIONS + NUM_POINTS - 1);
+}
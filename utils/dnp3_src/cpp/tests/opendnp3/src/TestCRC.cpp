@@ -29,6 +29,7 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <chrono>
 
 using namespace std;
 using namespace opendnp3;
@@ -43,4 +44,115 @@ TEST_CASE(SUITE("CrcTest"))
 	REQUIRE(CRC::CalcCrc(hs, 8) == 0x21E9);
 }
 
+namespace
+{
+
+// bit at a time reference of the DNP3 CRC, independent of the tables
+uint16_t ReferenceCrc(const uint8_t* input, uint32_t length)
+{
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		crc ^= input[i];
+		for (int bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? ((crc >> 1) ^ 0xA6BC) : (crc >> 1);
+		}
+	}
+	return ~crc;
+}
+
+// byte at a time table implementation, as used before slice-by-8
+uint16_t BytewiseCrc(const uint8_t* input, uint32_t length)
+{
+	static uint16_t table[256];
+	static bool init = false;
+	if (!init)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint8_t byte = static_cast<uint8_t>(i);
+			table[i] = ~ReferenceCrc(&byte, 1);
+		}
+		init = true;
+	}
+
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		crc = table[(crc ^ input[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+std::vector<uint8_t> PseudoRandomBytes(uint32_t size)
+{
+	std::vector<uint8_t> bytes(size);
+	uint32_t state = 0x12345678;
+	for (auto& byte : bytes)
+	{
+		state = state * 1103515245 + 12345;
+		byte = static_cast<uint8_t>(state >> 16);
+	}
+	return bytes;
+}
+
+}
 
+TEST_CASE(SUITE("MatchesReferenceForAllLengthsAndAlignments"))
+{
+	auto data = PseudoRandomBytes(512);
+
+	for (uint32_t offset = 0; offset < 8; ++offset)
+	{
+		for (uint32_t length = 0; length <= 300; ++length)
+		{
+			REQUIRE(CRC::CalcCrc(data.data() + offset, length) == ReferenceCrc(data.data() + offset, length));
+		}
+	}
+}
+
+TEST_CASE(SUITE("CalcCrcAndCopy"))
+{
+	auto data = PseudoRandomBytes(300);
+
+	for (uint32_t length = 0; length <= 300; length += 7)
+	{
+		std::vector<uint8_t> copy(length + 1, 0xAA);
+		REQUIRE(CRC::CalcCrcAndCopy(data.data(), copy.data(), length) == ReferenceCrc(data.data(), length));
+		REQUIRE(std::equal(data.begin(), data.begin() + length, copy.begin()));
+		REQUIRE(copy[length] == 0xAA);
+	}
+}
+
+TEST_CASE(SUITE("Throughput"))
+{
+	const uint32_t SIZE = 2048;
+	const int ITERATIONS = 200;
+
+	auto data = PseudoRandomBytes(SIZE);
+	volatile uint16_t sink = 0; // keeps the loops from being optimized away
+
+	auto measure = [&](uint32_t blockSize, uint16_t (*calc)(const uint8_t*, uint32_t)) -> uint64_t
+	{
+		uint16_t sum = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < ITERATIONS; ++i)
+		{
+			for (uint32_t pos = 0; pos + blockSize <= SIZE; pos += blockSize)
+			{
+				sum ^= calc(data.data() + pos, blockSize);
+			}
+		}
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		sink = sum;
+		return (static_cast<uint64_t>(SIZE) * ITERATIONS * 1000) / std::max<int64_t>(ns, 1);
+	};
+
+	for (uint32_t blockSize : { 16u, 2048u })
+	{
+		auto bytewise = measure(blockSize, &BytewiseCrc);
+		auto sliced = measure(blockSize, &CRC::CalcCrc);
+		std::cout << "CRC of " << blockSize << " byte blocks: byte at a time " << bytewise << " MB/s, slice-by-8 " << sliced << " MB/s" << std::endl;
+	}
+}
@@ -22,14 +22,20 @@
 
 #include "mocks/MeasurementComparisons.h"
 #include "mocks/DatabaseTestObject.h"
+#include "mocks/APDUHelpers.h"
 
 #include <opendnp3/app/QualityMasks.h>
 
+#include <testlib/HexConversions.h>
+
 #include <limits>
+#include <iostream>
+#include <chrono>
 
 using namespace std;
 using namespace openpal;
 using namespace opendnp3;
+using namespace testlib;
 
 template <class Spec>
 void TestBufferForEvent(bool isEvent, const typename Spec::meas_t& newVal, DatabaseTestObject& test, std::deque< Event <Spec> >& queue)
@@ -179,4 +185,184 @@ TEST_CASE(SUITE("CounterLastReportedChange"))
 	TestBufferForEvent(true, Counter(0, ToUnderlying(CounterQuality::RESTART)), t, t.buffer.counterEvents);
 }
 
+// range updates behave like consecutive single updates
+TEST_CASE(SUITE("AnalogRangeUpdate"))
+{
+	DatabaseTestObject t(DatabaseSizes::AnalogOnly(5));
+	auto view = t.db.GetConfigView();
+	for (uint16_t i = 0; i < 5; ++i)
+	{
+		view.analogs[i].config.clazz = PointClass::Class1;
+	}
+
+	Analog values[] = { Analog(1, 0x01), Analog(2, 0x01), Analog(3, 0x01) };
+	REQUIRE(t.db.UpdateRange(values, 1, 3) == 3);
+
+	REQUIRE(t.buffer.analogEvents.size() == 3);
+	for (uint16_t i = 0; i < 3; ++i)
+	{
+		REQUIRE(t.buffer.analogEvents[i].index == i + 1);
+		REQUIRE(t.buffer.analogEvents[i].value.value == i + 1);
+		REQUIRE(view.analogs[i + 1].value.value == i + 1);
+	}
+	REQUIRE(view.analogs[0].value.value == 0);
+	REQUIRE(view.analogs[4].value.value == 0);
+
+	// unchanged values don't produce events
+	REQUIRE(t.db.UpdateRange(values, 1, 3) == 3);
+	REQUIRE(t.buffer.analogEvents.size() == 3);
+}
+
+TEST_CASE(SUITE("BinaryRangeUpdateSuppressEvents"))
+{
+	DatabaseTestObject t(DatabaseSizes::BinaryOnly(2));
+	auto view = t.db.GetConfigView();
+	view.binaries[0].config.clazz = PointClass::Class1;
+	view.binaries[1].config.clazz = PointClass::Class1;
+
+	Binary values[] = { Binary(true, 0x01), Binary(true, 0x01) };
+	REQUIRE(t.db.UpdateRange(values, 0, 2, EventMode::Suppress) == 2);
+	REQUIRE(t.buffer.binaryEvents.empty());
+	REQUIRE(view.binaries[0].value.value);
+	REQUIRE(view.binaries[1].value.value);
+}
+
+TEST_CASE(SUITE("RangeUpdatePastTheEndIsTruncated"))
+{
+	DatabaseTestObject t(DatabaseSizes::CounterOnly(3));
+	auto view = t.db.GetConfigView();
+
+	Counter values[] = { Counter(7), Counter(8), Counter(9) };
+	REQUIRE(t.db.UpdateRange(values, 1, 3) == 2);
+	REQUIRE(view.counters[1].value.value == 7);
+	REQUIRE(view.counters[2].value.value == 8);
+
+	REQUIRE(t.db.UpdateRange(values, 3, 3) == 0);
+	REQUIRE(t.db.UpdateRange(values, 0xFFFF, 3) == 0);
+	REQUIRE(t.db.UpdateRange(values, 0, 0) == 0);
+}
+
+TEST_CASE(SUITE("RangeUpdateDiscontiguous"))
+{
+	DatabaseTestObject t(DatabaseSizes::AnalogOutputStatusOnly(3), IndexMode::Discontiguous);
+	auto view = t.db.GetConfigView();
+	view.analogOutputStatii[0].config.vIndex = 2;
+	view.analogOutputStatii[1].config.vIndex = 4;
+	view.analogOutputStatii[2].config.vIndex = 5;
+
+	// covers virtual indices 3, 4 and 5; index 3 doesn't exist
+	AnalogOutputStatus values[] = { AnalogOutputStatus(30), AnalogOutputStatus(40), AnalogOutputStatus(50) };
+	REQUIRE(t.db.UpdateRange(values, 3, 3) == 2);
+	REQUIRE(view.analogOutputStatii[0].value.value == 0);
+	REQUIRE(view.analogOutputStatii[1].value.value == 40);
+	REQUIRE(view.analogOutputStatii[2].value.value == 50);
+
+	REQUIRE(t.db.UpdateRange(values, 6, 3) == 0);
+}
+
+// the objects of a class 0 read, one line per fragment
+std::string ReadClass0(Database& db, uint32_t fragSize)
+{
+	std::string objects;
+	db.GetStaticSelector().SelectAll(GroupVariation::Group60Var1);
+
+	bool complete = false;
+	while (!complete)
+	{
+		auto response = APDUHelpers::Response(fragSize);
+		auto writer = response.GetWriter();
+		complete = db.GetResponseLoader().Load(writer);
+		objects += ToHex(response.ToRSlice().Skip(4)) + "\n";
+	}
+
+	return objects;
+}
+
+TEST_CASE(SUITE("StaticImageIsInvalidatedByUpdates"))
+{
+	const uint16_t NUM = 150; // a partial block at the end
+
+	DatabaseTestObject cached(DatabaseSizes::AnalogOnly(NUM));
+	REQUIRE(ReadClass0(cached.db, 2048) != "");
+
+	Analog values[NUM];
+	for (uint16_t i = 0; i < NUM; ++i)
+	{
+		values[i] = Analog(i, 0x01);
+	}
+	cached.db.UpdateRange(values, 0, NUM);
+	cached.db.Update(Analog(-3, 0x01), 70);
+	cached.db.Modify(FlagsType::AnalogInput, 140, 149, 0x02);
+
+	// compare to a database that never built an image
+	DatabaseTestObject fresh(DatabaseSizes::AnalogOnly(NUM));
+	fresh.db.UpdateRange(values, 0, NUM);
+	fresh.db.Update(Analog(-3, 0x01), 70);
+	fresh.db.Modify(FlagsType::AnalogInput, 140, 149, 0x02);
+
+	for (uint32_t fragSize : { 2048u, 100u })
+	{
+		auto expected = ReadClass0(fresh.db, fragSize);
+		REQUIRE(ReadClass0(cached.db, fragSize) == expected);
+		REQUIRE(ReadClass0(cached.db, fragSize) == expected);
+	}
+}
+
+TEST_CASE(SUITE("StaticImageKeepsSelectedValues"))
+{
+	DatabaseTestObject t(DatabaseSizes::CounterOnly(2));
+	t.db.Update(Counter(1), 0);
+	t.db.Update(Counter(2), 1);
+	REQUIRE(ReadClass0(t.db, 2048) == "14 01 00 00 01 01 01 00 00 00 01 02 00 00 00\n");
+
+	// values are reported as they were when they were selected
+	t.db.GetStaticSelector().SelectAll(GroupVariation::Group60Var1);
+	t.db.Update(Counter(3), 1);
+
+	auto response = APDUHelpers::Response(2048);
+	auto writer = response.GetWriter();
+	REQUIRE(t.db.GetResponseLoader().Load(writer));
+	REQUIRE(ToHex(response.ToRSlice().Skip(4)) == "14 01 00 00 01 01 01 00 00 00 01 02 00 00 00");
+
+	REQUIRE(ReadClass0(t.db, 2048) == "14 01 00 00 01 01 01 00 00 00 01 03 00 00 00\n");
+}
 
+TEST_CASE(SUITE("IntegrityPollThroughput"))
+{
+	const uint16_t NUM = 10000;
+	const int POLLS = 50;
+
+	DatabaseTestObject t(DatabaseSizes::AnalogOnly(NUM));
+	Analog values[NUM];
+
+	auto measure = [&](bool updateAll) -> int64_t
+	{
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < POLLS; ++i)
+		{
+			if (updateAll)
+			{
+				for (uint16_t j = 0; j < NUM; ++j)
+				{
+					values[j] = Analog(i + j, 0x01);
+				}
+				t.db.UpdateRange(values, 0, NUM, EventMode::Suppress);
+			}
+
+			uint32_t fragments = 0;
+			t.db.GetStaticSelector().SelectAll(GroupVariation::Group60Var1);
+			for (bool complete = false; !complete; ++fragments)
+			{
+				auto response = APDUHelpers::Response(2048);
+				auto writer = response.GetWriter();
+				complete = t.db.GetResponseLoader().Load(writer);
+			}
+			REQUIRE(fragments == 25); // 2044 bytes in each fragment, 5 bytes per value
+		}
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / POLLS;
+	};
+
+	auto changed = measure(true);
+	auto unchanged = measure(false);
+	std::cout << "Integrity poll of " << NUM << " analogs: " << changed << " us with every value changed, " << unchanged << " us with no value changed" << std::endl;
+}
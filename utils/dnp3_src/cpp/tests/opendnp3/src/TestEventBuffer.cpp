@@ -0,0 +1,177 @@
+/*
+ * Licensed to Green Energy Corp (www.greenenergycorp.com) under one or
+ * more contributor license agreements. See the NOTICE file distributed
+ * with this work for additional information regarding copyright ownership.
+ * Green Energy Corp licenses this file to you under the Apache License,
+ * Version 2.0 (the "License"); you may not use this file except in
+ * compliance with the License.  You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * This project was forked on 01/01/2013 by Automatak, LLC and modifications
+ * may have been made to this file. Automatak, LLC licenses these modifications
+ * to you under the terms of the License.
+ */
+#include <catch.hpp>
+
+#include "mocks/APDUHelpers.h"
+
+#include <opendnp3/outstation/EventBuffer.h>
+
+#include <testlib/HexConversions.h>
+
+#include <iostream>
+#include <chrono>
+
+using namespace std;
+using namespace openpal;
+using namespace opendnp3;
+using namespace testlib;
+
+#define SUITE(name) "EventBuffer - " name
+
+void AddBinary(EventBuffer& buffer, uint16_t index, bool value, EventClass clazz = EventClass::EC1)
+{
+	buffer.Update(Event<BinarySpec>(Binary(value), index, clazz, EventBinaryVariation::Group2Var1));
+}
+
+void AddAnalog(EventBuffer& buffer, uint16_t index, double value, EventClass clazz = EventClass::EC2)
+{
+	buffer.Update(Event<AnalogSpec>(Analog(value), index, clazz, EventAnalogVariation::Group32Var1));
+}
+
+std::string LoadEvents(EventBuffer& buffer, uint32_t size = 2048)
+{
+	auto response = APDUHelpers::Response(size);
+	auto writer = response.GetWriter();
+	buffer.Load(writer);
+	return ToHex(response.ToRSlice().Skip(4)); // skip the control, function and IIN
+}
+
+TEST_CASE(SUITE("Selections by type are written in SOE order"))
+{
+	EventBuffer buffer(EventBufferConfig::AllTypes(10));
+	AddBinary(buffer, 0, true);
+	AddAnalog(buffer, 1, 5);
+	AddBinary(buffer, 2, false);
+
+	buffer.SelectAll(GroupVariation::Group32Var0);
+	buffer.SelectAll(GroupVariation::Group2Var0);
+
+	REQUIRE(LoadEvents(buffer) ==
+	        "02 01 28 01 00 00 00 81 "
+	        "20 01 28 01 00 01 00 01 05 00 00 00 "
+	        "02 01 28 01 00 02 00 01");
+	REQUIRE_FALSE(buffer.HasAnySelection());
+}
+
+TEST_CASE(SUITE("Selections by class are written in SOE order"))
+{
+	EventBuffer buffer(EventBufferConfig::AllTypes(10));
+	AddBinary(buffer, 0, true, EventClass::EC1);
+	AddAnalog(buffer, 1, 5, EventClass::EC3);
+	AddAnalog(buffer, 2, 6, EventClass::EC2);
+	AddBinary(buffer, 3, false, EventClass::EC3);
+
+	buffer.SelectAllByClass(ClassField(false, true, false, true));
+
+	REQUIRE(LoadEvents(buffer) ==
+	        "02 01 28 01 00 00 00 81 "
+	        "20 01 28 01 00 01 00 01 05 00 00 00 "
+	        "02 01 28 01 00 03 00 01");
+
+	buffer.ClearWritten();
+	REQUIRE(buffer.UnwrittenClassField().GetBitfield() == ClassField(false, false, true, false).GetBitfield());
+}
+
+TEST_CASE(SUITE("Selecting the same type twice selects each event once"))
+{
+	EventBuffer buffer(EventBufferConfig::AllTypes(10));
+	AddAnalog(buffer, 0, 1);
+	AddAnalog(buffer, 1, 2);
+
+	buffer.SelectAll(GroupVariation::Group32Var0);
+	buffer.SelectAll(GroupVariation::Group32Var0);
+
+	REQUIRE(LoadEvents(buffer) == "20 01 28 02 00 00 00 01 01 00 00 00 01 00 01 02 00 00 00");
+
+	buffer.ClearWritten();
+	REQUIRE(buffer.UnwrittenClassField().GetBitfield() == ClassField().GetBitfield());
+	REQUIRE_FALSE(buffer.HasAnySelection());
+}
+
+TEST_CASE(SUITE("Overflow discards the oldest event even if selected"))
+{
+	EventBuffer buffer(EventBufferConfig(2));
+	AddBinary(buffer, 0, true);
+	AddBinary(buffer, 1, true);
+	buffer.SelectAll(GroupVariation::Group2Var0);
+
+	AddBinary(buffer, 2, true);
+	REQUIRE(buffer.IsOverflown());
+
+	REQUIRE(LoadEvents(buffer) == "02 01 28 01 00 01 00 81");
+
+	buffer.ClearWritten();
+	REQUIRE_FALSE(buffer.IsOverflown());
+	REQUIRE(buffer.UnwrittenClassField().GetBitfield() == ClassField(false, true, false, false).GetBitfield());
+
+	buffer.SelectAll(GroupVariation::Group2Var0);
+	REQUIRE(LoadEvents(buffer) == "02 01 28 01 00 02 00 81");
+}
+
+TEST_CASE(SUITE("Unselect returns written events to the buffer"))
+{
+	EventBuffer buffer(EventBufferConfig::AllTypes(10));
+	AddBinary(buffer, 0, true);
+	AddAnalog(buffer, 1, 5);
+
+	buffer.SelectAllByClass(ClassField::AllEventClasses());
+	REQUIRE(LoadEvents(buffer) != "");
+	buffer.Unselect();
+
+	REQUIRE_FALSE(buffer.HasAnySelection());
+
+	buffer.SelectAll(GroupVariation::Group32Var0);
+	REQUIRE(LoadEvents(buffer) == "20 01 28 01 00 01 00 01 05 00 00 00");
+}
+
+TEST_CASE(SUITE("Polling a few events out of a large buffer"))
+{
+	// the master reads the binary events while the buffer is full of analog events
+	const uint16_t NUM_ANALOGS = 60000;
+	const int POLLS = 1000;
+
+	auto measure = [&](uint16_t numAnalogs) -> int64_t
+	{
+		EventBuffer buffer(EventBufferConfig(POLLS, 0, NUM_ANALOGS));
+
+		for (uint16_t i = 0; i < numAnalogs; ++i)
+		{
+			AddAnalog(buffer, i, i);
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < POLLS; ++i)
+		{
+			AddBinary(buffer, 0, (i % 2) == 0);
+			buffer.SelectAll(GroupVariation::Group2Var0);
+			REQUIRE(LoadEvents(buffer).size() == 23);
+			buffer.ClearWritten();
+		}
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		REQUIRE(buffer.UnwrittenClassField().GetBitfield() == ClassField(false, false, numAnalogs > 0, false).GetBitfield());
+		return ns / POLLS;
+	};
+
+	auto empty = measure(0);
+	auto full = measure(NUM_ANALOGS);
+	std::cout << "Binary event poll: " << empty << " ns with an empty buffer, " << full << " ns with " << NUM_ANALOGS << " analog events buffered" << std::endl;
+}
@@ -174,6 +174,20 @@ TEST_CASE(SUITE("NotSupported"))
 	REQUIRE(ToHex(wrapper) == RepairCRC("05 64 05 1F 01 00 00 04 28 5A"));
 }
 
+TEST_CASE(SUITE("ValidateAndReadUserData"))
+{
+	HexSequence hs("00 01 02 03 04 05 06 07 08 09 0A 0B 0C 0D 0E 0F 10 11 12 13 14 15 16 17 18 19 1A 1B 1C 1D 1E 1F 20 21");
 
+	uint8_t frame[292];
+	WSlice wrapper(frame, 292);
+	LinkFrame::FormatUnconfirmedUserData(wrapper, true, 1, 1024, hs, hs.Size(), nullptr);
 
+	uint8_t userData[250];
+	REQUIRE(LinkFrame::ValidateAndReadUserData(frame + LPDU_HEADER_SIZE, userData, hs.Size()));
+	REQUIRE(ToHex(RSlice(userData, hs.Size())) == ToHex(hs.ToRSlice()));
 
+	// corrupt the last block
+	frame[LPDU_HEADER_SIZE + 2 * LPDU_DATA_PLUS_CRC_SIZE] ^= 0x01;
+	REQUIRE_FALSE(LinkFrame::ValidateAndReadUserData(frame + LPDU_HEADER_SIZE, userData, hs.Size()));
+	REQUIRE_FALSE(LinkFrame::ValidateBodyCRC(frame + LPDU_HEADER_SIZE, hs.Size()));
+}
@@ -0,0 +1,692 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Load test of the Modbus master. A farm of simulated slaves is started on a
+// child process: libmodbus TCP servers on consecutive local ports and RTU
+// slaves on pseudo terminals, with configurable response delays and fault
+// injection. The runtime's modbus_master.cpp polls them from a scan loop
+// like the one in main.cpp, and the achieved poll cycle, the latency of each
+// device, the time the scan spends exchanging data and the CPU used by the
+// master are reported. Run it with -h for the options.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <pthread.h>
+#include <modbus.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <atomic>
+
+#include "ladder.h"
+
+#define MAX_SLAVES          1000
+#define RTU_FRAME_SILENCE   2       //ms without bytes that ends an RTU frame
+
+//-----------------------------------------------------------------------------
+// Runtime symbols the Modbus master depends on. In the runtime they come
+// from main.cpp, glueVars.cpp and the Modbus slave, which aren't part of
+// the benchmark
+//-----------------------------------------------------------------------------
+IEC_BOOL *bool_input[BUFFER_SIZE][8];
+IEC_BOOL *bool_output[BUFFER_SIZE][8];
+IEC_BYTE *byte_input[BUFFER_SIZE];
+IEC_BYTE *byte_output[BUFFER_SIZE];
+IEC_UINT *int_input[BUFFER_SIZE];
+IEC_UINT *int_output[BUFFER_SIZE];
+IEC_UINT *int_memory[BUFFER_SIZE];
+IEC_DINT *dint_memory[BUFFER_SIZE];
+IEC_LINT *lint_memory[BUFFER_SIZE];
+IEC_LINT *special_functions[BUFFER_SIZE];
+pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long common_ticktime__ = 10000000;
+uint8_t run_openplc = 1;
+bool run_modbus_metrics = false;
+bool run_modbus_rtu = false;
+uint32_t io_map_generation = 0;
+
+static bool verbose = false;
+
+void log(unsigned char *logmsg)
+{
+    if (verbose) printf("%s", logmsg);
+}
+
+void sleepms(int milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+int processModbusMessage(unsigned char *buffer, int bufferSize)
+{
+    return 0;
+}
+
+void mapUnusedIO()
+{
+}
+
+uint64_t modbusLockWait()
+{
+    return 0;
+}
+
+int printModbusClientMetrics(char *buffer, int size)
+{
+    return 0;
+}
+
+//Benchmark settings. Static, since modbus_master.cpp has globals with the
+//same names
+static int num_tcp = 10;
+static int num_buses = 0;
+static int slaves_per_bus = 4;
+static int input_registers = 32;
+static int holding_registers = 8;
+static int num_bits = 16;
+static int polling_period = 100;
+static int scan_period = 10;
+static int duration = 10;
+static int warmup = 2;
+static int delay_ms = 0;
+static int jitter_ms = 0;
+static int drop_pct = 0;
+static int exception_pct = 0;
+static int timeout = 1000;
+static int pipeline_depth = 1;
+static int base_port = 15600;
+static bool scan_synchronous = false;
+
+//Counters of each slave, kept on memory shared with the master's process.
+//A poll is counted on the request that reads the first input register
+struct MB_bench_stats
+{
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> faults;
+    std::atomic<uint64_t> polls;
+    std::atomic<uint64_t> last_poll;        //ns, on CLOCK_MONOTONIC
+    std::atomic<uint64_t> interval_sum;     //ns
+    std::atomic<uint64_t> interval_max;     //ns
+};
+
+struct MB_bench_slave
+{
+    char name[100];
+    uint8_t slave_id;
+    int bus;                    //serial port of RTU slaves, -1 for TCP
+    int port;
+    int fd;                     //listening socket or pty master
+    modbus_t *ctx;
+    modbus_mapping_t *map;
+    unsigned int seed;
+    struct MB_bench_stats *stats;
+};
+
+static struct MB_bench_slave slaves[MAX_SLAVES];
+static int num_slaves = 0;
+static char bus_names[MAX_SLAVES][100];
+static std::atomic<uint64_t> *measure_from;        //ns, polls before it are warmup
+
+//-----------------------------------------------------------------------------
+// Returns the current time of the monotonic clock in nanoseconds. The clock
+// is the same for the master and the slave farm
+//-----------------------------------------------------------------------------
+uint64_t benchTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Answers a request received by a simulated slave, after its response delay.
+// Faults are injected by not answering, which makes the master time out, or
+// by answering with a Server Busy exception
+//-----------------------------------------------------------------------------
+void handleRequest(struct MB_bench_slave *slave, uint8_t *query, int size)
+{
+    int header = modbus_get_header_length(slave->ctx);
+    uint8_t function = query[header];
+    uint16_t address = (query[header + 1] << 8) | query[header + 2];
+    struct MB_bench_stats *stats = slave->stats;
+    uint64_t now = benchTime();
+
+    stats->requests++;
+    if (function == MODBUS_FC_READ_INPUT_REGISTERS && address == 0)
+    {
+        uint64_t last_poll = stats->last_poll.exchange(now);
+        if (now >= *measure_from) stats->polls++;
+        if (last_poll >= *measure_from && last_poll != 0)
+        {
+            stats->interval_sum += now - last_poll;
+            if (now - last_poll > stats->interval_max) stats->interval_max = now - last_poll;
+        }
+
+        //inputs change on every poll, like on a real process
+        slave->map->tab_input_registers[0]++;
+    }
+
+    int delay = delay_ms;
+    if (jitter_ms > 0) delay += rand_r(&slave->seed) % (jitter_ms + 1);
+    if (delay > 0) usleep(delay * 1000);
+
+    int fault = rand_r(&slave->seed) % 100;
+    if (fault < drop_pct)
+    {
+        stats->faults++;
+        return;
+    }
+    if (fault < drop_pct + exception_pct)
+    {
+        stats->faults++;
+        modbus_reply_exception(slave->ctx, query, MODBUS_EXCEPTION_SLAVE_OR_SERVER_BUSY);
+        return;
+    }
+
+    modbus_reply(slave->ctx, query, size, slave->map);
+}
+
+//-----------------------------------------------------------------------------
+// Thread of a simulated TCP slave. Like libmodbus' bandwidth-server-many-up,
+// it serves all its connections with select(), so that a master that
+// reconnects before noticing that its old connection died is answered
+//-----------------------------------------------------------------------------
+void *tcpSlave(void *arg)
+{
+    struct MB_bench_slave *slave = (struct MB_bench_slave *)arg;
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+    fd_set refset;
+    fd_set rdset;
+    int fdmax = slave->fd;
+
+    FD_ZERO(&refset);
+    FD_SET(slave->fd, &refset);
+
+    while (1)
+    {
+        rdset = refset;
+        if (select(fdmax + 1, &rdset, NULL, NULL, NULL) < 0)
+        {
+            if (errno == EINTR) continue;
+            perror("select");
+            return NULL;
+        }
+
+        for (int fd = 0; fd <= fdmax; fd++)
+        {
+            if (!FD_ISSET(fd, &rdset)) continue;
+
+            if (fd == slave->fd)
+            {
+                int client = accept(slave->fd, NULL, NULL);
+                if (client < 0) continue;
+                FD_SET(client, &refset);
+                if (client > fdmax) fdmax = client;
+                continue;
+            }
+
+            modbus_set_socket(slave->ctx, fd);
+            int rc = modbus_receive(slave->ctx, query);
+            if (rc > 0)
+            {
+                handleRequest(slave, query, rc);
+            }
+            else if (rc < 0)
+            {
+                close(fd);
+                FD_CLR(fd, &refset);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Thread of a simulated RTU bus. All slaves on the bus share the pty, so the
+// frames are taken from it here and handed to the slave they are addressed
+// to. A frame ends when the line goes silent
+//-----------------------------------------------------------------------------
+void *rtuBus(void *arg)
+{
+    int bus = (int)(intptr_t)arg;
+    int fd = -1;
+    uint8_t frame[MODBUS_RTU_MAX_ADU_LENGTH];
+
+    for (int i = 0; i < num_slaves; i++)
+    {
+        if (slaves[i].bus == bus) fd = slaves[i].fd;
+    }
+
+    while (1)
+    {
+        int size = 0;
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        if (poll(&pfd, 1, -1) <= 0) continue;
+        while (size < (int)sizeof(frame))
+        {
+            int n = read(fd, &frame[size], sizeof(frame) - size);
+            if (n <= 0) break;
+            size += n;
+            if (poll(&pfd, 1, RTU_FRAME_SILENCE) <= 0) break;
+        }
+
+        if (size < 4) continue;
+        uint16_t crc = calculateCRC16(frame, size - 2);
+        if (frame[size - 2] != (crc & 0xFF) || frame[size - 1] != (crc >> 8)) continue;
+
+        for (int i = 0; i < num_slaves; i++)
+        {
+            if (slaves[i].bus == bus && slaves[i].slave_id == frame[0]) handleRequest(&slaves[i], frame, size);
+        }
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Creates the simulated slaves. Their sockets and ptys are opened here,
+// before the slave farm is forked, so that the master can connect to them
+// as soon as it starts
+//-----------------------------------------------------------------------------
+bool createSlaves(struct MB_bench_stats *stats)
+{
+    for (int i = 0; i < num_tcp; i++)
+    {
+        struct MB_bench_slave *slave = &slaves[num_slaves];
+        snprintf(slave->name, sizeof(slave->name), "tcp%d", i);
+        slave->slave_id = 1;
+        slave->bus = -1;
+        slave->port = base_port + i;
+        slave->ctx = modbus_new_tcp("127.0.0.1", slave->port);
+        slave->fd = modbus_tcp_listen(slave->ctx, 4);
+        if (slave->fd < 0)
+        {
+            fprintf(stderr, "Can't listen on port %d: %s\n", slave->port, modbus_strerror(errno));
+            return false;
+        }
+        num_slaves++;
+    }
+
+    for (int bus = 0; bus < num_buses; bus++)
+    {
+        int master_fd, slave_fd;
+        if (openpty(&master_fd, &slave_fd, bus_names[bus], NULL, NULL) < 0)
+        {
+            perror("openpty");
+            return false;
+        }
+
+        //the pty is held open by the slave farm, so that reading it doesn't
+        //fail before the master opens it, and starts raw, so that nothing
+        //is echoed back
+        struct termios tios;
+        tcgetattr(slave_fd, &tios);
+        cfmakeraw(&tios);
+        tcsetattr(slave_fd, TCSANOW, &tios);
+
+        for (int i = 0; i < slaves_per_bus; i++)
+        {
+            struct MB_bench_slave *slave = &slaves[num_slaves];
+            snprintf(slave->name, sizeof(slave->name), "rtu%d_%d", bus, i + 1);
+            slave->slave_id = i + 1;
+            slave->bus = bus;
+            slave->fd = master_fd;
+            slave->ctx = modbus_new_rtu(bus_names[bus], 115200, 'N', 8, 1);
+            modbus_set_socket(slave->ctx, master_fd);
+            num_slaves++;
+        }
+    }
+
+    for (int i = 0; i < num_slaves; i++)
+    {
+        slaves[i].map = modbus_mapping_new(num_bits ? num_bits : 1, num_bits ? num_bits : 1,
+                                           holding_registers ? holding_registers : 1, input_registers);
+        slaves[i].seed = i + 1;
+        slaves[i].stats = &stats[i];
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Runs the slave farm. Never returns
+//-----------------------------------------------------------------------------
+void runSlaves()
+{
+    pthread_t thread;
+
+    for (int i = 0; i < num_slaves; i++)
+    {
+        if (slaves[i].bus < 0) pthread_create(&thread, NULL, tcpSlave, &slaves[i]);
+    }
+    for (int bus = 0; bus < num_buses; bus++)
+    {
+        pthread_create(&thread, NULL, rtuBus, (void *)(intptr_t)bus);
+    }
+
+    while (1) pause();
+}
+
+//-----------------------------------------------------------------------------
+// Writes the mbconfig.cfg polled by the master, with one device for each
+// simulated slave
+//-----------------------------------------------------------------------------
+bool writeConfig(const char *path)
+{
+    FILE *cfg = fopen(path, "w");
+    if (cfg == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    fprintf(cfg, "Num_Devices = \"%d\"\n", num_slaves);
+    fprintf(cfg, "Polling_Period = \"%d\"\n", polling_period);
+    fprintf(cfg, "Timeout = \"%d\"\n", timeout);
+    fprintf(cfg, "Scan_Synchronous = \"%d\"\n", scan_synchronous);
+
+    for (int i = 0; i < num_slaves; i++)
+    {
+        struct MB_bench_slave *slave = &slaves[i];
+        fprintf(cfg, "device%d.name = \"%s\"\n", i, slave->name);
+        fprintf(cfg, "device%d.slave_id = \"%d\"\n", i, slave->slave_id);
+        if (slave->bus < 0)
+        {
+            fprintf(cfg, "device%d.protocol = \"TCP\"\n", i);
+            fprintf(cfg, "device%d.address = \"127.0.0.1\"\n", i);
+            fprintf(cfg, "device%d.IP_Port = \"%d\"\n", i, slave->port);
+            fprintf(cfg, "device%d.Pipeline_Depth = \"%d\"\n", i, pipeline_depth);
+        }
+        else
+        {
+            fprintf(cfg, "device%d.protocol = \"RTU\"\n", i);
+            fprintf(cfg, "device%d.address = \"%s\"\n", i, bus_names[slave->bus]);
+            fprintf(cfg, "device%d.RTU_Baud_Rate = \"115200\"\n", i);
+            fprintf(cfg, "device%d.RTU_Parity = \"N\"\n", i);
+            fprintf(cfg, "device%d.RTU_Data_Bits = \"8\"\n", i);
+            fprintf(cfg, "device%d.RTU_Stop_Bits = \"1\"\n", i);
+        }
+        fprintf(cfg, "device%d.Discrete_Inputs_Start = \"0\"\n", i);
+        fprintf(cfg, "device%d.Discrete_Inputs_Size = \"%d\"\n", i, num_bits);
+        fprintf(cfg, "device%d.Coils_Start = \"0\"\n", i);
+        fprintf(cfg, "device%d.Coils_Size = \"%d\"\n", i, num_bits);
+        fprintf(cfg, "device%d.Input_Registers_Start = \"0\"\n", i);
+        fprintf(cfg, "device%d.Input_Registers_Size = \"%d\"\n", i, input_registers);
+        fprintf(cfg, "device%d.Holding_Registers_Read_Start = \"0\"\n", i);
+        fprintf(cfg, "device%d.Holding_Registers_Read_Size = \"0\"\n", i);
+        fprintf(cfg, "device%d.Holding_Registers_Start = \"0\"\n", i);
+        fprintf(cfg, "device%d.Holding_Registers_Size = \"%d\"\n", i, holding_registers);
+    }
+
+    fclose(cfg);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Attaches a variable to every position of the process image, as the PLC
+// program would, so that the scan copies all the data that fits on it
+//-----------------------------------------------------------------------------
+void attachImage()
+{
+    static IEC_BOOL bools_in[BUFFER_SIZE][8], bools_out[BUFFER_SIZE][8];
+    static IEC_UINT ints_in[BUFFER_SIZE], ints_out[BUFFER_SIZE];
+
+    for (int i = 0; i < BUFFER_SIZE; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            bool_input[i][j] = &bools_in[i][j];
+            bool_output[i][j] = &bools_out[i][j];
+        }
+        int_input[i] = &ints_in[i];
+        int_output[i] = &ints_out[i];
+    }
+
+    io_map_generation++;
+}
+
+int compareTimes(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+void usage(const char *name)
+{
+    printf("Usage: %s [options]\n", name);
+    printf("  -n N    TCP slaves, on consecutive ports (default %d)\n", num_tcp);
+    printf("  -P N    port of the first TCP slave (default %d)\n", base_port);
+    printf("  -u N    RTU buses, each on its own pty (default %d)\n", num_buses);
+    printf("  -U N    RTU slaves on each bus (default %d)\n", slaves_per_bus);
+    printf("  -r N    input registers of each slave (default %d)\n", input_registers);
+    printf("  -w N    holding registers written to each slave (default %d)\n", holding_registers);
+    printf("  -b N    discrete inputs and coils of each slave (default %d)\n", num_bits);
+    printf("  -p MS   polling period (default %d)\n", polling_period);
+    printf("  -s MS   scan cycle of the PLC (default %d)\n", scan_period);
+    printf("  -S      poll in Scan_Synchronous mode\n");
+    printf("  -q N    pipeline depth of the TCP devices (default %d)\n", pipeline_depth);
+    printf("  -T MS   Modbus timeout (default %d)\n", timeout);
+    printf("  -d MS   response delay of the slaves (default %d)\n", delay_ms);
+    printf("  -j MS   random extra delay, up to MS (default %d)\n", jitter_ms);
+    printf("  -f PCT  requests left unanswered (default %d)\n", drop_pct);
+    printf("  -e PCT  requests answered with an exception (default %d)\n", exception_pct);
+    printf("  -t S    measured duration (default %d)\n", duration);
+    printf("  -W S    warmup before measuring (default %d)\n", warmup);
+    printf("  -v      print the master's log\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:P:u:U:r:w:b:p:s:Sq:T:d:j:f:e:t:W:vh")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': num_tcp = atoi(optarg); break;
+            case 'P': base_port = atoi(optarg); break;
+            case 'u': num_buses = atoi(optarg); break;
+            case 'U': slaves_per_bus = atoi(optarg); break;
+            case 'r': input_registers = atoi(optarg); break;
+            case 'w': holding_registers = atoi(optarg); break;
+            case 'b': num_bits = atoi(optarg); break;
+            case 'p': polling_period = atoi(optarg); break;
+            case 's': scan_period = atoi(optarg); break;
+            case 'S': scan_synchronous = true; break;
+            case 'q': pipeline_depth = atoi(optarg); break;
+            case 'T': timeout = atoi(optarg); break;
+            case 'd': delay_ms = atoi(optarg); break;
+            case 'j': jitter_ms = atoi(optarg); break;
+            case 'f': drop_pct = atoi(optarg); break;
+            case 'e': exception_pct = atoi(optarg); break;
+            case 't': duration = atoi(optarg); break;
+            case 'W': warmup = atoi(optarg); break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]); return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (input_registers < 1 || scan_period < 1 || duration < 1 ||
+        num_tcp + num_buses * slaves_per_bus < 1 || num_tcp + num_buses * slaves_per_bus > MAX_SLAVES || slaves_per_bus > 247)
+    {
+        fprintf(stderr, "Invalid options: there must be 1 to %d slaves with at least one input register\n", MAX_SLAVES);
+        return 1;
+    }
+
+    //counters shared with the slave farm
+    size_t shared_size = MAX_SLAVES * sizeof(struct MB_bench_stats) + sizeof(std::atomic<uint64_t>);
+    void *shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    struct MB_bench_stats *stats = (struct MB_bench_stats *)shared;
+    measure_from = (std::atomic<uint64_t> *)&stats[MAX_SLAVES];
+    *measure_from = UINT64_MAX;
+
+    if (!createSlaves(stats)) return 1;
+
+    //the slave farm runs on its own process, so that its CPU isn't counted
+    pid_t farm = fork();
+    if (farm < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (farm == 0) runSlaves();
+
+    char dir[] = "/tmp/mb_master_bench_XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) < 0 || !writeConfig("mbconfig.cfg"))
+    {
+        kill(farm, SIGKILL);
+        return 1;
+    }
+
+    common_ticktime__ = (unsigned long long)scan_period * 1000000ULL;
+    attachImage();
+
+    //the config parser prints every device it reads
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (!verbose) dup2(devnull, STDOUT_FILENO);
+    initializeMB();
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    close(devnull);
+
+    //scan loop, as in main.cpp. Only the exchange with the Modbus master is
+    //timed, not the wait for a Scan_Synchronous cycle
+    int max_scans = (duration * 1000) / scan_period + 1;
+    uint32_t *scan_times = (uint32_t *)malloc(max_scans * sizeof(uint32_t));
+    int num_scans = 0;
+    uint64_t start = benchTime();
+    uint64_t measure_start = start + (uint64_t)warmup * 1000000000ULL;
+    uint64_t end = measure_start + (uint64_t)duration * 1000000000ULL;
+    uint64_t next_scan = start;
+    struct rusage usage_start, usage_end;
+    bool measuring = false;
+
+    while (1)
+    {
+        uint64_t now = benchTime();
+        if (!measuring && now >= measure_start)
+        {
+            measuring = true;
+            *measure_from = now;
+            getrusage(RUSAGE_SELF, &usage_start);
+        }
+        if (now >= end) break;
+
+        waitBuffersIn_MB();
+
+        uint64_t scan_start = benchTime();
+        pthread_mutex_lock(&bufferLock);
+        updateBuffersIn_MB();
+        for (int i = 0; i < BUFFER_SIZE; i++) *int_output[i] = *int_input[i];
+        updateBuffersOut_MB();
+        pthread_mutex_unlock(&bufferLock);
+        if (measuring && num_scans < max_scans) scan_times[num_scans++] = (uint32_t)((benchTime() - scan_start) / 1000);
+
+        next_scan += (uint64_t)scan_period * 1000000ULL;
+        struct timespec ts;
+        ts.tv_sec = next_scan / 1000000000ULL;
+        ts.tv_nsec = next_scan % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+    getrusage(RUSAGE_SELF, &usage_end);
+    uint64_t measured = benchTime() - *measure_from;
+
+    //report
+    static char health[1000000];
+    printModbusMasterHealth(health, sizeof(health));
+    kill(farm, SIGKILL);
+    waitpid(farm, NULL, 0);
+    unlink("mbconfig.cfg");
+    rmdir(dir);
+
+    uint64_t polls = 0, requests = 0, faults = 0, worst_max = 0;
+    double worst_avg = 0, sum_avg = 0;
+    int polled = 0;
+    for (int i = 0; i < num_slaves; i++)
+    {
+        polls += stats[i].polls;
+        requests += stats[i].requests;
+        faults += stats[i].faults;
+        if (stats[i].interval_max > worst_max) worst_max = stats[i].interval_max;
+        if (stats[i].polls > 1)
+        {
+            double avg = (double)stats[i].interval_sum / (stats[i].polls - 1) / 1e6;
+            sum_avg += avg;
+            if (avg > worst_avg) worst_avg = avg;
+            polled++;
+        }
+    }
+
+    qsort(scan_times, num_scans, sizeof(uint32_t), compareTimes);
+    double cpu = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) + (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1e6 +
+                 (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) + (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1e6;
+
+    printf("Modbus master benchmark: %d TCP slaves, %d RTU slaves on %d buses\n", num_tcp, num_buses * slaves_per_bus, num_buses);
+    printf("Each slave: %d input registers, %d holding registers, %d discrete inputs and coils\n",
+           input_registers, holding_registers, num_bits);
+    printf("Slaves: delay %d+%dms, %d%% unanswered, %d%% exceptions\n", delay_ms, jitter_ms, drop_pct, exception_pct);
+    printf("Measured for %.1fs after %ds of warmup\n\n", measured / 1e9, warmup);
+
+    printf("Poll cycle: configured %dms%s, achieved %.1fms on average, %.1fms on the slowest device, %.1fms at worst\n",
+           scan_synchronous ? scan_period : polling_period, scan_synchronous ? " by the scan" : "",
+           polled ? sum_avg / polled : 0.0, worst_avg, worst_max / 1e6);
+    printf("Polls: %llu (%.0f/s), requests: %llu (%.0f/s), faults injected: %llu\n",
+           (unsigned long long)polls, polls / (measured / 1e9), (unsigned long long)requests, requests / (measured / 1e9),
+           (unsigned long long)faults);
+    if (num_scans > 0)
+        printf("Scan: %d scans of %dms, exchange time p50=%uus p99=%uus max=%uus\n", num_scans, scan_period,
+               scan_times[num_scans / 2], scan_times[(int)(num_scans * 0.99)], scan_times[num_scans - 1]);
+    printf("Master CPU: %.1f%% of one core (%.2fs)\n\n", 100.0 * cpu / (measured / 1e9), cpu);
+
+    printf("Device polls and achieved cycle:\n");
+    for (int i = 0; i < num_slaves; i++)
+    {
+        uint64_t device_polls = stats[i].polls;
+        printf("%s polls=%llu avg_ms=%.1f max_ms=%.1f\n", slaves[i].name, (unsigned long long)device_polls,
+               (device_polls > 1) ? (double)stats[i].interval_sum / (device_polls - 1) / 1e6 : 0.0, stats[i].interval_max / 1e6);
+    }
+    printf("\nDevice health:\n%s", health);
+
+    //the polling workers are still running
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,252 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Test of the write-on-change mode of the Modbus master. A block of holding
+// registers too large for one Write Multiple Registers request is written
+// on change to a libmodbus slave, and the test checks that the first write
+// and every refresh cover all the requests the block is split into, and
+// that in between only the values that changed are sent.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <modbus.h>
+
+#include <atomic>
+
+#include "ladder.h"
+#include "mb_test.h"
+
+#define SLAVE_PORT          15690
+#define BLOCK_SIZE          200     //split in 123 + 77 registers
+#define REFRESH             400     //ms
+#define SCAN_PERIOD         20      //ms
+
+//-----------------------------------------------------------------------------
+// Runtime symbols the Modbus master depends on. In the runtime they come
+// from main.cpp, glueVars.cpp and the Modbus slave, which aren't part of
+// the test
+//-----------------------------------------------------------------------------
+IEC_BOOL *bool_input[BUFFER_SIZE][8];
+IEC_BOOL *bool_output[BUFFER_SIZE][8];
+IEC_BYTE *byte_input[BUFFER_SIZE];
+IEC_BYTE *byte_output[BUFFER_SIZE];
+IEC_UINT *int_input[BUFFER_SIZE];
+IEC_UINT *int_output[BUFFER_SIZE];
+IEC_UINT *int_memory[BUFFER_SIZE];
+IEC_DINT *dint_memory[BUFFER_SIZE];
+IEC_LINT *lint_memory[BUFFER_SIZE];
+IEC_LINT *special_functions[BUFFER_SIZE];
+pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+unsigned long long common_ticktime__ = SCAN_PERIOD * 1000000ULL;
+uint8_t run_openplc = 1;
+bool run_modbus_metrics = false;
+bool run_modbus_rtu = false;
+uint32_t io_map_generation = 0;
+
+static bool verbose = false;
+
+void log(unsigned char *logmsg)
+{
+    if (verbose) printf("%s", logmsg);
+}
+
+void sleepms(int milliseconds)
+{
+    usleep(milliseconds * 1000);
+}
+
+int processModbusMessage(unsigned char *buffer, int bufferSize)
+{
+    return 0;
+}
+
+void mapUnusedIO()
+{
+}
+
+uint64_t modbusLockWait()
+{
+    return 0;
+}
+
+int printModbusClientMetrics(char *buffer, int size)
+{
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Slave. Counts the registers written to it, and is reset by the test to
+// look like a slave that restarted
+//-----------------------------------------------------------------------------
+static modbus_mapping_t *slave_map;
+static pthread_mutex_t slave_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<int> registers_written(0);
+static std::atomic<bool> slave_listening(false);
+
+void *slaveThread(void *arg)
+{
+    modbus_t *ctx = modbus_new_tcp("127.0.0.1", SLAVE_PORT);
+    int server_fd = modbus_tcp_listen(ctx, 1);
+    slave_listening = true;
+    if (server_fd < 0) return NULL;
+
+    while (modbus_tcp_accept(ctx, &server_fd) >= 0)
+    {
+        uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+        int rc;
+        while ((rc = modbus_receive(ctx, query)) >= 0)
+        {
+            if (rc == 0) continue;
+
+            //MBAP header + function code + address + quantity
+            uint8_t function = query[7];
+            if (function == MODBUS_FC_WRITE_SINGLE_REGISTER) registers_written += 1;
+            else if (function == MODBUS_FC_WRITE_MULTIPLE_REGISTERS) registers_written += (query[10] << 8) | query[11];
+
+            pthread_mutex_lock(&slave_lock);
+            modbus_reply(ctx, query, rc, slave_map);
+            pthread_mutex_unlock(&slave_lock);
+        }
+        modbus_close(ctx);
+    }
+
+    return NULL;
+}
+
+void resetSlave()
+{
+    pthread_mutex_lock(&slave_lock);
+    for (int i = 0; i < BLOCK_SIZE; i++) slave_map->tab_registers[i] = 0xFFFF;
+    pthread_mutex_unlock(&slave_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Runs the scan loop of main.cpp for the time provided
+//-----------------------------------------------------------------------------
+static IEC_UINT outputs[BLOCK_SIZE];
+
+void runScans(int milliseconds)
+{
+    for (int elapsed = 0; elapsed < milliseconds; elapsed += SCAN_PERIOD)
+    {
+        updateBuffersIn_MB();
+        updateBuffersOut_MB();
+        sleepms(SCAN_PERIOD);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if every register of the slave holds the PLC's output
+//-----------------------------------------------------------------------------
+bool slaveMatches()
+{
+    bool matches = true;
+
+    pthread_mutex_lock(&slave_lock);
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+        if (slave_map->tab_registers[i] != outputs[i])
+        {
+            if (verbose) printf("register %d = %d, expected %d\n", i, slave_map->tab_registers[i], outputs[i]);
+            matches = false;
+        }
+    }
+    pthread_mutex_unlock(&slave_lock);
+
+    return matches;
+}
+
+bool writeConfig()
+{
+    FILE *cfg = fopen("mbconfig.cfg", "w");
+    if (cfg == NULL)
+    {
+        perror("mbconfig.cfg");
+        return false;
+    }
+
+    fprintf(cfg, "Num_Devices = \"1\"\n");
+    fprintf(cfg, "Polling_Period = \"%d\"\n", SCAN_PERIOD);
+    fprintf(cfg, "Timeout = \"1000\"\n");
+    fprintf(cfg, "device0.name = \"change\"\n");
+    fprintf(cfg, "device0.slave_id = \"1\"\n");
+    fprintf(cfg, "device0.protocol = \"TCP\"\n");
+    fprintf(cfg, "device0.address = \"127.0.0.1\"\n");
+    fprintf(cfg, "device0.IP_Port = \"%d\"\n", SLAVE_PORT);
+    fprintf(cfg, "device0.Holding_Registers_Start = \"0\"\n");
+    fprintf(cfg, "device0.Holding_Registers_Size = \"%d\"\n", BLOCK_SIZE);
+    fprintf(cfg, "device0.Holding_Registers_Target = \"%%QW100\"\n");
+    fprintf(cfg, "device0.Holding_Registers_Write_Mode = \"change\"\n");
+    fprintf(cfg, "device0.Holding_Registers_Refresh = \"%d\"\n", REFRESH);
+    fclose(cfg);
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = true;
+
+    slave_map = modbus_mapping_new(0, 0, BLOCK_SIZE, 0);
+    resetSlave();
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, slaveThread, NULL);
+    while (!slave_listening) usleep(1000);
+
+    //mostly zeros, which the slave doesn't hold, with a few other values
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+        outputs[i] = (i % 50 == 5) ? i : 0;
+        int_output[100 + i] = &outputs[i];
+    }
+
+    if (!writeConfig()) return 1;
+    initializeMB();
+
+    //the first write covers every register of both requests
+    runScans(REFRESH / 2);
+    CHECK(slaveMatches());
+    CHECK(registers_written == BLOCK_SIZE);
+
+    //nothing changed, so nothing is written
+    registers_written = 0;
+    runScans(REFRESH / 4);
+    CHECK(registers_written == 0);
+
+    //a single change on the second request goes out alone
+    outputs[180] = 1234;
+    runScans(REFRESH / 4);
+    CHECK(slaveMatches());
+    CHECK(registers_written == 1);
+
+    //a slave that lost its registers gets all of them back on the refresh
+    resetSlave();
+    runScans(REFRESH * 3 / 2);
+    CHECK(slaveMatches());
+
+    run_openplc = 0;
+    sleepms(200);
+
+    return testResult();
+}
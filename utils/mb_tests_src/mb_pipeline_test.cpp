@@ -0,0 +1,334 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Test of the pipelined Modbus/TCP transport of the master. pipelineExecute()
+// talks to a scripted slave on a local socket that answers each read after
+// a delay taken from the request itself, so responses can be reordered,
+// delayed past their timeout or never sent at all.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <atomic>
+
+#include "ladder.h"
+#include "mb_test.h"
+
+#define TIMEOUT             150     //ms, for each transaction
+#define LATE_DELAY          300     //ms, a response that arrives after its transaction timed out
+#define LOST                0xFFFF  //address of a read that is never answered
+#define EXCEPTION           0xFFFE  //address of a read answered with an exception
+#define MAX_PENDING         64
+
+//-----------------------------------------------------------------------------
+// Returns the current time of the monotonic clock in milliseconds
+//-----------------------------------------------------------------------------
+uint64_t monotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//-----------------------------------------------------------------------------
+// Scripted slave. Every request is a read of one holding register, and its
+// address is both the delay of the response in ms and the value returned,
+// except for LOST and EXCEPTION. The slave keeps track of how many requests
+// were waiting for their response at the same time
+//-----------------------------------------------------------------------------
+struct MB_scripted_response
+{
+    uint64_t due;           //ms, on CLOCK_MONOTONIC
+    unsigned char frame[16];
+    int size;
+};
+
+static int listen_fd = -1;
+static std::atomic<int> max_outstanding(0);
+
+void *slaveThread(void *arg)
+{
+    struct MB_scripted_response pending[MAX_PENDING];
+    int num_pending = 0;
+    unsigned char rx[1024];
+    int rx_size = 0;
+
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) return NULL;
+
+    while (1)
+    {
+        //sleep until the next response is due or a request arrives
+        uint64_t now = monotonicMs();
+        int wait_ms = -1;
+        for (int i = 0; i < num_pending; i++)
+        {
+            int wait = (pending[i].due > now) ? (int)(pending[i].due - now) : 0;
+            if (wait_ms < 0 || wait < wait_ms) wait_ms = wait;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, wait_ms) > 0)
+        {
+            int n = recv(fd, &rx[rx_size], sizeof(rx) - rx_size, 0);
+            if (n <= 0) break;
+            rx_size += n;
+
+            //requests are MBAP header + FC3 + address + quantity
+            while (rx_size >= 12)
+            {
+                uint16_t address = (rx[8] << 8) | rx[9];
+                if (address != LOST && num_pending < MAX_PENDING)
+                {
+                    struct MB_scripted_response *response = &pending[num_pending++];
+                    memcpy(response->frame, rx, 7);
+                    response->frame[7] = rx[7];
+                    if (address == EXCEPTION)
+                    {
+                        response->frame[5] = 3;
+                        response->frame[7] |= 0x80;
+                        response->frame[8] = 2;
+                        response->size = 9;
+                        response->due = monotonicMs();
+                    }
+                    else
+                    {
+                        response->frame[5] = 5;
+                        response->frame[8] = 2;
+                        response->frame[9] = address >> 8;
+                        response->frame[10] = address & 0xFF;
+                        response->size = 11;
+                        response->due = monotonicMs() + address;
+                    }
+                    response->frame[4] = 0;
+
+                    if (num_pending > max_outstanding) max_outstanding = num_pending;
+                }
+
+                memmove(rx, &rx[12], rx_size - 12);
+                rx_size -= 12;
+            }
+        }
+
+        //send the responses that are due
+        now = monotonicMs();
+        for (int i = 0; i < num_pending; i++)
+        {
+            if (pending[i].due > now) continue;
+
+            send(fd, pending[i].frame, pending[i].size, MSG_NOSIGNAL);
+            pending[i] = pending[num_pending - 1];
+            num_pending--;
+            i--;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Fills a transaction with a read of one holding register
+//-----------------------------------------------------------------------------
+void setRead(struct MB_transaction *transaction, uint16_t address)
+{
+    transaction->unit_id = 1;
+    transaction->request[0] = 3;
+    transaction->request[1] = address >> 8;
+    transaction->request[2] = address & 0xFF;
+    transaction->request[3] = 0;
+    transaction->request[4] = 1;
+    transaction->request_size = 5;
+    transaction->response_size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Returns true if the transaction completed with the value its slave was
+// scripted to return
+//-----------------------------------------------------------------------------
+bool readMatches(struct MB_transaction *transaction)
+{
+    if (transaction->status != MB_TX_OK || transaction->response_size != 4) return false;
+    return transaction->response[2] == transaction->request[1] && transaction->response[3] == transaction->request[2];
+}
+
+//-----------------------------------------------------------------------------
+// Responses that come back in the opposite order of the requests are matched
+// to their transactions by id
+//-----------------------------------------------------------------------------
+void testOutOfOrder(struct MB_pipeline *pipeline)
+{
+    struct MB_transaction transactions[4];
+    uint16_t delays[4] = {90, 60, 30, 0};
+
+    for (int i = 0; i < 4; i++) setRead(&transactions[i], delays[i]);
+    CHECK(pipelineExecute(pipeline, transactions, 4));
+
+    for (int i = 0; i < 4; i++) CHECK(readMatches(&transactions[i]));
+    CHECK(transactions[3].latency < transactions[2].latency);
+    CHECK(transactions[2].latency < transactions[1].latency);
+    CHECK(transactions[1].latency < transactions[0].latency);
+}
+
+//-----------------------------------------------------------------------------
+// No more than the pipeline depth is ever in flight, and a batch larger than
+// the depth still completes
+//-----------------------------------------------------------------------------
+void testDepthLimit(struct MB_pipeline *pipeline, int depth)
+{
+    struct MB_transaction transactions[12];
+
+    for (int i = 0; i < 12; i++) setRead(&transactions[i], 20);
+    max_outstanding = 0;
+    CHECK(pipelineExecute(pipeline, transactions, 12));
+
+    for (int i = 0; i < 12; i++) CHECK(readMatches(&transactions[i]));
+    CHECK(max_outstanding == depth);
+}
+
+//-----------------------------------------------------------------------------
+// Each transaction's timeout starts when its own request is sent: with a
+// depth of 1 the batch takes longer than one timeout but nothing expires
+//-----------------------------------------------------------------------------
+void testPerTransactionDeadline(struct MB_pipeline *pipeline)
+{
+    struct MB_transaction transactions[3];
+
+    for (int i = 0; i < 3; i++) setRead(&transactions[i], TIMEOUT * 2 / 3);
+    uint64_t start = monotonicMs();
+    CHECK(pipelineExecute(pipeline, transactions, 3));
+    CHECK(monotonicMs() - start > TIMEOUT);
+
+    for (int i = 0; i < 3; i++) CHECK(readMatches(&transactions[i]));
+}
+
+//-----------------------------------------------------------------------------
+// A late and a lost response time out on their own, without holding back
+// the transactions around them. The late response arrives while the next
+// batch is in flight, and must not be taken for one of its responses
+//-----------------------------------------------------------------------------
+void testLateAndLost(struct MB_pipeline *pipeline)
+{
+    struct MB_transaction transactions[5];
+    setRead(&transactions[0], 10);
+    setRead(&transactions[1], LATE_DELAY);
+    setRead(&transactions[2], LOST);
+    setRead(&transactions[3], EXCEPTION);
+    setRead(&transactions[4], 20);
+
+    uint64_t start = monotonicMs();
+    CHECK(pipelineExecute(pipeline, transactions, 5));
+    uint64_t elapsed = monotonicMs() - start;
+    CHECK(elapsed >= TIMEOUT && elapsed < LATE_DELAY);
+
+    CHECK(readMatches(&transactions[0]));
+    CHECK(transactions[1].status == MB_TX_TIMEOUT);
+    CHECK(transactions[2].status == MB_TX_TIMEOUT);
+    CHECK(transactions[3].status == MB_TX_EXCEPTION);
+    CHECK(readMatches(&transactions[4]));
+
+    //two rounds of reads, so that the late response is due while the second
+    //one is in flight
+    struct MB_transaction next[8];
+    for (int i = 0; i < 8; i++) setRead(&next[i], 100 + i);
+    CHECK(pipelineExecute(pipeline, next, 8));
+    CHECK(monotonicMs() - start > LATE_DELAY);
+
+    for (int i = 0; i < 8; i++) CHECK(readMatches(&next[i]));
+}
+
+//-----------------------------------------------------------------------------
+// Opens a pipeline with the depth provided on a new connection to the slave
+//-----------------------------------------------------------------------------
+struct MB_pipeline *connectPipeline(uint16_t port, int depth, pthread_t *thread)
+{
+    pthread_create(thread, NULL, slaveThread, NULL);
+
+    struct MB_pipeline *pipeline = createPipeline("127.0.0.1", port, depth, TIMEOUT);
+    int fd = startConnect("127.0.0.1", port);
+    if (fd < 0) return pipeline;
+
+    uint64_t deadline = monotonicMs() + 1000;
+    int ret;
+    while ((ret = finishConnect(fd)) == 0 && monotonicMs() < deadline) usleep(1000);
+    if (ret > 0) pipelineSetSocket(pipeline, fd);
+    else close(fd);
+
+    return pipeline;
+}
+
+void disconnectPipeline(struct MB_pipeline *pipeline, pthread_t thread)
+{
+    pipelineClose(pipeline);
+    pthread_join(thread, NULL);
+    free(pipeline);
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_in server_addr;
+    socklen_t addr_len = sizeof(server_addr);
+    pthread_t thread;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = 0;
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+        listen(listen_fd, 1) < 0 || getsockname(listen_fd, (struct sockaddr *)&server_addr, &addr_len) < 0)
+    {
+        perror("listen");
+        return 1;
+    }
+    uint16_t port = ntohs(server_addr.sin_port);
+
+    //no connection yet
+    struct MB_pipeline *pipeline = createPipeline("127.0.0.1", port, 4, TIMEOUT);
+    struct MB_transaction transaction;
+    setRead(&transaction, 0);
+    CHECK(!pipelineExecute(pipeline, &transaction, 1));
+    CHECK(transaction.status == MB_TX_ERROR);
+    free(pipeline);
+
+    pipeline = connectPipeline(port, 4, &thread);
+    testOutOfOrder(pipeline);
+    testDepthLimit(pipeline, 4);
+    testLateAndLost(pipeline);
+    disconnectPipeline(pipeline, thread);
+
+    pipeline = connectPipeline(port, 1, &thread);
+    testDepthLimit(pipeline, 1);
+    testPerTransactionDeadline(pipeline);
+    disconnectPipeline(pipeline, thread);
+
+    close(listen_fd);
+
+    return testResult();
+}
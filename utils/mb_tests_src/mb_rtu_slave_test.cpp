@@ -0,0 +1,304 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Test of the Modbus RTU slave. processRTUFrame() is checked directly, and
+// then the slave is started on one side of a pseudo terminal while the test
+// plays the master on the other side, checking that frames are delimited by
+// the t3.5 silence and that frames with a bad CRC are never answered.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>
+#include <termios.h>
+#include <pthread.h>
+
+#include <atomic>
+
+#include "ladder.h"
+#include "mb_test.h"
+
+#define SLAVE_ID            7
+#define TEST_BAUD           4800    //t3.5 = 7.3ms, long enough to be timed on a loaded machine
+#define NO_RESPONSE_WAIT    100     //ms to wait before deciding that no response was sent
+
+//-----------------------------------------------------------------------------
+// Runtime symbols the Modbus slave depends on. In the runtime they come from
+// main.cpp, glueVars.cpp and the other servers, which aren't part of the test
+//-----------------------------------------------------------------------------
+IEC_BOOL *bool_input[BUFFER_SIZE][8];
+IEC_BOOL *bool_output[BUFFER_SIZE][8];
+IEC_BYTE *byte_input[BUFFER_SIZE];
+IEC_BYTE *byte_output[BUFFER_SIZE];
+IEC_UINT *int_input[BUFFER_SIZE];
+IEC_UINT *int_output[BUFFER_SIZE];
+IEC_UINT *int_memory[BUFFER_SIZE];
+IEC_DINT *dint_memory[BUFFER_SIZE];
+IEC_LINT *lint_memory[BUFFER_SIZE];
+IEC_LINT *special_functions[BUFFER_SIZE];
+pthread_mutex_t bufferLock = PTHREAD_MUTEX_INITIALIZER;
+bool run_modbus_metrics = false;
+bool run_modbus_rtu = false;
+
+static bool verbose = false;
+static std::atomic<bool> slave_listening(false);
+
+void log(unsigned char *logmsg)
+{
+    if (strstr((char *)logmsg, "listening") != NULL) slave_listening = true;
+    if (verbose) printf("%s", logmsg);
+}
+
+int printModbusClientMetrics(char *buffer, int size)
+{
+    return 0;
+}
+
+int printModbusMasterMetrics(char *buffer, int size)
+{
+    return 0;
+}
+
+//modbus_rtu_slave.cpp
+int processRTUFrame(unsigned char *frame, int frameSize, uint8_t slave_id, unsigned char *response);
+
+//-----------------------------------------------------------------------------
+// Builds an RTU request for a function with two 16-bit fields (read
+// registers, write single register). Returns the size of the frame
+//-----------------------------------------------------------------------------
+int buildRequest(unsigned char *frame, uint8_t address, uint8_t function, uint16_t first, uint16_t second)
+{
+    frame[0] = address;
+    frame[1] = function;
+    frame[2] = first >> 8;
+    frame[3] = first & 0xFF;
+    frame[4] = second >> 8;
+    frame[5] = second & 0xFF;
+
+    uint16_t crc = calculateCRC16(frame, 6);
+    frame[6] = crc & 0xFF;
+    frame[7] = crc >> 8;
+
+    return 8;
+}
+
+bool crcIsValid(unsigned char *frame, int size)
+{
+    if (size < 4) return false;
+    uint16_t crc = calculateCRC16(frame, size - 2);
+    return frame[size - 2] == (crc & 0xFF) && frame[size - 1] == (crc >> 8);
+}
+
+//-----------------------------------------------------------------------------
+// Reads whatever the slave sends until the line is silent for wait_ms.
+// Returns the number of bytes received
+//-----------------------------------------------------------------------------
+int readResponse(int fd, unsigned char *buffer, int size, int wait_ms)
+{
+    int received = 0;
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (received < size && poll(&pfd, 1, wait_ms) > 0)
+    {
+        int n = read(fd, &buffer[received], size - received);
+        if (n <= 0) break;
+        received += n;
+    }
+
+    return received;
+}
+
+void sleepus(int microseconds)
+{
+    struct timespec ts;
+    ts.tv_sec = microseconds / 1000000;
+    ts.tv_nsec = (microseconds % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+//-----------------------------------------------------------------------------
+// Checks the conversion between RTU and the Modbus engine without a serial
+// line: a write and a read back, frames with a bad CRC, frames for other
+// slaves and broadcasts
+//-----------------------------------------------------------------------------
+void testProcessFrame()
+{
+    unsigned char frame[256];
+    unsigned char response[256];
+
+    //write single register 10 = 0x1234, answered with an echo of the request
+    int size = buildRequest(frame, SLAVE_ID, 6, 10, 0x1234);
+    int responseSize = processRTUFrame(frame, size, SLAVE_ID, response);
+    CHECK(responseSize == 8);
+    CHECK(memcmp(frame, response, 8) == 0);
+
+    //read it back
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    responseSize = processRTUFrame(frame, size, SLAVE_ID, response);
+    CHECK(responseSize == 7);
+    CHECK(response[0] == SLAVE_ID && response[1] == 3 && response[2] == 2);
+    CHECK(response[3] == 0x12 && response[4] == 0x34);
+    CHECK(crcIsValid(response, responseSize));
+
+    //exceptions keep the slave address and get a valid CRC too
+    size = buildRequest(frame, SLAVE_ID, 3, 60000, 1);
+    responseSize = processRTUFrame(frame, size, SLAVE_ID, response);
+    CHECK(responseSize == 5);
+    CHECK(response[0] == SLAVE_ID && response[1] == 0x83 && response[2] == 2);
+    CHECK(crcIsValid(response, responseSize));
+
+    //a single corrupted bit, on the data or on the CRC itself, drops the frame
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    frame[3] ^= 0x01;
+    CHECK(processRTUFrame(frame, size, SLAVE_ID, response) == 0);
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    frame[7] ^= 0x80;
+    CHECK(processRTUFrame(frame, size, SLAVE_ID, response) == 0);
+
+    //too short to hold a function code and a CRC
+    CHECK(processRTUFrame(frame, 3, SLAVE_ID, response) == 0);
+
+    //frames for other slaves are ignored
+    size = buildRequest(frame, SLAVE_ID + 1, 3, 10, 1);
+    CHECK(processRTUFrame(frame, size, SLAVE_ID, response) == 0);
+
+    //broadcasts are executed but not answered
+    size = buildRequest(frame, 0, 6, 10, 0x5678);
+    CHECK(processRTUFrame(frame, size, SLAVE_ID, response) == 0);
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    responseSize = processRTUFrame(frame, size, SLAVE_ID, response);
+    CHECK(responseSize == 7 && response[3] == 0x56 && response[4] == 0x78);
+}
+
+//-----------------------------------------------------------------------------
+// Runs the RTU slave on the pty
+//-----------------------------------------------------------------------------
+void *slaveThread(void *arg)
+{
+    startRTUSlave((const char *)arg, TEST_BAUD, 'N', 8, 1, SLAVE_ID);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Checks the slave on a serial line. The pty doesn't pace the bytes at the
+// baud rate, so the gaps inside and between frames are produced by the test
+//-----------------------------------------------------------------------------
+void testSerialLine(int fd)
+{
+    unsigned char frame[256];
+    unsigned char response[256];
+    int t35 = rtuInterFrameDelay(TEST_BAUD, 'N', 8, 1);
+
+    //a complete request is answered
+    int size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    write(fd, frame, size);
+    int responseSize = readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT);
+    CHECK(responseSize == 7);
+    CHECK(response[0] == SLAVE_ID && response[1] == 3);
+    CHECK(crcIsValid(response, responseSize));
+
+    //a request with a bad CRC is never answered
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    frame[6] ^= 0xFF;
+    write(fd, frame, size);
+    CHECK(readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT) == 0);
+
+    //a gap shorter than t3.5 inside a frame doesn't split it
+    size = buildRequest(frame, SLAVE_ID, 3, 10, 1);
+    write(fd, frame, 3);
+    sleepus(t35 / 4);
+    write(fd, &frame[3], size - 3);
+    responseSize = readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT);
+    CHECK(responseSize == 7);
+    CHECK(crcIsValid(response, responseSize));
+
+    //a gap longer than t3.5 ends the frame, so both halves are discarded
+    write(fd, frame, 3);
+    sleepus(t35 * 4);
+    write(fd, &frame[3], size - 3);
+    CHECK(readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT) == 0);
+
+    //two requests without a silence between them are a single invalid frame
+    unsigned char pair[16];
+    buildRequest(pair, SLAVE_ID, 3, 10, 1);
+    buildRequest(&pair[8], SLAVE_ID, 3, 11, 1);
+    write(fd, pair, 16);
+    CHECK(readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT) == 0);
+
+    //separated by t3.5, each of them gets its own response
+    write(fd, pair, 8);
+    sleepus(t35 * 4);
+    write(fd, &pair[8], 8);
+    responseSize = readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT);
+    CHECK(responseSize == 14);
+    CHECK(crcIsValid(response, 7) && crcIsValid(&response[7], 7));
+
+    //the slave is still in sync after all the garbage
+    size = buildRequest(frame, SLAVE_ID, 6, 11, 0xBEEF);
+    write(fd, frame, size);
+    responseSize = readResponse(fd, response, sizeof(response), NO_RESPONSE_WAIT);
+    CHECK(responseSize == 8 && memcmp(frame, response, 8) == 0);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-v") == 0) verbose = true;
+
+    initializeModbusMap();
+    mapUnusedIO();
+
+    testProcessFrame();
+
+    int master_fd, slave_fd;
+    char pty_name[64];
+    if (openpty(&master_fd, &slave_fd, pty_name, NULL, NULL) < 0)
+    {
+        perror("openpty");
+        return 1;
+    }
+
+    //the pty starts raw, so that nothing is echoed back before the slave
+    //configures it
+    struct termios tios;
+    tcgetattr(slave_fd, &tios);
+    cfmakeraw(&tios);
+    tcsetattr(slave_fd, TCSANOW, &tios);
+
+    pthread_t thread;
+    run_modbus_rtu = true;
+    pthread_create(&thread, NULL, slaveThread, pty_name);
+
+    //the slave flushes the line when it opens the port
+    for (int i = 0; i < 200 && !slave_listening; i++) usleep(10000);
+    CHECK(slave_listening);
+    usleep(10000);
+
+    if (slave_listening) testSerialLine(master_fd);
+
+    run_modbus_rtu = false;
+    pthread_join(thread, NULL);
+    close(master_fd);
+    close(slave_fd);
+
+    return testResult();
+}
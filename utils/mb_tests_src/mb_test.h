@@ -0,0 +1,56 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Checks shared by the Modbus tests. CHECK() reports a failed condition
+// with its line and keeps going, so that one run shows every failure, and
+// testResult() gives the exit code of the test
+//-----------------------------------------------------------------------------
+
+#ifndef MB_TEST_H
+#define MB_TEST_H
+
+#include <stdio.h>
+
+#define CHECK(cond) checkResult((cond), #cond, __LINE__)
+
+static int failures = 0;
+
+static void checkResult(bool result, const char *expression, int line)
+{
+    if (!result)
+    {
+        printf("FAILED line %d: %s\n", line, expression);
+        failures++;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Prints the outcome of the test. Returns 0 if all checks passed
+//-----------------------------------------------------------------------------
+static int testResult()
+{
+    if (failures > 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
+
+#endif
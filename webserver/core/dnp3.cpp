@@ -25,6 +25,9 @@
 #include <cctype>
 #include <locale>
 #include <fstream>
+#include <sstream>
+#include <vector>
+#include <atomic>
 
 #include "ladder.h"
 
@@ -41,8 +44,6 @@
 #define MIN_64B_RANGE			4096
 #define MAX_64B_RANGE			8191
 
-#define OPLC_CYCLE              50000000
-
 // Initial offset parameters (yurgen1975)
 int offset_di = 0;
 int offset_do = 0;
@@ -56,10 +57,61 @@ using namespace asiopal;
 using namespace asiodnp3;
 
 
+// Number of points of each type on the outstation database, from dnp3.cfg.
+// Points past MAX_DISCRETE_INPUT have nothing on the buffers to publish
+#define DNP3_MAX_DATABASE_SIZE  MAX_DISCRETE_INPUT
+int dnp3_database_size = 10;
+
+// Last values pushed to the outstation database. Only points that differ
+// from them are updated, so that a scan in which nothing changed costs no
+// updates. dnp3_holding_regs holds the value as pushed, after the cast to int
 IEC_BOOL dnp3_discrete_input[MAX_DISCRETE_INPUT];
 IEC_BOOL dnp3_coils[MAX_COILS];
 IEC_UINT dnp3_input_regs[MAX_INP_REGS];
-IEC_UINT dnp3_holding_regs[MAX_HOLD_REGS];
+int dnp3_holding_regs[MAX_HOLD_REGS];
+
+// Points that were pushed at least once. A point that wasn't is queued
+// whatever its shadow value, so a first push that didn't fit the queue on
+// one scan goes on where it stopped on the next ones
+bool dnp3_discrete_input_pushed[MAX_DISCRETE_INPUT];
+bool dnp3_coils_pushed[MAX_COILS];
+bool dnp3_input_regs_pushed[MAX_INP_REGS];
+bool dnp3_holding_regs_pushed[MAX_HOLD_REGS];
+
+// Changes are passed from the scan to the outstation through a single
+// producer, single consumer queue, so that neither waits for the other.
+// The scan only writes dnp3_queue_tail and the outstation strand only
+// writes dnp3_queue_head. DNP3_QUEUE_SIZE must be a power of 2, and large
+// enough for the first push of the largest database: every binary input,
+// binary output and analog input, plus the analog outputs up to
+// MAX_64B_RANGE
+#define DNP3_QUEUE_SIZE         32768
+static_assert(MAX_DISCRETE_INPUT + MAX_COILS + MAX_INP_REGS + MAX_64B_RANGE <= DNP3_QUEUE_SIZE,
+              "DNP3 change queue can't hold the first push of the largest database");
+
+#define DNP3_BINARY             0
+#define DNP3_BINARY_OUTPUT      1
+#define DNP3_ANALOG             2
+#define DNP3_ANALOG_OUTPUT      3
+
+struct DNP3_change
+{
+    uint8_t type;
+    uint16_t index;
+    int value;
+    uint64_t time;              // end of the scan, in ms since the epoch (UTC)
+};
+
+struct DNP3_change dnp3_queue[DNP3_QUEUE_SIZE];
+std::atomic<uint32_t> dnp3_queue_head(0);
+std::atomic<uint32_t> dnp3_queue_tail(0);
+std::atomic<bool> dnp3_drain_pending(false);    // a drain was posted to the strand and didn't start yet
+bool dnp3_queue_full = false;
+
+// Outstation fed by the scan and the update that drains the queue into its
+// database. Only changed with bufferLock held, which the scan also holds
+std::shared_ptr<IOutstation> dnp3_outstation;
+Updates *dnp3_drain = NULL;
 
 
 // trim string from left
@@ -202,58 +254,183 @@ protected:
 };
 
 //------------------------------------------------------------------
-// Function to update DNP3 values every time they may have changed
+// Adds a point that changed on this scan to the queue. The consumer only
+// reads the entry after it sees the new tail. Returns false if the queue
+// is full
+//------------------------------------------------------------------
+static inline bool push_change(uint8_t type, int index, int value, uint64_t time) {
+    uint32_t tail = dnp3_queue_tail.load(std::memory_order_relaxed);
+    if (tail - dnp3_queue_head.load(std::memory_order_acquire) >= DNP3_QUEUE_SIZE)
+        return false;
+
+    struct DNP3_change *change = &dnp3_queue[tail & (DNP3_QUEUE_SIZE - 1)];
+    change->type = type;
+    change->index = index;
+    change->value = value;
+    change->time = time;
+    dnp3_queue_tail.store(tail + 1);
+    return true;
+}
+
+//------------------------------------------------------------------
+// Applies the changes queued by the scan to the outstation database. Runs
+// on the outstation strand, so it never waits for the scan. Every change
+// carries the time of the scan that produced it, which is used for its
+// event
+//------------------------------------------------------------------
+static void drain_changes(IUpdateHandler &handler) {
+    // clear the flag first, so that changes queued from now on post a new drain
+    dnp3_drain_pending.store(false);
+
+    uint32_t head = dnp3_queue_head.load(std::memory_order_relaxed);
+    uint32_t tail = dnp3_queue_tail.load();
+    for (; head != tail; head++) {
+        struct DNP3_change *change = &dnp3_queue[head & (DNP3_QUEUE_SIZE - 1)];
+        DNPTime time(change->time);
+
+        if (change->type == DNP3_BINARY) {
+            Binary meas((bool)change->value);
+            meas.time = time;
+            handler.Update(meas, change->index);
+        }
+        else if (change->type == DNP3_BINARY_OUTPUT) {
+            BinaryOutputStatus meas((bool)change->value);
+            meas.time = time;
+            handler.Update(meas, change->index);
+        }
+        else if (change->type == DNP3_ANALOG) {
+            Analog meas(change->value);
+            meas.time = time;
+            handler.Update(meas, change->index);
+        }
+        else {
+            AnalogOutputStatus meas(change->value);
+            meas.time = time;
+            handler.Update(meas, change->index);
+        }
+    }
+    dnp3_queue_head.store(head, std::memory_order_release);
+}
+
+//------------------------------------------------------------------
+// Queues an analog output if its value changed since it was last queued.
+// Returns 1 if it was queued, 0 if it didn't change or -1 if the queue is
+// full
+//------------------------------------------------------------------
+static inline int update_analog_output(int value, int index, uint64_t time) {
+    if (dnp3_holding_regs_pushed[index] && dnp3_holding_regs[index] == value)
+        return 0;
+    if (!push_change(DNP3_ANALOG_OUTPUT, index, value, time))
+        return -1;
+
+    dnp3_holding_regs[index] = value;
+    dnp3_holding_regs_pushed[index] = true;
+    return 1;
+}
+
+//------------------------------------------------------------------
+// End of scan hook, called with bufferLock held. Queues the points that
+// changed on this scan for the outstation and posts a drain to its strand
+// if there isn't one pending already.
 // Updated by Yurgen1975 to support slave devices: DI/DO address 800 and AI/AO address 100
+// Only the points on the database (database_size) are published. If the
+// queue fills up, the points that didn't fit keep their old shadow value
+// (or stay unpushed) and are queued on the next scans
 //------------------------------------------------------------------
-void update_vals(std::shared_ptr<IOutstation> outstation){
-    UpdateBuilder builder;
+void updateBuffersOut_DNP3() {
+    if (dnp3_outstation == nullptr)
+        return;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t time = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+    int pushed = 0;
+    bool full = false;
+
     // Update Discrete input (Binary input) - changed to support offsets (yurgen1975)
-    for(int i = offset_di; i < MAX_DISCRETE_INPUT; i++) {
-        builder.Update(Binary((bool)(*bool_input[i/8][i%8])), i-offset_di);
+    for(int i = offset_di; !full && i < MAX_DISCRETE_INPUT && i - offset_di < dnp3_database_size; i++) {
+        IEC_BOOL value = *bool_input[i/8][i%8];
+        if (dnp3_discrete_input_pushed[i] && dnp3_discrete_input[i] == value)
+            continue;
+        full = !push_change(DNP3_BINARY, i-offset_di, value, time);
+        if (!full) {
+            dnp3_discrete_input[i] = value;
+            dnp3_discrete_input_pushed[i] = true;
+            pushed++;
+        }
     }
 
     // Update Coils (Binary Output) - changed to support offsets (yurgen1975)
-    for(int i = offset_do; i < MAX_COILS; i++) {
-        builder.Update(BinaryOutputStatus((bool)(*bool_output[i/8][i%8])), i-offset_do);
-    }    
+    for(int i = offset_do; !full && i < MAX_COILS && i - offset_do < dnp3_database_size; i++) {
+        IEC_BOOL value = *bool_output[i/8][i%8];
+        if (dnp3_coils_pushed[i] && dnp3_coils[i] == value)
+            continue;
+        full = !push_change(DNP3_BINARY_OUTPUT, i-offset_do, value, time);
+        if (!full) {
+            dnp3_coils[i] = value;
+            dnp3_coils_pushed[i] = true;
+            pushed++;
+        }
+    }
 
     // Update Input Registers (Analog Input) - changed to support offsets (yurgen1975)
-    for (int i = offset_ai; i < MAX_INP_REGS; i++) {
-        builder.Update(Analog((int)(*int_input[i])), i-offset_ai);
+    for (int i = offset_ai; !full && i < MAX_INP_REGS && i - offset_ai < dnp3_database_size; i++) {
+        IEC_UINT value = *int_input[i];
+        if (dnp3_input_regs_pushed[i] && dnp3_input_regs[i] == value)
+            continue;
+        full = !push_change(DNP3_ANALOG, i-offset_ai, value, time);
+        if (!full) {
+            dnp3_input_regs[i] = value;
+            dnp3_input_regs_pushed[i] = true;
+            pushed++;
+        }
     }
-    
+
     // Update Holding Registers (Analog Output) - changed to support offsets (yurgen1975)
-    for (int i = offset_ao; i < MIN_16B_RANGE; i++) {
-        builder.Update(AnalogOutputStatus((int)(*int_output[i])), i-offset_ao);
+    int ret = 0;
+    for (int i = offset_ao; !full && i < MIN_16B_RANGE && i - offset_ao < dnp3_database_size; i++) {
+        ret = update_analog_output((int)(*int_output[i]), i-offset_ao, time);
+        full = (ret < 0);
+        if (!full) pushed += ret;
     }
     // Update Holding registers for memory
-    for (int i = MIN_16B_RANGE; i < MAX_16B_RANGE; i++) {
-        if(int_memory[i - MIN_16B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*int_memory[i - MIN_16B_RANGE])),
-                    i
-            );
+    for (int i = MIN_16B_RANGE; !full && i < MAX_16B_RANGE && i < dnp3_database_size; i++) {
+        if(int_memory[i - MIN_16B_RANGE] == NULL)
+            continue;
+        ret = update_analog_output((int)(*int_memory[i - MIN_16B_RANGE]), i, time);
+        full = (ret < 0);
+        if (!full) pushed += ret;
     } 
     // Update Holding registers for 32 b memory
-    for (int i = MIN_32B_RANGE; i < MAX_32B_RANGE; i++) {
-        if(dint_memory[i - MIN_32B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*dint_memory[i - MIN_32B_RANGE])),
-                    i
-            );
+    for (int i = MIN_32B_RANGE; !full && i < MAX_32B_RANGE && i < dnp3_database_size; i++) {
+        if(dint_memory[i - MIN_32B_RANGE] == NULL)
+            continue;
+        ret = update_analog_output((int)(*dint_memory[i - MIN_32B_RANGE]), i, time);
+        full = (ret < 0);
+        if (!full) pushed += ret;
     } 
     // Update Holding registers for 64 b memory
     for (int i = MIN_64B_RANGE; 
-         (i < MAX_64B_RANGE && 
+         (!full && i < MAX_64B_RANGE && i < dnp3_database_size &&
             i - MIN_64B_RANGE < sizeof(lint_memory) / sizeof(lint_memory[0])); 
          i++) {
-        if(lint_memory[i - MIN_64B_RANGE] != NULL)
-            builder.Update(
-                    AnalogOutputStatus((int)(*lint_memory[i - MIN_64B_RANGE])),
-                    i
-            );
+        if(lint_memory[i - MIN_64B_RANGE] == NULL)
+            continue;
+        ret = update_analog_output((int)(*lint_memory[i - MIN_64B_RANGE]), i, time);
+        full = (ret < 0);
+        if (!full) pushed += ret;
     } 
-    outstation->Apply(builder.Build());
+
+    if (full && !dnp3_queue_full) {
+        unsigned char log_msg[1000];
+        sprintf(log_msg, "DNP3 change queue is full. Changes will be published on the next scans\n");
+        log(log_msg);
+    }
+    dnp3_queue_full = full;
+
+    if (pushed > 0 && !dnp3_drain_pending.exchange(true))
+        dnp3_outstation->Apply(*dnp3_drain);
 }
 
 //----------------------------------------------------------------------
@@ -274,8 +451,15 @@ OutstationStackConfig create_config() {
                 token = trim(token);
                 if (token == "database_size") {
                     getline(iss, token, '=');
+                    dnp3_database_size = atoi(token.c_str());
+                    if (dnp3_database_size > DNP3_MAX_DATABASE_SIZE) {
+                        unsigned char log_msg[1000];
+                        sprintf(log_msg, "DNP3: database_size %d is too large, using %d\n", dnp3_database_size, DNP3_MAX_DATABASE_SIZE);
+                        log(log_msg);
+                        dnp3_database_size = DNP3_MAX_DATABASE_SIZE;
+                    }
                     return OutstationStackConfig(
-                               DatabaseSizes::AllTypes(atoi(token.c_str()))
+                               DatabaseSizes::AllTypes(dnp3_database_size)
                            );
                 }
                 else 
@@ -287,7 +471,181 @@ OutstationStackConfig create_config() {
 
         }
     }
-    return OutstationStackConfig(DatabaseSizes::AllTypes(10));
+    dnp3_database_size = 10;
+    return OutstationStackConfig(DatabaseSizes::AllTypes(dnp3_database_size));
+}
+
+// Types of points on the point configuration table, with the groups and
+// the range of variations each one accepts
+struct DNP3_point_type
+{
+    const char *name;
+    int static_group;
+    int first_static;
+    int last_static;
+    int event_group;
+    int first_event;
+    int last_event;
+    bool has_deadband;
+};
+
+static const struct DNP3_point_type dnp3_point_types[] =
+{
+    {"binary",          1,  1, 2,   2,  1, 3,   false},
+    {"binary_output",   10, 2, 2,   11, 1, 2,   false},
+    {"analog",          30, 1, 6,   32, 1, 8,   true},
+    {"analog_output",   40, 1, 4,   42, 1, 8,   true}
+};
+
+// Settings of a line of the point configuration table. Fields left empty
+// are negative and keep the default of the point
+struct DNP3_point_config
+{
+    int clazz;
+    double deadband;
+    int svariation;
+    int evariation;
+};
+
+template <class Config>
+static void set_deadband(Config &config, double deadband) {
+    config.deadband = deadband;
+}
+
+static void set_deadband(BinaryConfig &config, double deadband) {}
+static void set_deadband(BOStatusConfig &config, double deadband) {}
+
+//----------------------------------------------------------------------
+// Applies a line of the point configuration table to the points from
+// start to stop of one type
+//----------------------------------------------------------------------
+template <class Config>
+static void apply_point_config(openpal::Array<Config, uint16_t> &points, int start, int stop, const DNP3_point_config &point, const DNP3_point_type &type) {
+    for (int i = start; i <= stop && i < points.Size(); i++) {
+        Config &config = points[i];
+        if (point.clazz >= 0)
+            config.clazz = (PointClass)(1 << point.clazz);
+        if (point.deadband >= 0)
+            set_deadband(config, point.deadband);
+        if (point.svariation >= 0)
+            config.svariation = (decltype(config.svariation))(point.svariation - type.first_static);
+        if (point.evariation >= 0)
+            config.evariation = (decltype(config.evariation))(point.evariation - type.first_event);
+    }
+}
+
+//----------------------------------------------------------------------
+// Parses a numeric field of the point configuration table. Returns false
+// if it isn't a number. Empty fields are set to -1
+//----------------------------------------------------------------------
+static bool parse_point_field(const string &field, double &value) {
+    if (field.empty()) {
+        value = -1;
+        return true;
+    }
+
+    char *end;
+    value = strtod(field.c_str(), &end);
+    return *end == '\0' && value >= 0;
+}
+
+//----------------------------------------------------------------------
+// Loads the point configuration table (dnp3.cfg point_config) into the
+// database configuration. Each line sets the class, deadband and default
+// static and event variations of a point or a range of points:
+//
+//   type, index, class, deadband, static variation, event variation
+//   analog, 0-7, 2, 5, 1, 3
+//
+// type is binary, binary_output, analog or analog_output, and index is a
+// point or a range of points on the DNP3 database, after the offsets.
+// class is 0 to 3, where 0 means the point never generates events. The
+// deadband only applies to analogs and the variations are those of the
+// static and event groups of the type. Empty fields keep the default.
+// Malformed lines are logged and skipped
+//----------------------------------------------------------------------
+void parsePointConfig(const string &path, OutstationStackConfig &config) {
+    unsigned char log_msg[1000];
+    ifstream csvfile(path.c_str());
+    if (!csvfile.is_open()) {
+        sprintf(log_msg, "DNP3: Couldn't open point configuration %s\n", path.c_str());
+        log(log_msg);
+        return;
+    }
+
+    string line;
+    int line_number = 0;
+    int num_points = 0;
+    while (getline(csvfile, line)) {
+        line_number++;
+        trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        vector<string> fields;
+        istringstream iss(line);
+        string field;
+        while (getline(iss, field, ','))
+            fields.push_back(trim(field));
+        while (fields.size() < 6)
+            fields.push_back("");
+
+        const DNP3_point_type *type = NULL;
+        for (size_t i = 0; i < sizeof(dnp3_point_types) / sizeof(dnp3_point_types[0]); i++) {
+            if (fields[0] == dnp3_point_types[i].name) {
+                type = &dnp3_point_types[i];
+                break;
+            }
+        }
+
+        int start = -1, stop = -1;
+        char dash;
+        istringstream index(fields[1]);
+        if (!(index >> start))
+            start = -1;
+        else if (!(index >> dash >> stop) || dash != '-')
+            stop = start;
+
+        double clazz, deadband, svariation, evariation;
+        const char *error = NULL;
+        if (type == NULL)
+            error = "unknown point type";
+        else if (start < 0 || stop < start || stop >= dnp3_database_size)
+            error = "index out of the database";
+        else if (!parse_point_field(fields[2], clazz) || clazz > 3)
+            error = "class must be 0 to 3";
+        else if (!parse_point_field(fields[3], deadband) || (deadband >= 0 && !type->has_deadband))
+            error = "bad deadband";
+        else if (!parse_point_field(fields[4], svariation) || (svariation >= 0 && (svariation < type->first_static || svariation > type->last_static)))
+            error = "static variation not supported by the type";
+        else if (!parse_point_field(fields[5], evariation) || (evariation >= 0 && (evariation < type->first_event || evariation > type->last_event)))
+            error = "event variation not supported by the type";
+
+        if (error != NULL) {
+            sprintf(log_msg, "DNP3: Skipping line %d of %s: %s\n", line_number, path.c_str(), error);
+            log(log_msg);
+            continue;
+        }
+
+        DNP3_point_config point;
+        point.clazz = (int)clazz;
+        point.deadband = deadband;
+        point.svariation = (int)svariation;
+        point.evariation = (int)evariation;
+
+        if (type == &dnp3_point_types[0])
+            apply_point_config(config.dbConfig.binary, start, stop, point, *type);
+        else if (type == &dnp3_point_types[1])
+            apply_point_config(config.dbConfig.boStatus, start, stop, point, *type);
+        else if (type == &dnp3_point_types[2])
+            apply_point_config(config.dbConfig.analog, start, stop, point, *type);
+        else
+            apply_point_config(config.dbConfig.aoStatus, start, stop, point, *type);
+        num_points += stop - start + 1;
+    }
+
+    sprintf(log_msg, "DNP3: Configured %d points from %s\n", num_points, path.c_str());
+    log(log_msg);
 }
 
 //----------------------------------------------------------------------
@@ -297,6 +655,7 @@ OutstationStackConfig parseDNP3Config() {
     string line;
     ifstream cfgfile("dnp3.cfg");
     OutstationStackConfig config = create_config();
+    string point_config;
     if(cfgfile.is_open()) {
         while (getline(cfgfile, line)) {
             if (line[0] == '#')
@@ -379,6 +738,9 @@ OutstationStackConfig parseDNP3Config() {
                         openpal::TimeDuration::Milliseconds(
                             atoi(token.c_str())
                         );
+                } else if (token == "point_config") {
+                    getline(iss, token, '=');
+                    point_config = trim(token);
                 } else if (token == "unsol_retry_timeout") {
                     getline(iss, token, '=');
                     config.outstation.params.unsolRetryTimeout = 
@@ -394,6 +756,10 @@ OutstationStackConfig parseDNP3Config() {
         }
     }
 
+    // the point configuration needs the database size, which is known now
+    if (!point_config.empty())
+        parsePointConfig(point_config, config);
+
     return config;
 } 
 
@@ -441,24 +807,44 @@ void dnp3StartServer(int port) {
             parseDNP3Config()
     );
 
-    // Enable the outstation and start communications
+    // Enable the outstation and start communications. The whole database
+    // is pushed on the first scan
+    std::fill_n(dnp3_discrete_input_pushed, MAX_DISCRETE_INPUT, false);
+    std::fill_n(dnp3_coils_pushed, MAX_COILS, false);
+    std::fill_n(dnp3_input_regs_pushed, MAX_INP_REGS, false);
+    std::fill_n(dnp3_holding_regs_pushed, MAX_HOLD_REGS, false);
     outstation->Enable();
     printf("DNP3 Enabled \n");
 
     mapUnusedIO();
 
-    // Continuously update
-    struct timespec timer_start;
-    clock_gettime(CLOCK_MONOTONIC, &timer_start);
-    
-    while(run_dnp3) 
+    // From now on the end of each scan feeds the outstation. The queue is
+    // emptied by a single update that is posted to the outstation strand
+    // whenever there are changes and no drain is pending
+    UpdateBuilder builder;
+    builder.Add(drain_changes);
+    Updates drain = builder.Build();
+
+    pthread_mutex_lock(&bufferLock);
+    dnp3_queue_head = 0;
+    dnp3_queue_tail = 0;
+    dnp3_drain_pending = false;
+    dnp3_queue_full = false;
+    dnp3_drain = &drain;
+    dnp3_outstation = outstation;
+    pthread_mutex_unlock(&bufferLock);
+
+    while(run_dnp3)
     {
-        pthread_mutex_lock(&bufferLock);
-        update_vals(outstation);
-        pthread_mutex_unlock(&bufferLock);
-        sleep_until(&timer_start, OPLC_CYCLE);
+        sleepms(100);
     }
-    
+
+    // Stop the scan from feeding the outstation before it goes away
+    pthread_mutex_lock(&bufferLock);
+    dnp3_outstation = nullptr;
+    dnp3_drain = NULL;
+    pthread_mutex_unlock(&bufferLock);
+
     printf("Shutting down DNP3 server\n");
     channel->Shutdown();
     printf("DNP3 Server deactivated\n");
@@ -40,6 +40,17 @@
 //Global Variables
 bool run_modbus = 0;
 int modbus_port = 502;
+bool run_modbus_udp = 0;
+int modbus_udp_port = 502;
+bool run_modbus_rtu = 0;
+char rtu_slave_device[100];
+int rtu_slave_baud = 19200;
+char rtu_slave_parity = 'N';
+int rtu_slave_data_bits = 8;
+int rtu_slave_stop_bits = 1;
+int rtu_slave_id = 1;
+bool run_modbus_metrics = 0;
+int modbus_metrics_port = 9502;
 bool run_dnp3 = 0;
 int dnp3_port = 20000;
 unsigned char server_command[1024];
@@ -50,6 +61,9 @@ time_t end_time;
 
 //Global Threads
 pthread_t modbus_thread;
+pthread_t modbus_udp_thread;
+pthread_t modbus_rtu_thread;
+pthread_t modbus_metrics_thread;
 pthread_t dnp3_thread;
 
 //-----------------------------------------------------------------------------
@@ -60,6 +74,34 @@ void *modbusThread(void *arg)
     startServer(modbus_port);
 }
 
+//-----------------------------------------------------------------------------
+// Start the Modbus/UDP Thread
+//-----------------------------------------------------------------------------
+void *modbusUDPThread(void *arg)
+{
+    startServerUDP(modbus_udp_port);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Start the Modbus RTU Slave Thread
+//-----------------------------------------------------------------------------
+void *modbusRTUThread(void *arg)
+{
+    startRTUSlave(rtu_slave_device, rtu_slave_baud, rtu_slave_parity, rtu_slave_data_bits,
+                  rtu_slave_stop_bits, rtu_slave_id);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Start the Modbus Metrics Thread
+//-----------------------------------------------------------------------------
+void *modbusMetricsThread(void *arg)
+{
+    startMetricsServer(modbus_metrics_port);
+    return NULL;
+}
+
 //-----------------------------------------------------------------------------
 // Start the DNP3 Thread
 //-----------------------------------------------------------------------------
@@ -90,6 +132,42 @@ int readCommandArgument(unsigned char *command)
     return atoi(argument);
 }
 
+//-----------------------------------------------------------------------------
+// Split the comma separated arguments from a command function. Each argument
+// is copied into one of the 'arguments' buffers, which must hold at least
+// 100 chars. Returns the number of arguments found
+//-----------------------------------------------------------------------------
+int readCommandArguments(unsigned char *command, char arguments[][100], int max_arguments)
+{
+    int i = 0;
+    int j = 0;
+    int count = 0;
+
+    while (command[i] != '(' && command[i] != '\0') i++;
+    if (command[i] == '(') i++;
+    if (command[i] == ')' || command[i] == '\0') return 0;
+
+    arguments[0][0] = '\0';
+    while (command[i] != ')' && command[i] != '\0' && count < max_arguments)
+    {
+        if (command[i] == ',')
+        {
+            count++;
+            j = 0;
+            if (count < max_arguments) arguments[count][0] = '\0';
+        }
+        else if (j < 99)
+        {
+            arguments[count][j] = command[i];
+            j++;
+            arguments[count][j] = '\0';
+        }
+        i++;
+    }
+
+    return (count < max_arguments) ? count + 1 : count;
+}
+
 //-----------------------------------------------------------------------------
 // Create the socket and bind it. Returns the file descriptor for the socket
 // created.
@@ -203,6 +281,27 @@ void processCommand(unsigned char *buffer, int client_fd)
             sprintf(log_msg, "Modbus server was stopped\n");
             log(log_msg);
         }
+        if (run_modbus_udp)
+        {
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+            sprintf(log_msg, "Modbus UDP server was stopped\n");
+            log(log_msg);
+        }
+        if (run_modbus_rtu)
+        {
+            run_modbus_rtu = 0;
+            pthread_join(modbus_rtu_thread, NULL);
+            sprintf(log_msg, "Modbus RTU slave was stopped\n");
+            log(log_msg);
+        }
+        if (run_modbus_metrics)
+        {
+            run_modbus_metrics = 0;
+            pthread_join(modbus_metrics_thread, NULL);
+            sprintf(log_msg, "Modbus metrics server was stopped\n");
+            log(log_msg);
+        }
         if (run_dnp3)
         {
             run_dnp3 = 0;
@@ -248,6 +347,125 @@ void processCommand(unsigned char *buffer, int client_fd)
         }
         processing_command = false;
     }
+    else if (strncmp(buffer, "start_modbus_udp(", 17) == 0)
+    {
+        processing_command = true;
+        sprintf(log_msg, "Issued start_modbus_udp() command to start on port: %d\n", readCommandArgument(buffer));
+        log(log_msg);
+        modbus_udp_port = readCommandArgument(buffer);
+        if (run_modbus_udp)
+        {
+            sprintf(log_msg, "Modbus UDP server already active. Restarting on port: %d\n", modbus_udp_port);
+            log(log_msg);
+            //Stop Modbus UDP server
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+            sprintf(log_msg, "Modbus UDP server was stopped\n");
+            log(log_msg);
+        }
+        //Start Modbus UDP server
+        run_modbus_udp = 1;
+        pthread_create(&modbus_udp_thread, NULL, modbusUDPThread, NULL);
+        processing_command = false;
+    }
+    else if (strncmp(buffer, "stop_modbus_udp()", 17) == 0)
+    {
+        processing_command = true;
+        sprintf(log_msg, "Issued stop_modbus_udp() command\n");
+        log(log_msg);
+        if (run_modbus_udp)
+        {
+            run_modbus_udp = 0;
+            pthread_join(modbus_udp_thread, NULL);
+            sprintf(log_msg, "Modbus UDP server was stopped\n");
+            log(log_msg);
+        }
+        processing_command = false;
+    }
+    else if (strncmp(buffer, "start_modbus_rtu(", 17) == 0)
+    {
+        //start_modbus_rtu(device,baud,parity,data bits,stop bits,slave id)
+        char arguments[6][100];
+        processing_command = true;
+        if (readCommandArguments(buffer, arguments, 6) != 6)
+        {
+            processing_command = false;
+            count_char = sprintf(buffer, "Error: start_modbus_rtu() takes 6 arguments\n");
+            write(client_fd, buffer, count_char);
+            return;
+        }
+        if (run_modbus_rtu)
+        {
+            sprintf(log_msg, "Modbus RTU slave already active. Restarting on %s\n", arguments[0]);
+            log(log_msg);
+            //Stop Modbus RTU slave
+            run_modbus_rtu = 0;
+            pthread_join(modbus_rtu_thread, NULL);
+            sprintf(log_msg, "Modbus RTU slave was stopped\n");
+            log(log_msg);
+        }
+        strncpy(rtu_slave_device, arguments[0], sizeof(rtu_slave_device));
+        rtu_slave_baud = atoi(arguments[1]);
+        rtu_slave_parity = arguments[2][0];
+        rtu_slave_data_bits = atoi(arguments[3]);
+        rtu_slave_stop_bits = atoi(arguments[4]);
+        rtu_slave_id = atoi(arguments[5]);
+        sprintf(log_msg, "Issued start_modbus_rtu() command to start on %s\n", rtu_slave_device);
+        log(log_msg);
+        //Start Modbus RTU slave
+        run_modbus_rtu = 1;
+        pthread_create(&modbus_rtu_thread, NULL, modbusRTUThread, NULL);
+        processing_command = false;
+    }
+    else if (strncmp(buffer, "stop_modbus_rtu()", 17) == 0)
+    {
+        processing_command = true;
+        sprintf(log_msg, "Issued stop_modbus_rtu() command\n");
+        log(log_msg);
+        if (run_modbus_rtu)
+        {
+            run_modbus_rtu = 0;
+            pthread_join(modbus_rtu_thread, NULL);
+            sprintf(log_msg, "Modbus RTU slave was stopped\n");
+            log(log_msg);
+        }
+        processing_command = false;
+    }
+    else if (strncmp(buffer, "start_modbus_metrics(", 21) == 0)
+    {
+        processing_command = true;
+        sprintf(log_msg, "Issued start_modbus_metrics() command to start on port: %d\n", readCommandArgument(buffer));
+        log(log_msg);
+        modbus_metrics_port = readCommandArgument(buffer);
+        if (run_modbus_metrics)
+        {
+            sprintf(log_msg, "Modbus metrics server already active. Restarting on port: %d\n", modbus_metrics_port);
+            log(log_msg);
+            //Stop Modbus metrics server
+            run_modbus_metrics = 0;
+            pthread_join(modbus_metrics_thread, NULL);
+            sprintf(log_msg, "Modbus metrics server was stopped\n");
+            log(log_msg);
+        }
+        //Start Modbus metrics server
+        run_modbus_metrics = 1;
+        pthread_create(&modbus_metrics_thread, NULL, modbusMetricsThread, NULL);
+        processing_command = false;
+    }
+    else if (strncmp(buffer, "stop_modbus_metrics()", 21) == 0)
+    {
+        processing_command = true;
+        sprintf(log_msg, "Issued stop_modbus_metrics() command\n");
+        log(log_msg);
+        if (run_modbus_metrics)
+        {
+            run_modbus_metrics = 0;
+            pthread_join(modbus_metrics_thread, NULL);
+            sprintf(log_msg, "Modbus metrics server was stopped\n");
+            log(log_msg);
+        }
+        processing_command = false;
+    }
     else if (strncmp(buffer, "start_dnp3(", 11) == 0)
     {
         processing_command = true;
@@ -291,6 +509,39 @@ void processCommand(unsigned char *buffer, int client_fd)
         processing_command = false;
         return;
     }
+    else if (strncmp(buffer, "modbus_clients()", 16) == 0)
+    {
+        processing_command = true;
+        char clients[10000];
+        count_char = printModbusClients(clients, sizeof(clients));
+        write(client_fd, clients, count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "modbus_stats()", 14) == 0)
+    {
+        processing_command = true;
+        char stats[10000];
+        count_char = printModbusStats(stats, sizeof(stats));
+        write(client_fd, stats, count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "modbus_devices()", 16) == 0)
+    {
+        processing_command = true;
+        char devices[10000];
+        count_char = printModbusMasterHealth(devices, sizeof(devices));
+        write(client_fd, devices, count_char);
+        processing_command = false;
+        return;
+    }
+    else if (strncmp(buffer, "reload_modbus_master()", 22) == 0)
+    {
+        processing_command = true;
+        reloadMB();
+        processing_command = false;
+    }
     else if (strncmp(buffer, "exec_time()", 11) == 0)
     {
         processing_command = true;
@@ -117,7 +117,14 @@ extern int log_index;
 void handleSpecialFunctions();
 
 //server.cpp
+#define MB_PRIORITY_LOW         0
+#define MB_PRIORITY_NORMAL      1
+#define MB_PRIORITY_HIGH        2
+#define MB_NUM_PRIORITIES       3
 void startServer(int port);
+void startServerUDP(int port);
+int printModbusClients(char *buffer, int size);
+int printModbusClientMetrics(char *buffer, int size);
 int getSO_ERROR(int fd);
 void closeSocket(int fd);
 bool SetSocketBlockingEnabled(int fd, bool blocking);
@@ -125,6 +132,9 @@ bool SetSocketBlockingEnabled(int fd, bool blocking);
 //interactive_server.cpp
 void startInteractiveServer(int port);
 extern bool run_modbus;
+extern bool run_modbus_udp;
+extern bool run_modbus_rtu;
+extern bool run_modbus_metrics;
 extern bool run_dnp3;
 extern time_t start_time;
 extern time_t end_time;
@@ -132,15 +142,65 @@ extern time_t end_time;
 //modbus.cpp
 int processModbusMessage(unsigned char *buffer, int bufferSize);
 void mapUnusedIO();
+void initializeModbusMap();
+void setModbusClientPriority(int priority);
+int modbusBusyResponse(unsigned char *buffer, int bufferSize);
+uint64_t modbusLockWait();
+extern uint32_t io_map_generation;
+
+//modbus_stats.cpp
+struct MB_histogram;
+void recordModbusRequest(unsigned char function_code, unsigned char *response, int requestSize, int responseSize, struct timespec *received);
+struct MB_histogram *createHistogram();
+void histogramRecord(struct MB_histogram *hist, uint64_t value);
+uint64_t histogramPercentile(struct MB_histogram *hist, double percentile);
+int printPrometheusHistogram(char *buffer, int size, const char *name, const char *labels, struct MB_histogram *hist);
+int printModbusStats(char *buffer, int size);
+void startMetricsServer(int port);
+
+//modbus_rtu_slave.cpp
+void startRTUSlave(const char *device, int baud, char parity, int data_bits, int stop_bits, uint8_t slave_id);
+uint16_t calculateCRC16(unsigned char *buffer, int size);
+int rtuInterFrameDelay(int baud, char parity, int data_bits, int stop_bits);
+
+//modbus_master_tcp.cpp
+#define MB_MAX_PDU_SIZE         253
+#define MB_MAX_PIPELINE_DEPTH   16
+#define MB_TX_OK                0
+#define MB_TX_EXCEPTION         1
+#define MB_TX_TIMEOUT           2
+#define MB_TX_ERROR             3
+struct MB_pipeline;
+struct MB_transaction
+{
+    uint8_t unit_id;
+    uint8_t request[MB_MAX_PDU_SIZE];
+    int request_size;
+    uint8_t response[MB_MAX_PDU_SIZE];
+    int response_size;
+    int status;
+    uint32_t latency;       //us, from the request being sent to its response
+};
+struct MB_pipeline *createPipeline(const char *address, uint16_t port, int depth, int timeout);
+void pipelineClose(struct MB_pipeline *pipeline);
+int startConnect(const char *address, uint16_t port);
+int finishConnect(int fd);
+void pipelineSetSocket(struct MB_pipeline *pipeline, int fd);
+bool pipelineExecute(struct MB_pipeline *pipeline, struct MB_transaction *transactions, int count);
 
 //modbus_master.cpp
 void initializeMB();
+void reloadMB();
 void *querySlaveDevices(void *arg);
+void waitBuffersIn_MB();
 void updateBuffersIn_MB();
 void updateBuffersOut_MB();
+int printModbusMasterHealth(char *buffer, int size);
+int printModbusMasterMetrics(char *buffer, int size);
 
 //dnp3.cpp
 void dnp3StartServer(int port);
+void updateBuffersOut_DNP3();
 
 //persistent_storage.cpp
 void *persistentStorage(void *args);
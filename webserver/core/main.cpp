@@ -192,6 +192,7 @@ int main(int argc,char **argv)
     pthread_create(&interactive_thread, NULL, interactiveServerThread, NULL);
     config_init__();
     glueVars();
+    initializeModbusMap();
 
     //======================================================
     //               MUTEX INITIALIZATION
@@ -256,6 +257,7 @@ int main(int argc,char **argv)
 		glueVars();
         
 		updateBuffersIn(); //read input image
+        waitBuffersIn_MB(); //wait for the slave devices polled on the last scan
 
 		pthread_mutex_lock(&bufferLock); //lock mutex
 		updateCustomIn();
@@ -264,6 +266,7 @@ int main(int argc,char **argv)
 		config_run__(tick++); // execute plc program logic
 		updateCustomOut();
         updateBuffersOut_MB(); //update slave devices with data from the output image table
+        updateBuffersOut_DNP3(); //publish the points that changed on this scan to the DNP3 outstation
 		pthread_mutex_unlock(&bufferLock); //unlock mutex
 
 		updateBuffersOut(); //write output image
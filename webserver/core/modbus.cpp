@@ -27,6 +27,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <string.h>
+#include <time.h>
 
 #include "ladder.h"
 
@@ -51,6 +53,9 @@
 #define MB_FC_WRITE_REGISTER            6
 #define MB_FC_WRITE_MULTIPLE_COILS      15
 #define MB_FC_WRITE_MULTIPLE_REGISTERS  16
+#define MB_FC_MASK_WRITE_REGISTER       22
+#define MB_FC_READ_WRITE_MULTIPLE_REGISTERS 23
+#define MB_FC_ENCAPSULATED_INTERFACE    43
 #define MB_FC_ERROR                     255
 
 #define ERR_NONE                        0
@@ -60,6 +65,15 @@
 #define ERR_SLAVE_DEVICE_FAILURE        4
 #define ERR_SLAVE_DEVICE_BUSY           6
 
+#define MB_MEI_READ_DEVICE_ID           14
+#define MB_DEVID_BASIC                  1
+#define MB_DEVID_REGULAR                2
+#define MB_DEVID_EXTENDED               3
+#define MB_DEVID_INDIVIDUAL             4
+#define MB_DEVID_CONFORMITY             0x82 //regular identification, stream and individual access
+#define MB_DEVID_LAST_BASIC             2
+#define MB_DEVID_NUM_OBJECTS            6
+#define MB_MAX_ADU_SIZE                 260
 
 #define bitRead(value, bit) (((value) >> (bit)) & 0x01)
 #define bitSet(value, bit) ((value) |= (1UL << (bit)))
@@ -74,7 +88,20 @@ IEC_BOOL mb_coils[MAX_COILS];
 IEC_UINT mb_input_regs[MAX_INP_REGS];
 IEC_UINT mb_holding_regs[MAX_HOLD_REGS];
 
-int MessageLength;
+//Size of the response being built. Each server thread (TCP clients, UDP and
+//RTU) processes its own message, so this is kept per thread
+thread_local int MessageLength;
+
+//Objects returned by Read Device Identification, indexed by object id
+const char *device_id_objects[MB_DEVID_NUM_OBJECTS] =
+{
+	"OpenPLC Project",               //0x00 VendorName
+	"OpenPLC Runtime",               //0x01 ProductCode
+	"v3",                            //0x02 MajorMinorRevision
+	"http://www.openplcproject.com", //0x03 VendorUrl
+	"OpenPLC Runtime",               //0x04 ProductName
+	"OpenPLC v3",                    //0x05 ModelName
+};
 
 
 
@@ -89,6 +116,360 @@ int word(unsigned char byte1, unsigned char byte2)
 	return returnValue;
 }
 
+//-----------------------------------------------------------------------------
+//                          MODBUS ADDRESS MAP
+// The slave address map is read from mbmap.cfg and compiled into one dense
+// table per Modbus area, indexed directly by the register address. Each entry
+// points to the OpenPLC buffer slot that holds the located variable, so a
+// request costs one table lookup per register no matter how the map looks.
+// When mbmap.cfg doesn't exist, default_modbus_map is used instead, which is
+// the traditional OpenPLC address layout.
+//-----------------------------------------------------------------------------
+#define MB_AREA_COILS                   0
+#define MB_AREA_DISCRETE_INPUTS         1
+#define MB_AREA_INPUT_REGISTERS         2
+#define MB_AREA_HOLDING_REGISTERS       3
+#define MB_NUM_AREAS                    4
+
+#define MB_MAX_ADDRESS                  65536
+
+struct MB_map_entry
+{
+	void *slot;                         //address of the OpenPLC buffer pointer for this register
+	uint8_t width;                      //size of the variable in 16-bit words (0 if unmapped)
+	uint8_t shift;                      //position of this register inside the variable, in bits
+	bool swap_bytes;                    //register bytes are sent low byte first
+	IEC_UINT fallback;                  //storage used while the located variable doesn't exist
+};
+
+struct MB_map
+{
+	struct MB_map_entry *entries;
+	int size;
+};
+
+struct MB_map modbus_map[MB_NUM_AREAS];
+
+const char *modbus_area_names[MB_NUM_AREAS] = {"coil", "di", "ir", "hr"};
+
+const char *default_modbus_map[] =
+{
+	"coil  0     %QX0.0  8192  BOOL",
+	"di    0     %IX0.0  8192  BOOL",
+	"ir    0     %IW0    1024  INT",
+	"hr    0     %QW0    1024  INT",
+	"hr    1024  %MW0    1024  INT",
+	"hr    2048  %MD0    1024  DINT",
+	"hr    4096  %ML0    1024  LINT",
+	NULL
+};
+
+//-----------------------------------------------------------------------------
+// Returns the size in 16-bit words of an IEC type that can be mapped into
+// Modbus. BOOL has size 0. Returns -1 for unsupported types
+//-----------------------------------------------------------------------------
+int mapTypeWidth(const char *type)
+{
+	if (!strcmp(type, "BOOL")) return 0;
+	if (!strcmp(type, "INT") || !strcmp(type, "UINT") || !strcmp(type, "WORD")) return 1;
+	if (!strcmp(type, "DINT") || !strcmp(type, "UDINT") || !strcmp(type, "DWORD") || !strcmp(type, "REAL")) return 2;
+	if (!strcmp(type, "LINT") || !strcmp(type, "ULINT") || !strcmp(type, "LWORD") || !strcmp(type, "LREAL")) return 4;
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the OpenPLC buffer slot for the located variable 'name', advanced by
+// 'offset' variables. The size of the variable in words is stored in 'width'
+// (0 for booleans). Returns NULL if the variable is not valid
+//-----------------------------------------------------------------------------
+void *locatedVarSlot(const char *name, int offset, int *width)
+{
+	int pos1 = 0, pos2 = 0;
+
+	if (name[0] != '%' || name[1] == '\0' || name[2] == '\0') return NULL;
+	if (sscanf(&name[3], "%d.%d", &pos1, &pos2) < 1) return NULL;
+
+	if (name[2] == 'X')
+	{
+		int bit = pos1 * 8 + pos2 + offset;
+		if (pos2 < 0 || pos2 > 7 || bit < 0 || bit >= BUFFER_SIZE * 8) return NULL;
+		*width = 0;
+		if (name[1] == 'I') return &bool_input[bit / 8][bit % 8];
+		if (name[1] == 'Q') return &bool_output[bit / 8][bit % 8];
+		return NULL;
+	}
+
+	int index = pos1 + offset;
+	if (index < 0 || index >= BUFFER_SIZE) return NULL;
+
+	if (name[2] == 'W')
+	{
+		*width = 1;
+		if (name[1] == 'I') return &int_input[index];
+		if (name[1] == 'Q') return &int_output[index];
+		if (name[1] == 'M') return &int_memory[index];
+	}
+	else if (name[1] == 'M' && name[2] == 'D')
+	{
+		*width = 2;
+		return &dint_memory[index];
+	}
+	else if (name[1] == 'M' && name[2] == 'L')
+	{
+		*width = 4;
+		return &lint_memory[index];
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Parses one line of the address map and adds it to the map tables. The line
+// format is:
+//   <area> <first register> <first variable> <count> <type> [word order] [byte order]
+// where area is coil, di, ir or hr and the orders are 'big' (default) or
+// 'little'. Returns false if the line is invalid
+//-----------------------------------------------------------------------------
+bool addMapLine(const char *line)
+{
+	char area_name[10], var_name[20], type[10];
+	char word_order[10] = "big", byte_order[10] = "big";
+	int first_reg, count, area = -1;
+
+	if (sscanf(line, "%9s %d %19s %d %9s %9s %9s", area_name, &first_reg, var_name, &count, type, word_order, byte_order) < 5)
+		return false;
+
+	for (int i = 0; i < MB_NUM_AREAS; i++)
+	{
+		if (!strcmp(area_name, modbus_area_names[i])) area = i;
+	}
+
+	int type_width = mapTypeWidth(type);
+	bool bit_area = (area == MB_AREA_COILS || area == MB_AREA_DISCRETE_INPUTS);
+	if (area < 0 || type_width < 0 || first_reg < 0 || count <= 0) return false;
+	if (bit_area != (type_width == 0)) return false;
+	if (strcmp(word_order, "big") && strcmp(word_order, "little")) return false;
+	if (strcmp(byte_order, "big") && strcmp(byte_order, "little")) return false;
+
+	//inputs can't be exposed as writable coils or registers
+	bool writable_area = (area == MB_AREA_COILS || area == MB_AREA_HOLDING_REGISTERS);
+	if (writable_area && var_name[1] == 'I') return false;
+
+	int regs_per_var = bit_area ? 1 : type_width;
+	int last_reg = first_reg + count * regs_per_var;
+	if (last_reg > MB_MAX_ADDRESS) return false;
+
+	//every variable of the line is checked before anything is written, so
+	//that a rejected line leaves the map untouched
+	for (int i = 0; i < count; i++)
+	{
+		int var_width;
+		void *slot = locatedVarSlot(var_name, i, &var_width);
+		if (slot == NULL || var_width != type_width) return false;
+	}
+
+	//grow the table of this area so that it covers the new registers
+	struct MB_map *map = &modbus_map[area];
+	if (last_reg > map->size)
+	{
+		struct MB_map_entry *entries = (struct MB_map_entry *)realloc(map->entries, last_reg * sizeof(struct MB_map_entry));
+		if (entries == NULL) return false;
+
+		memset(&entries[map->size], 0, (last_reg - map->size) * sizeof(struct MB_map_entry));
+		map->entries = entries;
+		map->size = last_reg;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		int var_width;
+		void *slot = locatedVarSlot(var_name, i, &var_width);
+
+		for (int w = 0; w < regs_per_var; w++)
+		{
+			struct MB_map_entry *entry = &map->entries[first_reg + i * regs_per_var + w];
+			entry->slot = slot;
+			entry->width = bit_area ? 1 : type_width;
+			entry->shift = !strcmp(word_order, "big") ? 16 * (type_width - 1 - w) : 16 * w;
+			entry->swap_bytes = !strcmp(byte_order, "little");
+			entry->fallback = 0;
+		}
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Compiles the Modbus address map from mbmap.cfg, or from the default map if
+// the file doesn't exist. Must be called before the Modbus servers start
+//-----------------------------------------------------------------------------
+void initializeModbusMap()
+{
+	unsigned char log_msg[1000];
+	char line[1024];
+
+	for (int i = 0; i < MB_NUM_AREAS; i++)
+	{
+		free(modbus_map[i].entries);
+		modbus_map[i].entries = NULL;
+		modbus_map[i].size = 0;
+	}
+
+	FILE *mapfile = fopen("mbmap.cfg", "r");
+	if (mapfile != NULL)
+	{
+		int line_number = 0;
+		while (fgets(line, sizeof(line), mapfile) != NULL)
+		{
+			line_number++;
+			char *start = line;
+			while (*start == ' ' || *start == '\t') start++;
+			if (*start == '#' || *start == '\r' || *start == '\n' || *start == '\0') continue;
+
+			if (!addMapLine(start))
+			{
+				sprintf(log_msg, "Modbus Map: ignoring invalid line %d on mbmap.cfg\n", line_number);
+				log(log_msg);
+			}
+		}
+		fclose(mapfile);
+	}
+	else
+	{
+		for (int i = 0; default_modbus_map[i] != NULL; i++)
+		{
+			addMapLine(default_modbus_map[i]);
+		}
+	}
+
+	sprintf(log_msg, "Modbus Map: %d coils, %d discrete inputs, %d input registers, %d holding registers\n",
+			modbus_map[MB_AREA_COILS].size, modbus_map[MB_AREA_DISCRETE_INPUTS].size,
+			modbus_map[MB_AREA_INPUT_REGISTERS].size, modbus_map[MB_AREA_HOLDING_REGISTERS].size);
+	log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Verify if a range of addresses is fully mapped on a Modbus area
+//-----------------------------------------------------------------------------
+bool mapRangeIsValid(int area, int start, int count)
+{
+	struct MB_map *map = &modbus_map[area];
+	if (start < 0 || count < 0 || start + count > map->size) return false;
+
+	for (int i = start; i < start + count; i++)
+	{
+		if (map->entries[i].width == 0) return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads one coil or discrete input. Must be called with bufferLock held and
+// with an address validated by mapRangeIsValid()
+//-----------------------------------------------------------------------------
+IEC_BOOL readMappedBit(int area, int position)
+{
+	struct MB_map_entry *entry = &modbus_map[area].entries[position];
+	IEC_BOOL *var = *(IEC_BOOL **)entry->slot;
+	return (var != NULL) ? *var : (IEC_BOOL)entry->fallback;
+}
+
+//-----------------------------------------------------------------------------
+// Writes one coil. Must be called with bufferLock held and with an address
+// validated by mapRangeIsValid()
+//-----------------------------------------------------------------------------
+void writeMappedBit(int area, int position, IEC_BOOL value)
+{
+	struct MB_map_entry *entry = &modbus_map[area].entries[position];
+	IEC_BOOL *var = *(IEC_BOOL **)entry->slot;
+	if (var != NULL) *var = value;
+	else entry->fallback = value;
+}
+
+//-----------------------------------------------------------------------------
+// Reads one input or holding register. Must be called with bufferLock held and
+// with an address validated by mapRangeIsValid()
+//-----------------------------------------------------------------------------
+IEC_UINT readMappedRegister(int area, int position)
+{
+	struct MB_map_entry *entry = &modbus_map[area].entries[position];
+	IEC_UINT value;
+
+	switch (entry->width)
+	{
+		case 1:
+		{
+			IEC_UINT *var = *(IEC_UINT **)entry->slot;
+			value = (var != NULL) ? *var : entry->fallback;
+			break;
+		}
+		case 2:
+		{
+			IEC_DINT *var = *(IEC_DINT **)entry->slot;
+			value = (var != NULL) ? (IEC_UINT)((uint32_t)*var >> entry->shift) : entry->fallback;
+			break;
+		}
+		default:
+		{
+			IEC_LINT *var = *(IEC_LINT **)entry->slot;
+			value = (var != NULL) ? (IEC_UINT)((uint64_t)*var >> entry->shift) : entry->fallback;
+			break;
+		}
+	}
+
+	if (entry->swap_bytes) value = (IEC_UINT)((value << 8) | (value >> 8));
+	return value;
+}
+
+//-----------------------------------------------------------------------------
+// Writes one holding register. Must be called with bufferLock held and with
+// an address validated by mapRangeIsValid()
+//-----------------------------------------------------------------------------
+void writeMappedRegister(int area, int position, IEC_UINT value)
+{
+	struct MB_map_entry *entry = &modbus_map[area].entries[position];
+
+	if (entry->swap_bytes) value = (IEC_UINT)((value << 8) | (value >> 8));
+
+	switch (entry->width)
+	{
+		case 1:
+		{
+			IEC_UINT *var = *(IEC_UINT **)entry->slot;
+			if (var != NULL) *var = value;
+			else entry->fallback = value;
+			break;
+		}
+		case 2:
+		{
+			IEC_DINT *var = *(IEC_DINT **)entry->slot;
+			if (var != NULL)
+			{
+				uint32_t tempValue = (uint32_t)*var & ~((uint32_t)0xffff << entry->shift);
+				*var = (IEC_DINT)(tempValue | ((uint32_t)value << entry->shift));
+			}
+			else entry->fallback = value;
+			break;
+		}
+		default:
+		{
+			IEC_LINT *var = *(IEC_LINT **)entry->slot;
+			if (var != NULL)
+			{
+				uint64_t tempValue = (uint64_t)*var & ~((uint64_t)0xffff << entry->shift);
+				*var = (IEC_LINT)(tempValue | ((uint64_t)value << entry->shift));
+			}
+			else entry->fallback = value;
+			break;
+		}
+	}
+}
+
+//Incremented every time variables are attached to the process image, so
+//that modules holding pointers to it know when to take them again
+uint32_t io_map_generation = 0;
+
 //-----------------------------------------------------------------------------
 // This function sets the internal NULL OpenPLC buffers to point to valid
 // positions on the Modbus buffer
@@ -118,9 +499,108 @@ void mapUnusedIO()
 			if (int_output[i] == NULL) int_output[i] = &mb_holding_regs[i];
 
 		if (i >= MIN_16B_RANGE && i <= MAX_16B_RANGE)
-			if (int_memory[i - MIN_16B_RANGE] == NULL) int_memory[i] = &mb_holding_regs[i];
+			if (int_memory[i - MIN_16B_RANGE] == NULL) int_memory[i - MIN_16B_RANGE] = &mb_holding_regs[i];
 	}
 
+	io_map_generation++;
+	pthread_mutex_unlock(&bufferLock);
+}
+
+//-----------------------------------------------------------------------------
+// Requests from Modbus clients don't take bufferLock directly. They go through
+// a priority gate first, where a request only proceeds when no request with a
+// higher priority is waiting. Requests are ordered by the priority class of
+// their client first, and then writes go ahead of reads from the same class.
+// This way control writes from the SCADA master don't queue behind bulk reads
+// from a busy HMI, while a low priority client can't jump ahead of a higher
+// class just by sending writes.
+//-----------------------------------------------------------------------------
+#define MB_NUM_REQUEST_PRIORITIES   (MB_NUM_PRIORITIES * 2)
+
+int waiting_requests[MB_NUM_REQUEST_PRIORITIES];
+pthread_mutex_t priorityLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t priorityCond = PTHREAD_COND_INITIALIZER;
+
+//Priority class of the client served by this thread, and priority of the
+//request currently being processed, from 0 to MB_NUM_REQUEST_PRIORITIES - 1
+thread_local int client_priority = MB_PRIORITY_NORMAL;
+thread_local int request_priority = MB_PRIORITY_NORMAL * 2;
+
+//Time spent by the current request waiting for bufferLock, in nanoseconds
+thread_local uint64_t lock_wait_ns = 0;
+
+//-----------------------------------------------------------------------------
+// Sets the priority class of the client whose requests will be processed next
+// by the calling thread
+//-----------------------------------------------------------------------------
+void setModbusClientPriority(int priority)
+{
+	client_priority = priority;
+}
+
+//-----------------------------------------------------------------------------
+// Verify if a function code writes to the OpenPLC buffers
+//-----------------------------------------------------------------------------
+bool isWriteFunction(unsigned char function_code)
+{
+	return (function_code == MB_FC_WRITE_COIL || function_code == MB_FC_WRITE_REGISTER ||
+			function_code == MB_FC_WRITE_MULTIPLE_COILS || function_code == MB_FC_WRITE_MULTIPLE_REGISTERS ||
+			function_code == MB_FC_MASK_WRITE_REGISTER || function_code == MB_FC_READ_WRITE_MULTIPLE_REGISTERS);
+}
+
+//-----------------------------------------------------------------------------
+// Verify if a request with higher priority is waiting for bufferLock. Must be
+// called with priorityLock held
+//-----------------------------------------------------------------------------
+bool higherPriorityWaiting(int priority)
+{
+	for (int p = priority + 1; p < MB_NUM_REQUEST_PRIORITIES; p++)
+	{
+		if (waiting_requests[p] > 0) return true;
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Locks bufferLock on behalf of a Modbus request, after every waiting request
+// with a higher priority got its turn
+//-----------------------------------------------------------------------------
+void lockBuffer()
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pthread_mutex_lock(&priorityLock);
+	waiting_requests[request_priority]++;
+	while (higherPriorityWaiting(request_priority)) pthread_cond_wait(&priorityCond, &priorityLock);
+	pthread_mutex_unlock(&priorityLock);
+
+	pthread_mutex_lock(&bufferLock);
+
+	pthread_mutex_lock(&priorityLock);
+	waiting_requests[request_priority]--;
+	pthread_cond_broadcast(&priorityCond);
+	pthread_mutex_unlock(&priorityLock);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	lock_wait_ns += (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the time the last request processed by the calling thread spent
+// waiting for bufferLock, in nanoseconds
+//-----------------------------------------------------------------------------
+uint64_t modbusLockWait()
+{
+	return lock_wait_ns;
+}
+
+//-----------------------------------------------------------------------------
+// Unlocks bufferLock taken by lockBuffer()
+//-----------------------------------------------------------------------------
+void unlockBuffer()
+{
 	pthread_mutex_unlock(&bufferLock);
 }
 
@@ -163,35 +643,28 @@ void ReadCoils(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
+	if (!mapRangeIsValid(MB_AREA_COILS, Start, CoilDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
 	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
+	for(int i = 0; i < ByteDataLength; i++)
 	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_COILS)
-			{
-				if (bool_output[position/8][position%8] != NULL)
-				{
-					bitWrite(buffer[9 + i], j, *bool_output[position/8][position%8]);
-				}
-				else
-				{
-					bitWrite(buffer[9 + i], j, 0);
-				}
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
+		buffer[9 + i] = 0;
 	}
-	pthread_mutex_unlock(&bufferLock);
+
+	lockBuffer();
+	for(int i = 0; i < CoilDataLength; i++)
+	{
+		bitWrite(buffer[9 + i / 8], i % 8, readMappedBit(MB_AREA_COILS, Start + i));
+	}
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -230,35 +703,28 @@ void ReadDiscreteInputs(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
-	//Preparing response
+	if (!mapRangeIsValid(MB_AREA_DISCRETE_INPUTS, Start, InputDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
+	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
+	for(int i = 0; i < ByteDataLength; i++)
 	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_DISCRETE_INPUT)
-			{
-				if (bool_input[position/8][position%8] != NULL)
-				{
-					bitWrite(buffer[9 + i], j, *bool_input[position/8][position%8]);
-				}
-				else
-				{
-					bitWrite(buffer[9 + i], j, 0);
-				}
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
+		buffer[9 + i] = 0;
 	}
-	pthread_mutex_unlock(&bufferLock);
+
+	lockBuffer();
+	for(int i = 0; i < InputDataLength; i++)
+	{
+		bitWrite(buffer[9 + i / 8], i % 8, readMappedBit(MB_AREA_DISCRETE_INPUTS, Start + i));
+	}
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -296,110 +762,25 @@ void ReadHoldingRegisters(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
+	if (!mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, Start, WordDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
 	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
+	lockBuffer();
 	for(int i = 0; i < WordDataLength; i++)
 	{
-		int position = Start + i;
-		if (position <= MIN_16B_RANGE)
-		{
-			if (int_output[position] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_output[position]);
-				buffer[10 + i * 2] = lowByte(*int_output[position]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
-		}
-		//accessing memory
-		//16-bit registers
-		else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_memory[position - MIN_16B_RANGE]);
-				buffer[10 + i * 2] = lowByte(*int_memory[position - MIN_16B_RANGE]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
-		}
-		//32-bit registers
-		else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-		{
-			if (dint_memory[(position - MIN_32B_RANGE)/2] != NULL)
-			{
-				if ((position - MIN_32B_RANGE) % 2 == 0) //first word
-				{
-					uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] >> 16);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else //second word
-				{
-					uint16_t tempValue = (uint16_t)(*dint_memory[(position - MIN_32B_RANGE)/2] & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = mb_holding_regs[position];
-				buffer[10 + i * 2] = mb_holding_regs[position];
-			}
-		}
-		//64-bit registers
-		else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-		{
-			if (lint_memory[(position - MIN_64B_RANGE)/4] != NULL)
-			{
-				if ((position - MIN_64B_RANGE) % 4 == 0) //first word
-				{
-					uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] >> 48);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 1)//second word
-				{
-					uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 32) & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 2)//third word
-				{
-					uint16_t tempValue = (uint16_t)((*lint_memory[(position - MIN_64B_RANGE)/4] >> 16) & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-				else if ((position - MIN_64B_RANGE) % 4 == 3)//fourth word
-				{
-					uint16_t tempValue = (uint16_t)(*lint_memory[(position - MIN_64B_RANGE)/4] & 0xffff);
-					buffer[ 9 + i * 2] = highByte(tempValue);
-					buffer[10 + i * 2] = lowByte(tempValue);
-				}
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = mb_holding_regs[position];
-				buffer[10 + i * 2] = mb_holding_regs[position];
-			}
-		}
-		//invalid address
-		else
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
+		IEC_UINT value = readMappedRegister(MB_AREA_HOLDING_REGISTERS, Start + i);
+		buffer[ 9 + i * 2] = highByte(value);
+		buffer[10 + i * 2] = lowByte(value);
 	}
-	pthread_mutex_unlock(&bufferLock);
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -437,34 +818,25 @@ void ReadInputRegisters(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
+	if (!mapRangeIsValid(MB_AREA_INPUT_REGISTERS, Start, WordDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
 	//preparing response
 	buffer[4] = highByte(ByteDataLength + 3);
 	buffer[5] = lowByte(ByteDataLength + 3); //Number of bytes after this one
 	buffer[8] = ByteDataLength;     //Number of bytes of data
 
-	pthread_mutex_lock(&bufferLock);
+	lockBuffer();
 	for(int i = 0; i < WordDataLength; i++)
 	{
-		int position = Start + i;
-		if (position < MAX_INP_REGS)
-		{
-			if (int_input[position] != NULL)
-			{
-				buffer[ 9 + i * 2] = highByte(*int_input[position]);
-				buffer[10 + i * 2] = lowByte(*int_input[position]);
-			}
-			else
-			{
-				buffer[ 9 + i * 2] = 0;
-				buffer[10 + i * 2] = 0;
-			}
-		}
-		else //invalid address
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
+		IEC_UINT value = readMappedRegister(MB_AREA_INPUT_REGISTERS, Start + i);
+		buffer[ 9 + i * 2] = highByte(value);
+		buffer[10 + i * 2] = lowByte(value);
 	}
-	pthread_mutex_unlock(&bufferLock);
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -493,7 +865,7 @@ void WriteCoil(unsigned char *buffer, int bufferSize)
 
 	Start = word(buffer[8], buffer[9]);
 
-	if (Start < MAX_COILS)
+	if (mapRangeIsValid(MB_AREA_COILS, Start, 1))
 	{
 		unsigned char value;
 		if (word(buffer[10], buffer[11]) > 0)
@@ -505,12 +877,9 @@ void WriteCoil(unsigned char *buffer, int bufferSize)
 			value = 0;
 		}
 
-		pthread_mutex_lock(&bufferLock);
-		if (bool_output[Start/8][Start%8] != NULL)
-		{
-			*bool_output[Start/8][Start%8] = value;
-		}
-		pthread_mutex_unlock(&bufferLock);
+		lockBuffer();
+		writeMappedBit(MB_AREA_COILS, Start, value);
+		unlockBuffer();
 	}
 
 	else //invalid address
@@ -547,85 +916,16 @@ void WriteRegister(unsigned char *buffer, int bufferSize)
 
 	Start = word(buffer[8],buffer[9]);
 
-	pthread_mutex_lock(&bufferLock);
-	//analog outputs
-	if (Start <= MIN_16B_RANGE)
+	if (mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, Start, 1))
 	{
-		if (int_output[Start] != NULL)
-		{
-			*int_output[Start] = word(buffer[10],buffer[11]);
-		}
-	}
-	//accessing memory
-	//16-bit registers
-	else if (Start >= MIN_16B_RANGE && Start <= MAX_16B_RANGE)
-	{
-		if (int_memory[Start - MIN_16B_RANGE] != NULL)
-		{
-			*int_memory[Start - MIN_16B_RANGE] = word(buffer[10],buffer[11]);
-		}
-	}
-	//32-bit registers
-	else if (Start >= MIN_32B_RANGE && Start <= MAX_32B_RANGE)
-	{
-		if (dint_memory[(Start - MIN_32B_RANGE)/2] != NULL)
-		{
-			uint32_t tempValue = (uint32_t)word(buffer[10],buffer[11]);
-
-			if ((Start - MIN_32B_RANGE) % 2 == 0) //first word
-			{
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] & 0x0000ffff;
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] | (tempValue << 16);
-			}
-			else //second word
-			{
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] & 0xffff0000;
-				*dint_memory[(Start - MIN_32B_RANGE) / 2] = *dint_memory[(Start - MIN_32B_RANGE) / 2] | tempValue;
-			}
-		}
-		else
-		{
-			mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-		}
-	}
-	//64-bit registers
-	else if (Start >= MIN_64B_RANGE && Start <= MAX_64B_RANGE)
-	{
-		if (lint_memory[(Start - MIN_64B_RANGE)/4] != NULL)
-		{
-			uint64_t tempValue = (uint64_t)word(buffer[10],buffer[11]);
-
-			if ((Start - MIN_64B_RANGE) % 4 == 0) //first word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0x0000ffffffffffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 48);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 1) //second word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffff0000ffffffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 32);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 2) //third word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffffffff0000ffff;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | (tempValue << 16);
-			}
-			else if ((Start - MIN_64B_RANGE) % 4 == 3) //fourth word
-			{
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] & 0xffffffffffff0000;
-				*lint_memory[(Start - MIN_64B_RANGE) / 4] = *lint_memory[(Start - MIN_64B_RANGE) / 4] | tempValue;
-			}
-		}
-		else
-		{
-			mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-		}
+		lockBuffer();
+		writeMappedRegister(MB_AREA_HOLDING_REGISTERS, Start, word(buffer[10],buffer[11]));
+		unlockBuffer();
 	}
 	else //invalid address
 	{
 		mb_error = ERR_ILLEGAL_DATA_ADDRESS;
 	}
-	pthread_mutex_unlock(&bufferLock);
 
 	if (mb_error != ERR_NONE)
 	{
@@ -666,27 +966,24 @@ void WriteMultipleCoils(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
+	//the whole range is checked before writing, so that an invalid request
+	//doesn't leave the coils partially written
+	if (!mapRangeIsValid(MB_AREA_COILS, Start, CoilDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
 	//preparing response
 	buffer[4] = 0;
 	buffer[5] = 6; //Number of bytes after this one.
 
-	pthread_mutex_lock(&bufferLock);
-	for(int i = 0; i < ByteDataLength ; i++)
+	lockBuffer();
+	for(int i = 0; i < CoilDataLength; i++)
 	{
-		for(int j = 0; j < 8; j++)
-		{
-			int position = Start + i * 8 + j;
-			if (position < MAX_COILS)
-			{
-				if (bool_output[position/8][position%8] != NULL) *bool_output[position/8][position%8] = bitRead(buffer[13 + i], j);
-			}
-			else //invalid address
-			{
-				mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-			}
-		}
+		writeMappedBit(MB_AREA_COILS, Start + i, bitRead(buffer[13 + i / 8], i % 8));
 	}
-	pthread_mutex_unlock(&bufferLock);
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -724,87 +1021,24 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
 		return;
 	}
 
+	//the whole range is checked before writing, so that an invalid request
+	//doesn't leave the registers partially written
+	if (!mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, Start, WordDataLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
 	//preparing response
 	buffer[4] = 0;
 	buffer[5] = 6; //Number of bytes after this one.
 
-	pthread_mutex_lock(&bufferLock);
+	lockBuffer();
 	for(int i = 0; i < WordDataLength; i++)
 	{
-		int position = Start + i;
-		//analog outputs
-		if (position <= MIN_16B_RANGE)
-		{
-			if (int_output[position] != NULL) *int_output[position] =  word(buffer[13 + i * 2], buffer[14 + i * 2]);
-		}
-		//accessing memory
-		//16-bit registers
-		else if (position >= MIN_16B_RANGE && position <= MAX_16B_RANGE)
-		{
-			if (int_memory[position - MIN_16B_RANGE] != NULL) *int_memory[position - MIN_16B_RANGE] = word(buffer[13 + i * 2], buffer[14 + i * 2]);
-		}
-		//32-bit registers
-		else if (position >= MIN_32B_RANGE && position <= MAX_32B_RANGE)
-		{
-			if (dint_memory[(Start - MIN_32B_RANGE)/2] != NULL)
-			{
-				uint32_t tempValue = (uint32_t)word(buffer[13 + i * 2], buffer[14 + i * 2]);
-
-				if ((position - MIN_32B_RANGE) % 2 == 0) //first word
-				{
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] & 0x0000ffff;
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] | (tempValue << 16);
-				}
-				else //second word
-				{
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] & 0xffff0000;
-					*dint_memory[(position - MIN_32B_RANGE) / 2] = *dint_memory[(position - MIN_32B_RANGE) / 2] | tempValue;
-				}
-			}
-			else
-			{
-				mb_holding_regs[position] = word(buffer[13 + i * 2], buffer[14 + i * 2]);
-			}
-		}
-		//64-bit registers
-		else if (position >= MIN_64B_RANGE && position <= MAX_64B_RANGE)
-		{
-			if (lint_memory[(position - MIN_64B_RANGE)/4] != NULL)
-			{
-				uint64_t tempValue = (uint64_t)word(buffer[13 + i * 2], buffer[14 + i * 2]);
-
-				if ((position - MIN_64B_RANGE) % 4 == 0) //first word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0x0000ffffffffffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 48);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 1) //second word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffff0000ffffffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 32);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 2) //third word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffffffff0000ffff;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | (tempValue << 16);
-				}
-				else if ((Start - MIN_64B_RANGE) % 4 == 3) //fourth word
-				{
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] & 0xffffffffffff0000;
-					*lint_memory[(position - MIN_64B_RANGE) / 4] = *lint_memory[(position - MIN_64B_RANGE) / 4] | tempValue;
-				}
-			}
-			else
-			{
-				mb_holding_regs[Start] = word(buffer[10],buffer[11]);
-			}
-		}
-		else //invalid address
-		{
-			mb_error = ERR_ILLEGAL_DATA_ADDRESS;
-		}
+		writeMappedRegister(MB_AREA_HOLDING_REGISTERS, Start + i, word(buffer[13 + i * 2], buffer[14 + i * 2]));
 	}
-	pthread_mutex_unlock(&bufferLock);
+	unlockBuffer();
 
 	if (mb_error != ERR_NONE)
 	{
@@ -816,6 +1050,202 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Mask Write Register. The register is modified
+// in place while holding bufferLock, so the new value is applied between two
+// PLC scans without a read-modify-write round trip from the client
+//-----------------------------------------------------------------------------
+void MaskWriteRegister(unsigned char *buffer, int bufferSize)
+{
+	int Start;
+	int mb_error = ERR_NONE;
+	IEC_UINT AndMask, OrMask, value;
+
+	//this request must have at least 14 bytes. If it doesn't, it's a corrupted message
+	if (bufferSize < 14)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	Start = word(buffer[8], buffer[9]);
+	AndMask = word(buffer[10], buffer[11]);
+	OrMask = word(buffer[12], buffer[13]);
+
+	if (mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, Start, 1))
+	{
+		lockBuffer();
+		value = readMappedRegister(MB_AREA_HOLDING_REGISTERS, Start);
+		value = (value & AndMask) | (OrMask & ~AndMask);
+		writeMappedRegister(MB_AREA_HOLDING_REGISTERS, Start, value);
+		unlockBuffer();
+	}
+	else //invalid address
+	{
+		mb_error = ERR_ILLEGAL_DATA_ADDRESS;
+	}
+
+	if (mb_error != ERR_NONE)
+	{
+		ModbusError(buffer, mb_error);
+	}
+	else
+	{
+		//the response is an echo of the request
+		buffer[4] = 0;
+		buffer[5] = 8; //Number of bytes after this one.
+		MessageLength = 14;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Read/Write Multiple Registers. The write and
+// the read are done under the same bufferLock, so the PLC program sees both
+// at the same scan boundary
+//-----------------------------------------------------------------------------
+void ReadWriteMultipleRegisters(unsigned char *buffer, int bufferSize)
+{
+	int ReadStart, ReadWordLength, WriteStart, WriteWordLength, WriteByteLength;
+
+	//this request must have at least 17 bytes. If it doesn't, it's a corrupted message
+	if (bufferSize < 17)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	ReadStart = word(buffer[8], buffer[9]);
+	ReadWordLength = word(buffer[10], buffer[11]);
+	WriteStart = word(buffer[12], buffer[13]);
+	WriteWordLength = word(buffer[14], buffer[15]);
+	WriteByteLength = WriteWordLength * 2;
+
+	//quantities allowed by the Modbus specification
+	if (ReadWordLength < 1 || ReadWordLength > 125 || WriteWordLength < 1 || WriteWordLength > 121)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	//this request must have all the bytes it wants to write. If it doesn't, it's a corrupted message
+	if ( (bufferSize < (17 + WriteByteLength)) || (buffer[16] != WriteByteLength) )
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	if (!mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, ReadStart, ReadWordLength) ||
+		!mapRangeIsValid(MB_AREA_HOLDING_REGISTERS, WriteStart, WriteWordLength))
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+		return;
+	}
+
+	lockBuffer();
+	//the write operation is performed before the read
+	for (int i = 0; i < WriteWordLength; i++)
+	{
+		writeMappedRegister(MB_AREA_HOLDING_REGISTERS, WriteStart + i, word(buffer[17 + i * 2], buffer[18 + i * 2]));
+	}
+
+	//the response overwrites the request data, which was already consumed
+	for (int i = 0; i < ReadWordLength; i++)
+	{
+		IEC_UINT value = readMappedRegister(MB_AREA_HOLDING_REGISTERS, ReadStart + i);
+		buffer[ 9 + i * 2] = highByte(value);
+		buffer[10 + i * 2] = lowByte(value);
+	}
+	unlockBuffer();
+
+	buffer[4] = highByte(ReadWordLength * 2 + 3);
+	buffer[5] = lowByte(ReadWordLength * 2 + 3); //Number of bytes after this one
+	buffer[8] = ReadWordLength * 2;     //Number of bytes of data
+	MessageLength = ReadWordLength * 2 + 9;
+}
+
+//-----------------------------------------------------------------------------
+// Implementation of Modbus/TCP Read Device Identification (FC 43 / MEI 14).
+// Basic and regular objects are supported with stream and individual access
+//-----------------------------------------------------------------------------
+void ReadDeviceIdentification(unsigned char *buffer, int bufferSize)
+{
+	int ReadDevIdCode, ObjectId, NumObjects, position;
+	bool MoreFollows = false;
+
+	//this request must have at least 11 bytes. If it doesn't, it's a corrupted message
+	if (bufferSize < 11)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	if (buffer[8] != MB_MEI_READ_DEVICE_ID)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_FUNCTION);
+		return;
+	}
+
+	ReadDevIdCode = buffer[9];
+	ObjectId = buffer[10];
+
+	if (ReadDevIdCode < MB_DEVID_BASIC || ReadDevIdCode > MB_DEVID_INDIVIDUAL)
+	{
+		ModbusError(buffer, ERR_ILLEGAL_DATA_VALUE);
+		return;
+	}
+
+	int lastObject;
+	if (ReadDevIdCode == MB_DEVID_INDIVIDUAL)
+	{
+		if (ObjectId >= MB_DEVID_NUM_OBJECTS)
+		{
+			ModbusError(buffer, ERR_ILLEGAL_DATA_ADDRESS);
+			return;
+		}
+		lastObject = ObjectId;
+	}
+	else
+	{
+		//extended objects are not implemented, so they are served as regular
+		lastObject = (ReadDevIdCode == MB_DEVID_BASIC) ? MB_DEVID_LAST_BASIC : MB_DEVID_NUM_OBJECTS - 1;
+		//an unknown object id restarts the stream from the first object
+		if (ObjectId > lastObject) ObjectId = 0;
+	}
+
+	//preparing response
+	buffer[9] = ReadDevIdCode;
+	buffer[10] = MB_DEVID_CONFORMITY;
+	NumObjects = 0;
+	position = 14;
+
+	for (int id = ObjectId; id <= lastObject; id++)
+	{
+		int objLength = strlen(device_id_objects[id]);
+
+		//the response must fit in a single Modbus PDU
+		if (position + 2 + objLength > MB_MAX_ADU_SIZE)
+		{
+			MoreFollows = true;
+			buffer[12] = id;
+			break;
+		}
+
+		buffer[position++] = id;
+		buffer[position++] = objLength;
+		memcpy(&buffer[position], device_id_objects[id], objLength);
+		position += objLength;
+		NumObjects++;
+	}
+
+	buffer[11] = MoreFollows ? 0xFF : 0x00;
+	if (!MoreFollows) buffer[12] = 0;
+	buffer[13] = NumObjects;
+
+	buffer[4] = highByte(position - 6);
+	buffer[5] = lowByte(position - 6); //Number of bytes after this one
+	MessageLength = position;
+}
+
 //-----------------------------------------------------------------------------
 // This function must parse and process the client request and write back the
 // response for it. The return value is the size of the response message in
@@ -824,6 +1254,12 @@ void WriteMultipleRegisters(unsigned char *buffer, int bufferSize)
 int processModbusMessage(unsigned char *buffer, int bufferSize)
 {
 	MessageLength = 0;
+	lock_wait_ns = 0;
+
+	//writes go ahead of reads from the same client class, but never ahead of
+	//requests from a higher class
+	request_priority = client_priority * 2;
+	if (bufferSize >= 8 && isWriteFunction(buffer[7])) request_priority++;
 
 	//check if the message is long enough
 	if (bufferSize < 8)
@@ -879,6 +1315,24 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
 		WriteMultipleRegisters(buffer, bufferSize);
 	}
 
+	//****************** Mask Write Register ******************
+	else if(buffer[7] == MB_FC_MASK_WRITE_REGISTER)
+	{
+		MaskWriteRegister(buffer, bufferSize);
+	}
+
+	//************* Read/Write Multiple Registers *************
+	else if(buffer[7] == MB_FC_READ_WRITE_MULTIPLE_REGISTERS)
+	{
+		ReadWriteMultipleRegisters(buffer, bufferSize);
+	}
+
+	//************* Read Device Identification ****************
+	else if(buffer[7] == MB_FC_ENCAPSULATED_INTERFACE)
+	{
+		ReadDeviceIdentification(buffer, bufferSize);
+	}
+
 	//****************** Function Code Error ******************
 	else
 	{
@@ -887,3 +1341,17 @@ int processModbusMessage(unsigned char *buffer, int bufferSize)
 
 	return MessageLength;
 }
+
+//-----------------------------------------------------------------------------
+// Builds a Slave Device Busy exception for the request in the buffer, for
+// servers that must reject a request without processing it. The return value
+// is the size of the response message in bytes.
+//-----------------------------------------------------------------------------
+int modbusBusyResponse(unsigned char *buffer, int bufferSize)
+{
+	if (bufferSize < 8) return 0;
+
+	lock_wait_ns = 0;
+	ModbusError(buffer, ERR_SLAVE_DEVICE_BUSY);
+	return MessageLength;
+}
@@ -32,30 +32,101 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <arpa/inet.h>
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <atomic>
 
 #include "ladder.h"
 
 #define MB_TCP				1
 #define MB_RTU				2
-#define MAX_MB_IO			400
+
+#define MB_BLOCK_DI			0
+#define MB_BLOCK_COILS		1
+#define MB_BLOCK_IR			2
+#define MB_BLOCK_HR_READ	3
+#define MB_BLOCK_HR_WRITE	4
+#define MB_NUM_BLOCKS		5
 
 using namespace std;
 
-uint8_t bool_input_buf[MAX_MB_IO];
-uint8_t bool_output_buf[MAX_MB_IO];
-uint16_t int_input_buf[MAX_MB_IO];
-uint16_t int_output_buf[MAX_MB_IO];
+//Exchanges data between a polling worker and the scan thread without locks.
+//The producer fills the back buffer and swaps it with the ready one, while
+//the consumer swaps its front buffer with the ready one when it holds fresh
+//data. Neither side ever waits for the other
+#define TB_FRESH			4
+
+#define MB_LINK_ONLINE		0
+#define MB_LINK_CONNECTING	1
+#define MB_LINK_BACKOFF		2
+
+#define MB_WRITE_ALWAYS		0
+#define MB_WRITE_ON_CHANGE	1
+
+#define MB_DIAG_SIZE		8
 
-pthread_mutex_t ioLock;
+struct MB_triple_buffer
+{
+	void *buffers[3];
+	std::atomic<int> ready;		//index of the ready buffer, plus TB_FRESH
+	int back;					//owned by the producer
+	int front;					//owned by the consumer
+};
+
+//Run of a block's values that maps to consecutive variables in memory
+struct MB_copy
+{
+	uint16_t block_offset;
+	uint16_t count;
+	void *variable;			//first variable of the run on the process image
+};
 
 struct MB_address
 {
 	uint16_t start_address;
 	uint16_t num_regs;
+	uint32_t period;		//ms, 0 to use the device's period
+	uint32_t offset;		//ms, 0 to use the device's offset
+
+	//position of this block's first value on the process image, in bits for
+	//discrete inputs and coils and in words for registers
+	int target;
+	bool has_target;		//set on mbconfig.cfg instead of laid out in order
+	int num_copies;
+	struct MB_copy *copies;
+	struct MB_triple_buffer data;
+
+	//write policy of output blocks. In MB_WRITE_ON_CHANGE mode only values
+	//that differ from the last ones acknowledged by the slave by more than
+	//the deadband are written, and the whole block is written again every
+	//refresh interval. The deadband compares the raw, unsigned register
+	//values, so a signed value crossing zero always counts as a change
+	uint8_t write_mode;
+	uint16_t deadband;
+	uint32_t refresh;		//ms, 0 to never write unchanged values again
+	uint64_t next_refresh;	//ns, on CLOCK_MONOTONIC
+	void *acked;
+	bool acked_valid;
+	bool write_all;			//the whole block is written on this poll
+};
+
+//A serial port shared by RTU devices. Transactions of all devices on the bus
+//are serialized by its worker and spaced by the t3.5 inter-frame silence
+struct MB_rtu_bus
+{
+	char port[100];
+	int baud;
+	char parity;
+	int data_bits;
+	int stop_bits;
+	modbus_t *ctx;
+	bool open;
+	uint64_t frame_gap;		//ns, t3.5
+	uint64_t turnaround;	//ns, after broadcasts
+	uint64_t idle_at;		//ns, on CLOCK_MONOTONIC, when the next frame may go out
 };
 
 struct MB_device
@@ -71,23 +142,170 @@ struct MB_device
 	int rtu_stop_bit;
 	uint8_t dev_id;
 	bool isConnected;
+	struct MB_rtu_bus *bus;		//NULL for TCP devices
+	uint32_t polling_period;	//ms, 0 to use the global Polling_Period
+	uint32_t polling_offset;	//ms
+	bool use_fc23;				//slave supports Read/Write Multiple Registers
+	int pipeline_depth;			//TCP transactions in flight, 1 to use libmodbus
+	struct MB_pipeline *pipeline;
+
+	//connection state and circuit breaker, read by printModbusMasterHealth()
+	int link;					//device whose connection is used to poll this one
+	std::atomic<uint8_t> link_state;
+	std::atomic<uint64_t> next_attempt;		//ns, on CLOCK_MONOTONIC
+	std::atomic<uint32_t> consecutive_failures;
+	std::atomic<uint32_t> breaker_trips;
+	std::atomic<uint32_t> connects;
+	int connect_fd;
+	uint64_t connect_deadline;	//ns, on CLOCK_MONOTONIC
+	unsigned int jitter_seed;
+
+	//diagnostics, copied to the %MD values at diagnostics_target by the scan
+	//thread. Transactions and latencies are recorded on the device that owns
+	//the connection, the age of the inputs on each device
+	int diagnostics_target;		//-1 if not mapped
+	std::atomic<uint64_t> last_read;		//ns, on CLOCK_MONOTONIC. 0 if never
+	std::atomic<uint32_t> last_latency;		//us
+	std::atomic<uint64_t> transactions;
+	std::atomic<uint64_t> failed_transactions;
+	struct MB_histogram *latency;
 
 	struct MB_address discrete_inputs;
 	struct MB_address coils;
 	struct MB_address input_registers;
 	struct MB_address holding_read_registers;
 	struct MB_address holding_registers;
+
+	//settings of the device on mbconfig.cfg that need a new connection or
+	//new buffers when they change. Compared when the config is reloaded
+	char *config;
+};
+
+//A register block polled by a task
+struct MB_block_ref
+{
+	int device;
+	int block;
+	bool failed;			//a request for this block failed on this poll
+};
+
+//Part of a request that belongs to one block
+struct MB_segment
+{
+	int ref;				//block on the task's block list
+	uint16_t block_offset;
+	uint16_t request_offset;
+	uint16_t count;
+};
+
+//One Modbus transaction. FC23 requests have both a read and a write part
+struct MB_request
+{
+	uint8_t function;
+	uint16_t read_start;
+	uint16_t read_count;
+	int num_read_segments;
+	struct MB_segment *read_segments;
+	uint16_t write_start;
+	uint16_t write_count;
+	int num_write_segments;
+	struct MB_segment *write_segments;
+	bool only_changes;		//some of the blocks written are in MB_WRITE_ON_CHANGE mode
+	uint8_t *changed;		//values of an only_changes request to be written
+};
+
+//Blocks of the same slave polled with the same period and offset, and the
+//requests planned to poll them
+struct MB_poll_task
+{
+	int device;				//device whose connection is used
+	uint8_t slave_id;
+	uint32_t period_ms;
+	uint32_t offset_ms;
+	uint64_t period;		//ns
+	uint64_t next_poll;		//ns, on CLOCK_MONOTONIC
+	int num_blocks;
+	struct MB_block_ref *blocks;
+	int num_requests;
+	struct MB_request *requests;
+};
+
+//Devices polled by the same thread. Each TCP endpoint gets its own worker,
+//while RTU devices sharing a serial port are polled by a single worker
+struct MB_worker
+{
+	char port[100];
+	uint8_t protocol;
+	uint16_t ip_port;
+	int num_devices;
+	int *devices;
+	int num_tasks;
+	struct MB_poll_task *tasks;
+
+	//used when a request spans several blocks
+	uint8_t bits[MODBUS_MAX_READ_BITS];
+	uint16_t read_registers[MODBUS_MAX_READ_REGISTERS];
+	uint16_t write_registers[MODBUS_MAX_WRITE_REGISTERS];
+
+	//batch of a task for the pipelined transport, and the request each
+	//transaction belongs to
+	int max_transactions;
+	struct MB_transaction *transactions;
+	int *transaction_requests;
+
+	pthread_t thread;
+	bool running;
+	std::atomic<bool> stop;	//set to stop the thread after its current poll
+	uint64_t cycle;			//last Scan_Synchronous cycle polled
 };
 
 struct MB_device *mb_devices;
 uint8_t num_devices;
+struct MB_worker *mb_workers;
+int num_workers = 0;
+struct MB_rtu_bus *mb_buses;
+int num_buses = 0;
+struct MB_rtu_bus *retired_buses;	//buses of the previous config, while reloading
+int num_retired_buses = 0;
 uint16_t polling_period = 100;
 uint16_t timeout = 1000;
+uint16_t coalesce_gap = 0;
+uint32_t rtu_turnaround = 100;
+uint32_t reconnect_min = 100;
+uint32_t reconnect_max = 10000;
+uint32_t breaker_threshold = 3;
+
+//Failed requests and connection attempts of all workers. Copied to the comm
+//error counter (%ML1026) by the scan thread, which holds bufferLock
+std::atomic<uint64_t> comm_errors(0);
+
+//Scan_Synchronous mode. Each scan starts a poll cycle on every worker right
+//after the outputs are published, and the next scan waits for it to finish
+std::atomic<bool> scan_synchronous(false);
+uint32_t scan_sync_timeout = 0;		//ms, 0 to wait up to one scan cycle
+pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t sync_start;
+pthread_cond_t sync_done;
+uint64_t sync_cycle = 0;
+int sync_workers = 0;				//workers that have tasks
+int sync_pending = 0;				//workers still polling the current cycle
+uint64_t sync_timeouts = 0;			//scans that stopped waiting for a cycle
+uint64_t sync_overruns = 0;			//scans that found the previous cycle running
+
+//generation of the process image the copy plans were compiled for
+uint32_t copy_plan_generation = 0;
+
+//held while the config is reloaded, so that the device list doesn't change
+//under the interactive and metrics servers
+pthread_mutex_t reloadLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *block_names[MB_NUM_BLOCKS] = {"Discrete Inputs", "Coils", "Input Registers", "Holding Registers - Read", "Holding Registers"};
 
 //-----------------------------------------------------------------------------
-// Finds the data between the separators on the line provided
+// Finds the data between the separators on the line provided. At most
+// size - 1 chars are copied to buf
 //-----------------------------------------------------------------------------
-void getData(char *line, char *buf, char separator1, char separator2)
+void getData(char *line, char *buf, int size, char separator1, char separator2)
 {
 	int i=0, j=0;
 	buf[j] = '\0';
@@ -96,9 +314,10 @@ void getData(char *line, char *buf, char separator1, char separator2)
 	{
 		i++;
 	}
+	if (line[i] == '\0') return;
 	i++;
 
-	while (line[i] != separator2 && line[i] != '\0')
+	while (line[i] != separator2 && line[i] != '\0' && j < size - 1)
 	{
 		buf[j] = line[i];
 		i++;
@@ -108,38 +327,117 @@ void getData(char *line, char *buf, char separator1, char separator2)
 }
 
 //-----------------------------------------------------------------------------
-// Get the number of the Modbus device
+// Get the number of the Modbus device. Returns -1 if the line doesn't start
+// with a valid device number
 //-----------------------------------------------------------------------------
 int getDeviceNumber(char *line)
 {
 	char temp[5];
 	int i = 0, j = 6;
+	temp[0] = '\0';
 
 	while (line[j] != '.')
 	{
+		if (line[j] < '0' || line[j] > '9' || i == sizeof(temp) - 1) return -1;
 		temp[i] = line[j];
 		i++;
 		j++;
 		temp[i] = '\0';
 	}
 
-	return(atoi(temp));
+	return (i > 0) ? atoi(temp) : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Returns a register block of the device provided
+//-----------------------------------------------------------------------------
+struct MB_address *blockOf(struct MB_device *device, int block)
+{
+    switch (block)
+    {
+        case MB_BLOCK_DI: return &device->discrete_inputs;
+        case MB_BLOCK_COILS: return &device->coils;
+        case MB_BLOCK_IR: return &device->input_registers;
+        case MB_BLOCK_HR_READ: return &device->holding_read_registers;
+        default: return &device->holding_registers;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the register block of a device
+//-----------------------------------------------------------------------------
+struct MB_address *deviceBlock(int dev, int block)
+{
+    return blockOf(&mb_devices[dev], block);
+}
+
+//-----------------------------------------------------------------------------
+// Parses the process image address of a block, such as %IX100.0 or %QW120,
+// and returns its index on the image: in bits for %IX and %QX and in words
+// for %IW and %QW. Returns -1 if the address is invalid or not of the type
+// provided
+//-----------------------------------------------------------------------------
+int parseTarget(char *line, const char *type)
+{
+    char temp_buffer[20];
+    char *end;
+
+    getData(line, temp_buffer, sizeof(temp_buffer), '"', '"');
+    if (strncmp(temp_buffer, type, 3)) return -1;
+
+    long index = strtol(&temp_buffer[3], &end, 10);
+    if (end == &temp_buffer[3] || index < 0 || index >= BUFFER_SIZE) return -1;
+
+    if (type[2] == 'X')
+    {
+        if (*end != '.') return -1;
+        char *bit_start = end + 1;
+        long bit = strtol(bit_start, &end, 10);
+        if (end == bit_start || *end != '\0' || bit < 0 || bit > 7) return -1;
+        return index * 8 + bit;
+    }
+
+    return (*end == '\0') ? index : -1;
+}
+
+//-----------------------------------------------------------------------------
+// Sets the target of a block from the config, or logs why it can't be used
+//-----------------------------------------------------------------------------
+void setTarget(struct MB_device *device, int dev, int block, char *line)
+{
+    const char *types[MB_NUM_BLOCKS] = {"%IX", "%QX", "%IW", "%IW", "%QW"};
+    unsigned char log_msg[1000];
+
+    int target = parseTarget(line, types[block]);
+    if (target < 0)
+    {
+        sprintf(log_msg, "Modbus Master: invalid target for %s of MB device %d. Expected a %s address\n",
+                block_names[block], dev, types[block]);
+        log(log_msg);
+        return;
+    }
+
+    blockOf(device, block)->target = target;
+    blockOf(device, block)->has_target = true;
 }
 
 //-----------------------------------------------------------------------------
-// get the type of function or parameter for the Modbus device
+// get the type of function or parameter for the Modbus device. At most
+// size - 1 chars are copied to parameter
 //-----------------------------------------------------------------------------
-void getFunction(char *line, char *parameter)
+void getFunction(char *line, char *parameter, int size)
 {
 	int i = 0, j = 0;
+	parameter[0] = '\0';
 
-	while (line[j] != '.')
+	while (line[j] != '.' && line[j] != '\0')
 	{
 		j++;
 	}
+	if (line[j] == '\0') return;
 	j++;
 
-	while (line[j] != ' ' && line[j] != '=' && line[j] != '(')
+	while (line[j] != ' ' && line[j] != '=' && line[j] != '(' && line[j] != '\0' && i < size - 1)
 	{
 		parameter[i] = line[j];
 		i++;
@@ -148,158 +446,393 @@ void getFunction(char *line, char *parameter)
 	}
 }
 
-void parseConfig()
+//-----------------------------------------------------------------------------
+// Adds a setting of a device to its config. Where its blocks are mapped and
+// when they are polled can change without touching the connection, so those
+// settings are left out
+//-----------------------------------------------------------------------------
+void appendConfig(struct MB_device *device, char *function, char *line)
+{
+    int length = strlen(function);
+    if (length >= 6 && (!strcmp(&function[length - 6], "Target") || !strcmp(&function[length - 6], "Period") ||
+                        !strcmp(&function[length - 6], "Offset")))
+        return;
+
+    int size = device->config ? strlen(device->config) : 0;
+    device->config = (char *)realloc(device->config, size + strlen(line) + 2);
+    sprintf(&device->config[size], "%s\n", line);
+}
+
+//-----------------------------------------------------------------------------
+// Parses a Modbus master config file into a new array of devices. The global
+// settings missing on the file go back to their defaults. Returns the number
+// of devices, or -1 if the file can't be opened
+//-----------------------------------------------------------------------------
+int parseConfig(const char *path, struct MB_device **devices_out)
 {
 	string line;
 	char line_str[1024];
-	ifstream cfgfile("mbconfig.cfg");
+	ifstream cfgfile(path);
+	struct MB_device *devices = NULL;
+	int count = 0;
+
+	polling_period = 100;
+	timeout = 1000;
+	coalesce_gap = 0;
+	rtu_turnaround = 100;
+	reconnect_min = 100;
+	reconnect_max = 10000;
+	breaker_threshold = 3;
+	scan_synchronous = false;
+	scan_sync_timeout = 0;
 
 	if (cfgfile.is_open())
 	{
 		while (getline(cfgfile, line))
 		{
-			strncpy(line_str, line.c_str(), 1024);
+			strncpy(line_str, line.c_str(), sizeof(line_str) - 1);
+			line_str[sizeof(line_str) - 1] = '\0';
 			if (line_str[0] != '#' && strlen(line_str) > 1)
 			{
 				if (!strncmp(line_str, "Num_Devices", 11))
 				{
 					char temp_buffer[5];
-					getData(line_str, temp_buffer, '"', '"');
-					num_devices = atoi(temp_buffer);
-					mb_devices = (struct MB_device *)malloc(num_devices*sizeof(struct MB_device));
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					if (devices == NULL)
+					{
+						count = atoi(temp_buffer);
+						if (count < 0 || count > 255) count = 0;
+						devices = (struct MB_device *)calloc(count ? count : 1, sizeof(struct MB_device));
+						for (int i = 0; i < count; i++) devices[i].diagnostics_target = -1;
+					}
 				}
                 else if (!strncmp(line_str, "Polling_Period", 14))
 				{
                     char temp_buffer[10];
-					getData(line_str, temp_buffer, '"', '"');
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
 					polling_period = atoi(temp_buffer);
                 }
                 else if (!strncmp(line_str, "Timeout", 7))
 				{
                     char temp_buffer[10];
-					getData(line_str, temp_buffer, '"', '"');
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
 					timeout = atoi(temp_buffer);
                 }
+                else if (!strncmp(line_str, "Reconnect_Min", 13))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					reconnect_min = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Reconnect_Max", 13))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					reconnect_max = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Breaker_Threshold", 17))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					breaker_threshold = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "RTU_Turnaround_Delay", 20))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					rtu_turnaround = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Coalesce_Gap", 12))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					coalesce_gap = atoi(temp_buffer);
+                }
+                else if (!strncmp(line_str, "Scan_Synchronous", 16))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					scan_synchronous = (!strcmp(temp_buffer, "1") || !strcmp(temp_buffer, "true"));
+                }
+                else if (!strncmp(line_str, "Scan_Sync_Timeout", 17))
+				{
+                    char temp_buffer[10];
+					getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+					scan_sync_timeout = atoi(temp_buffer);
+                }
 
 				else if (!strncmp(line_str, "device", 6))
 				{
 					int deviceNumber = getDeviceNumber(line_str);
 					char functionType[100];
-					getFunction(line_str, functionType);
+					getFunction(line_str, functionType, sizeof(functionType));
+
+					if (deviceNumber < 0 || deviceNumber >= count)
+					{
+						unsigned char log_msg[1000];
+						sprintf(log_msg, "Modbus Master: ignoring line of unknown MB device on %s: %.100s\n", path, line_str);
+						log(log_msg);
+						continue;
+					}
+					appendConfig(&devices[deviceNumber], functionType, strchr(line_str, '.') + 1);
 
 					if (!strncmp(functionType, "name", 4))
 					{
-						getData(line_str, mb_devices[deviceNumber].dev_name, '"', '"');
+						getData(line_str, devices[deviceNumber].dev_name, sizeof(devices[deviceNumber].dev_name), '"', '"');
 					}
 					else if (!strncmp(functionType, "protocol", 8))
 					{
 						char temp_buffer[5];
-						getData(line_str, temp_buffer, '"', '"');
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
 
 						if (!strncmp(temp_buffer, "TCP", 3))
-							mb_devices[deviceNumber].protocol = MB_TCP;
+							devices[deviceNumber].protocol = MB_TCP;
 						else if (!strncmp(temp_buffer, "RTU", 3))
-							mb_devices[deviceNumber].protocol = MB_RTU;
+							devices[deviceNumber].protocol = MB_RTU;
 					}
 					else if (!strncmp(functionType, "slave_id", 8))
 					{
 						char temp_buffer[5];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].dev_id = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].dev_id = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "address", 7))
 					{
-						getData(line_str, mb_devices[deviceNumber].dev_address, '"', '"');
+						getData(line_str, devices[deviceNumber].dev_address, sizeof(devices[deviceNumber].dev_address), '"', '"');
 					}
 					else if (!strncmp(functionType, "IP_Port", 7))
 					{
 						char temp_buffer[6];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].ip_port = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].ip_port = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "RTU_Baud_Rate", 13))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].rtu_baud = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].rtu_baud = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "RTU_Parity", 10))
 					{
 						char temp_buffer[3];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].rtu_parity = temp_buffer[0];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].rtu_parity = temp_buffer[0];
 					}
 					else if (!strncmp(functionType, "RTU_Data_Bits", 13))
 					{
 						char temp_buffer[6];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].rtu_data_bit = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].rtu_data_bit = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "RTU_Stop_Bits", 13))
 					{
 						char temp_buffer[20];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].rtu_stop_bit = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].rtu_stop_bit = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Discrete_Inputs_Start", 21))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].discrete_inputs.start_address = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].discrete_inputs.start_address = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Discrete_Inputs_Size", 20))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].discrete_inputs.num_regs = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].discrete_inputs.num_regs = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Coils_Start", 11))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].coils.start_address = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.start_address = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Coils_Size", 10))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].coils.num_regs = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.num_regs = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Input_Registers_Start", 21))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].input_registers.start_address = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].input_registers.start_address = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Input_Registers_Size", 20))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].input_registers.num_regs = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].input_registers.num_regs = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Holding_Registers_Read_Start", 28))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].holding_read_registers.start_address = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_read_registers.start_address = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Holding_Registers_Read_Size", 27))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].holding_read_registers.num_regs = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_read_registers.num_regs = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Holding_Registers_Start", 23))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].holding_registers.start_address = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.start_address = atoi(temp_buffer);
 					}
 					else if (!strncmp(functionType, "Holding_Registers_Size", 22))
 					{
 						char temp_buffer[10];
-						getData(line_str, temp_buffer, '"', '"');
-						mb_devices[deviceNumber].holding_registers.num_regs = atoi(temp_buffer);
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.num_regs = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Coils_Write_Mode", 16))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.write_mode = (!strcmp(temp_buffer, "change") ? MB_WRITE_ON_CHANGE : MB_WRITE_ALWAYS);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Write_Mode", 28))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.write_mode = (!strcmp(temp_buffer, "change") ? MB_WRITE_ON_CHANGE : MB_WRITE_ALWAYS);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Deadband", 26))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.deadband = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Coils_Refresh", 13))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.refresh = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Refresh", 25))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.refresh = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Discrete_Inputs_Target", 22))
+					{
+						setTarget(&devices[deviceNumber], deviceNumber, MB_BLOCK_DI, line_str);
+					}
+					else if (!strncmp(functionType, "Coils_Target", 12))
+					{
+						setTarget(&devices[deviceNumber], deviceNumber, MB_BLOCK_COILS, line_str);
+					}
+					else if (!strncmp(functionType, "Input_Registers_Target", 22))
+					{
+						setTarget(&devices[deviceNumber], deviceNumber, MB_BLOCK_IR, line_str);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Read_Target", 29))
+					{
+						setTarget(&devices[deviceNumber], deviceNumber, MB_BLOCK_HR_READ, line_str);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Target", 24))
+					{
+						setTarget(&devices[deviceNumber], deviceNumber, MB_BLOCK_HR_WRITE, line_str);
+					}
+					else if (!strncmp(functionType, "Diagnostics_Target", 18))
+					{
+						devices[deviceNumber].diagnostics_target = parseTarget(line_str, "%MD");
+						if (devices[deviceNumber].diagnostics_target < 0)
+						{
+							unsigned char log_msg[1000];
+							sprintf(log_msg, "Modbus Master: invalid diagnostics target for MB device %d. Expected a %%MD address\n", deviceNumber);
+							log(log_msg);
+						}
+					}
+					else if (!strncmp(functionType, "Pipeline_Depth", 14))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].pipeline_depth = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Use_FC23", 8))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].use_fc23 = (!strcmp(temp_buffer, "1") || !strcmp(temp_buffer, "true"));
+					}
+					else if (!strncmp(functionType, "Polling_Period", 14))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].polling_period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Polling_Offset", 14))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].polling_offset = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Discrete_Inputs_Period", 22))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].discrete_inputs.period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Discrete_Inputs_Offset", 22))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].discrete_inputs.offset = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Coils_Period", 12))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Coils_Offset", 12))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].coils.offset = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Input_Registers_Period", 22))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].input_registers.period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Input_Registers_Offset", 22))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].input_registers.offset = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Read_Period", 29))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_read_registers.period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Read_Offset", 29))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_read_registers.offset = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Period", 24))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.period = atoi(temp_buffer);
+					}
+					else if (!strncmp(functionType, "Holding_Registers_Offset", 24))
+					{
+						char temp_buffer[10];
+						getData(line_str, temp_buffer, sizeof(temp_buffer), '"', '"');
+						devices[deviceNumber].holding_registers.offset = atoi(temp_buffer);
 					}
 				}
 			}
@@ -308,303 +841,1925 @@ void parseConfig()
     else
     {
         unsigned char log_msg[1000];
-        sprintf(log_msg, "Skipping configuration of Slave Devices (mbconfig.cfg file not found)\n");
+        sprintf(log_msg, "Skipping configuration of Slave Devices (%s file not found)\n", path);
         log(log_msg);
+        return -1;
     }
 
-	//Parser Debug
-	///*
-	for (int i = 0; i < num_devices; i++)
-	{
-		printf("Device %d\n", i);
-		printf("Name: %s\n", mb_devices[i].dev_name);
-		printf("Protocol: %d\n", mb_devices[i].protocol);
-		printf("Address: %s\n", mb_devices[i].dev_address);
-		printf("IP Port: %d\n", mb_devices[i].ip_port);
-		printf("Baud rate: %d\n", mb_devices[i].rtu_baud);
-		printf("Parity: %c\n", mb_devices[i].rtu_parity);
-		printf("Data Bits: %d\n", mb_devices[i].rtu_data_bit);
-		printf("Stop Bits: %d\n", mb_devices[i].rtu_stop_bit);
-		printf("DI Start: %d\n", mb_devices[i].discrete_inputs.start_address);
-		printf("DI Size: %d\n", mb_devices[i].discrete_inputs.num_regs);
-		printf("Coils Start: %d\n", mb_devices[i].coils.start_address);
-		printf("Coils Size: %d\n", mb_devices[i].coils.num_regs);
-		printf("IR Start: %d\n", mb_devices[i].input_registers.start_address);
-		printf("IR Size: %d\n", mb_devices[i].input_registers.num_regs);
-		printf("HR Start: %d\n", mb_devices[i].holding_registers.start_address);
-		printf("HR Size: %d\n", mb_devices[i].holding_registers.num_regs);
-		printf("\n\n");
-	}
-	//*/
+	*devices_out = devices;
+	return count;
 }
 
 
 //-----------------------------------------------------------------------------
-// Thread to poll each slave device
+// Assigns the position of each block's data on the process image. Blocks
+// with a Target on mbconfig.cfg are placed there. The others are laid out
+// in the order they appear on mbconfig.cfg, starting at %IX100.0, %QX100.0,
+// %IW100 and %QW100, as shown on the web interface. Blocks that overlap on
+// the image or don't fit in it are logged
 //-----------------------------------------------------------------------------
-void *querySlaveDevices(void *arg)
+void assignTargets()
 {
-    while (run_openplc)
+    unsigned char log_msg[1000];
+    int next_target[MB_NUM_BLOCKS] = {100 * 8, 100 * 8, 100, 100, 100};
+    int image[MB_NUM_BLOCKS] = {0, 1, 2, 2, 3};
+    int image_size[MB_NUM_BLOCKS] = {BUFFER_SIZE * 8, BUFFER_SIZE * 8, BUFFER_SIZE, BUFFER_SIZE, BUFFER_SIZE};
+
+    for (int i = 0; i < num_devices; i++)
     {
-        unsigned char log_msg[1000];
-        
-        uint16_t bool_input_index = 0;
-        uint16_t bool_output_index = 0;
-        uint16_t int_input_index = 0;
-        uint16_t int_output_index = 0;
+        for (int block = 0; block < MB_NUM_BLOCKS; block++)
+        {
+            struct MB_address *address = deviceBlock(i, block);
+            if (address->has_target) continue;
+
+            //the read holding registers follow the input registers
+            int *next = &next_target[(block == MB_BLOCK_HR_READ) ? MB_BLOCK_IR : block];
+            address->target = *next;
+            *next += address->num_regs;
+        }
+    }
 
-        for (int i = 0; i < num_devices; i++)
+    for (int i = 0; i < num_devices; i++)
+    {
+        for (int block = 0; block < MB_NUM_BLOCKS; block++)
         {
-            //Verify if device is connected
-            if (!mb_devices[i].isConnected)
+            struct MB_address *address = deviceBlock(i, block);
+            if (address->num_regs == 0) continue;
+
+            if (address->target + address->num_regs > image_size[block])
             {
-                sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", mb_devices[i].dev_name);
+                sprintf(log_msg, "Modbus Master: %s of MB device %s don't fit in the process image. %d values are not mapped\n",
+                        block_names[block], mb_devices[i].dev_name, address->target + address->num_regs - image_size[block]);
                 log(log_msg);
-                if (modbus_connect(mb_devices[i].mb_ctx) == -1)
-                {
-                    sprintf(log_msg, "Connection failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                    log(log_msg);
-                    
-                    if (special_functions[2] != NULL) *special_functions[2]++;
-                    
-                    // Because this device is not connected, we skip those input registers
-                    bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                    int_input_index += (mb_devices[i].input_registers.num_regs);
-                    int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                    bool_output_index += (mb_devices[i].coils.num_regs);
-                    int_output_index += (mb_devices[i].holding_registers.num_regs);
-                }
-                else
-                {
-                    sprintf(log_msg, "Connected to MB device %s\n", mb_devices[i].dev_name);
-                    log(log_msg);
-                    mb_devices[i].isConnected = true;
-                }
             }
 
-            if (mb_devices[i].isConnected)
+            for (int j = i; j < num_devices; j++)
             {
-                struct timespec ts;
-                ts.tv_sec = 0;
-                ts.tv_nsec = (1000*1000*1000*28)/mb_devices[i].rtu_baud;
-
-                //Read discrete inputs
-                if (mb_devices[i].discrete_inputs.num_regs != 0)
-                {
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].discrete_inputs.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_bits(mb_devices[i].mb_ctx, mb_devices[i].discrete_inputs.start_address,
-                                                            mb_devices[i].discrete_inputs.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Discrete Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        bool_input_index += (mb_devices[i].discrete_inputs.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            bool_input_buf[bool_input_index] = tempBuff[j];
-                            bool_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
-
-                    free(tempBuff);
-                }
-
-                //Write coils
-                if (mb_devices[i].coils.num_regs != 0)
+                for (int other_block = (j == i) ? block + 1 : 0; other_block < MB_NUM_BLOCKS; other_block++)
                 {
-                    uint8_t *tempBuff;
-                    tempBuff = (uint8_t *)malloc(mb_devices[i].coils.num_regs);
+                    struct MB_address *other = deviceBlock(j, other_block);
+                    if (image[other_block] != image[block] || other->num_regs == 0) continue;
 
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].coils.num_regs; j++)
+                    if (address->target < other->target + other->num_regs && other->target < address->target + address->num_regs)
                     {
-                        tempBuff[j] = bool_output_buf[bool_output_index];
-                        bool_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
-
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_bits(mb_devices[i].mb_ctx, mb_devices[i].coils.start_address, mb_devices[i].coils.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-
-                        sprintf(log_msg, "Modbus Write Coils failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
-
-                //Read input registers
-                if (mb_devices[i].input_registers.num_regs != 0)
-                {
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].input_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_input_registers(	mb_devices[i].mb_ctx, mb_devices[i].input_registers.start_address,
-                                                                    mb_devices[i].input_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Read Input Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
+                        sprintf(log_msg, "Modbus Master: %s of MB device %s overlap %s of MB device %s on the process image\n",
+                                block_names[block], mb_devices[i].dev_name, block_names[other_block], mb_devices[j].dev_name);
                         log(log_msg);
-                        int_input_index += (mb_devices[i].input_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        int_input_index++;
-                        pthread_mutex_unlock(&ioLock);
                     }
-
-                    free(tempBuff);
                 }
+            }
+        }
+    }
+}
 
-                //Read holding registers
-                if (mb_devices[i].holding_read_registers.num_regs != 0)
-                {
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_read_registers.num_regs);
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_read_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_read_registers.start_address,
-                                                           mb_devices[i].holding_read_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        sprintf(log_msg, "Modbus Read Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        int_input_index += (mb_devices[i].holding_read_registers.num_regs);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    else
-                    {
-                        pthread_mutex_lock(&ioLock);
-                        for (int j = 0; j < return_val; j++)
-                        {
-                            int_input_buf[int_input_index] = tempBuff[j];
-                            int_input_index++;
-                        }
-                        pthread_mutex_unlock(&ioLock);
-                    }
+//-----------------------------------------------------------------------------
+// Returns the process image variable at an index of the image a block is
+// mapped to, or NULL if there is none
+//-----------------------------------------------------------------------------
+void *imageVariable(int block, int index)
+{
+    switch (block)
+    {
+        case MB_BLOCK_DI:
+            return (index < BUFFER_SIZE * 8) ? bool_input[index / 8][index % 8] : NULL;
+        case MB_BLOCK_COILS:
+            return (index < BUFFER_SIZE * 8) ? bool_output[index / 8][index % 8] : NULL;
+        case MB_BLOCK_IR:
+        case MB_BLOCK_HR_READ:
+            return (index < BUFFER_SIZE) ? int_input[index] : NULL;
+        case MB_BLOCK_HR_WRITE:
+            return (index < BUFFER_SIZE) ? int_output[index] : NULL;
+    }
 
-                    free(tempBuff);
-                }
+    return NULL;
+}
 
-                //Write holding registers
-                if (mb_devices[i].holding_registers.num_regs != 0)
-                {
-                    uint16_t *tempBuff;
-                    tempBuff = (uint16_t *)malloc(2*mb_devices[i].holding_registers.num_regs);
+//-----------------------------------------------------------------------------
+// Compiles the copy plan of a block: the runs of its values that map to
+// consecutive variables in memory, so that each run is exchanged with the
+// process image with a single memcpy. Values without a variable on the image
+// are left out of the plan
+//-----------------------------------------------------------------------------
+void planBlockCopies(struct MB_address *address, int block)
+{
+    int value_size = (block == MB_BLOCK_DI || block == MB_BLOCK_COILS) ? sizeof(IEC_BOOL) : sizeof(IEC_UINT);
 
-                    pthread_mutex_lock(&ioLock);
-                    for (int j = 0; j < mb_devices[i].holding_registers.num_regs; j++)
-                    {
-                        tempBuff[j] = int_output_buf[int_output_index];
-                        int_output_index++;
-                    }
-                    pthread_mutex_unlock(&ioLock);
+    address->num_copies = 0;
+    for (int j = 0; j < address->num_regs; j++)
+    {
+        uint8_t *variable = (uint8_t *)imageVariable(block, address->target + j);
+        if (variable == NULL) continue;
 
-                    nanosleep(&ts, NULL); 
-                    int return_val = modbus_write_registers(mb_devices[i].mb_ctx, mb_devices[i].holding_registers.start_address,
-                                                            mb_devices[i].holding_registers.num_regs, tempBuff);
-                    if (return_val == -1)
-                    {
-                        if (mb_devices[i].protocol != MB_RTU)
-                        {
-                            modbus_close(mb_devices[i].mb_ctx);
-                            mb_devices[i].isConnected = false;
-                        }
-                        
-                        sprintf(log_msg, "Modbus Write Holding Registers failed on MB device %s: %s\n", mb_devices[i].dev_name, modbus_strerror(errno));
-                        log(log_msg);
-                        if (special_functions[2] != NULL) *special_functions[2]++;
-                    }
-                    
-                    free(tempBuff);
-                }
+        if (address->num_copies > 0)
+        {
+            struct MB_copy *last = &address->copies[address->num_copies - 1];
+            if (last->block_offset + last->count == j && (uint8_t *)last->variable + last->count * value_size == variable)
+            {
+                last->count++;
+                continue;
             }
         }
-        sleepms(polling_period);
+
+        struct MB_copy *copy = &address->copies[address->num_copies];
+        address->num_copies++;
+        copy->block_offset = j;
+        copy->count = 1;
+        copy->variable = variable;
     }
 }
 
 //-----------------------------------------------------------------------------
-// This function is called by the main OpenPLC routine when it is initializing.
-// Modbus master initialization procedures are here.
+// Compiles the copy plans of all blocks. The plans are compiled again from
+// the scan thread whenever variables are attached to the process image
 //-----------------------------------------------------------------------------
-void initializeMB()
+void planCopies()
 {
-	parseConfig();
-
-	for (int i = 0; i < num_devices; i++)
-	{
-		if (mb_devices[i].protocol == MB_TCP)
-		{
-			mb_devices[i].mb_ctx = modbus_new_tcp(mb_devices[i].dev_address, mb_devices[i].ip_port);
-		}
-		else if (mb_devices[i].protocol == MB_RTU)
-		{
-			mb_devices[i].mb_ctx = modbus_new_rtu(	mb_devices[i].dev_address, mb_devices[i].rtu_baud,
-													mb_devices[i].rtu_parity, mb_devices[i].rtu_data_bit,
-													mb_devices[i].rtu_stop_bit);
-		}
-        
+    for (int i = 0; i < num_devices; i++)
+    {
+        for (int block = 0; block < MB_NUM_BLOCKS; block++)
+            planBlockCopies(deviceBlock(i, block), block);
+    }
+
+    copy_plan_generation = io_map_generation;
+}
+
+//-----------------------------------------------------------------------------
+// Allocates the triple buffer and the copy plan of a block
+//-----------------------------------------------------------------------------
+void allocateBlockBuffer(struct MB_address *address, int value_size)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        address->data.buffers[i] = calloc(address->num_regs ? address->num_regs : 1, value_size);
+    }
+
+    address->copies = (struct MB_copy *)malloc((address->num_regs ? address->num_regs : 1) * sizeof(struct MB_copy));
+    address->num_copies = 0;
+
+    address->acked = NULL;
+    address->acked_valid = false;
+    if (address->write_mode == MB_WRITE_ON_CHANGE)
+        address->acked = calloc(address->num_regs ? address->num_regs : 1, value_size);
+    address->data.back = 0;
+    address->data.ready = 1;
+    address->data.front = 2;
+}
+
+//-----------------------------------------------------------------------------
+// Publishes the back buffer of a triple buffer, taking the ready one as the
+// next back buffer
+//-----------------------------------------------------------------------------
+void publishBuffer(struct MB_triple_buffer *tb)
+{
+    tb->back = tb->ready.exchange(tb->back | TB_FRESH) & 3;
+}
+
+//-----------------------------------------------------------------------------
+// Takes the latest published buffer of a triple buffer as the front buffer.
+// Returns false if nothing was published since the last call, in which case
+// the front buffer is unchanged
+//-----------------------------------------------------------------------------
+bool takeBuffer(struct MB_triple_buffer *tb)
+{
+    if (!(tb->ready.load() & TB_FRESH)) return false;
+
+    tb->front = tb->ready.exchange(tb->front) & 3;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the current time on CLOCK_MONOTONIC in nanoseconds
+//-----------------------------------------------------------------------------
+uint64_t monotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the task of a worker that polls the slave provided with the period
+// and offset provided, creating it if it doesn't exist
+//-----------------------------------------------------------------------------
+struct MB_poll_task *findPollTask(struct MB_worker *worker, int dev, uint32_t period, uint32_t offset)
+{
+    for (int i = 0; i < worker->num_tasks; i++)
+    {
+        struct MB_poll_task *task = &worker->tasks[i];
+        if (task->slave_id == mb_devices[dev].dev_id && task->period_ms == period && task->offset_ms == offset)
+            return task;
+    }
+
+    struct MB_poll_task *task = &worker->tasks[worker->num_tasks];
+    worker->num_tasks++;
+    task->device = dev;
+    for (int i = 0; i < worker->num_tasks - 1; i++)
+    {
+        if (mb_devices[worker->tasks[i].device].dev_id == mb_devices[dev].dev_id) task->device = worker->tasks[i].device;
+    }
+    task->slave_id = mb_devices[dev].dev_id;
+    task->period_ms = period;
+    task->offset_ms = offset;
+    task->period = (uint64_t)period * 1000000ULL;
+    task->next_poll = monotonicTime() + (uint64_t)offset * 1000000ULL;
+    task->num_blocks = 0;
+    task->blocks = (struct MB_block_ref *)malloc(worker->num_devices * MB_NUM_BLOCKS * sizeof(struct MB_block_ref));
+    task->num_requests = 0;
+    task->requests = NULL;
+
+    return task;
+}
+
+//Piece of a block that fits in a single request
+struct MB_piece
+{
+    int ref;
+    uint16_t block_offset;
+    uint16_t start;
+    uint16_t count;
+};
+
+//-----------------------------------------------------------------------------
+// Orders pieces by their first address
+//-----------------------------------------------------------------------------
+int comparePieces(const void *a, const void *b)
+{
+    const struct MB_piece *piece_a = (const struct MB_piece *)a;
+    const struct MB_piece *piece_b = (const struct MB_piece *)b;
+
+    if (piece_a->start != piece_b->start) return piece_a->start - piece_b->start;
+    return piece_a->ref - piece_b->ref;
+}
+
+//-----------------------------------------------------------------------------
+// Plans the requests for all blocks of a type in a task. Blocks larger than
+// the protocol limit are split, and ranges are merged into the same request
+// while the result fits in the limit. Reads are merged across gaps of up to
+// 'gap' unused addresses, while writes are only merged when they are
+// contiguous, since writing the gap would overwrite data on the slave
+//-----------------------------------------------------------------------------
+void planRequests(struct MB_poll_task *task, int block, uint8_t function, int limit, int gap, bool is_write)
+{
+    int num_pieces = 0;
+    for (int i = 0; i < task->num_blocks; i++)
+    {
+        if (task->blocks[i].block == block)
+            num_pieces += (deviceBlock(task->blocks[i].device, block)->num_regs + limit - 1) / limit;
+    }
+    if (num_pieces == 0) return;
+
+    struct MB_piece *pieces = (struct MB_piece *)malloc(num_pieces * sizeof(struct MB_piece));
+    num_pieces = 0;
+    for (int i = 0; i < task->num_blocks; i++)
+    {
+        if (task->blocks[i].block != block) continue;
+
+        struct MB_address *address = deviceBlock(task->blocks[i].device, block);
+        for (int offset = 0; offset < address->num_regs; offset += limit)
+        {
+            pieces[num_pieces].ref = i;
+            pieces[num_pieces].block_offset = offset;
+            pieces[num_pieces].start = address->start_address + offset;
+            pieces[num_pieces].count = (address->num_regs - offset < limit) ? address->num_regs - offset : limit;
+            num_pieces++;
+        }
+    }
+    qsort(pieces, num_pieces, sizeof(struct MB_piece), comparePieces);
+
+    struct MB_request *request = NULL;
+    int end = 0;
+    for (int i = 0; i < num_pieces; i++)
+    {
+        struct MB_piece *piece = &pieces[i];
+        int piece_end = piece->start + piece->count;
+        int new_end = (piece_end > end) ? piece_end : end;
+
+        bool fits = (request != NULL && new_end - request->read_start <= limit);
+        if (is_write) fits = fits && piece->start == end;
+        else fits = fits && piece->start <= end + gap;
+
+        if (!fits)
+        {
+            request = &task->requests[task->num_requests];
+            task->num_requests++;
+            memset(request, 0, sizeof(struct MB_request));
+            request->function = function;
+            request->read_start = piece->start;
+            request->read_segments = (struct MB_segment *)malloc(num_pieces * sizeof(struct MB_segment));
+            new_end = piece_end;
+        }
+
+        struct MB_segment *segment = &request->read_segments[request->num_read_segments];
+        request->num_read_segments++;
+        segment->ref = piece->ref;
+        segment->block_offset = piece->block_offset;
+        segment->request_offset = piece->start - request->read_start;
+        segment->count = piece->count;
+
+        end = new_end;
+        request->read_count = end - request->read_start;
+    }
+
+    //write requests keep their range on the write fields
+    if (is_write)
+    {
+        for (int i = 0; i < task->num_requests; i++)
+        {
+            struct MB_request *write = &task->requests[i];
+            if (write->function != function || write->num_write_segments != 0) continue;
+
+            write->write_start = write->read_start;
+            write->write_count = write->read_count;
+            write->num_write_segments = write->num_read_segments;
+            write->write_segments = write->read_segments;
+            write->read_start = 0;
+            write->read_count = 0;
+            write->num_read_segments = 0;
+            write->read_segments = NULL;
+
+            for (int s = 0; s < write->num_write_segments; s++)
+            {
+                struct MB_block_ref *ref = &task->blocks[write->write_segments[s].ref];
+                if (deviceBlock(ref->device, ref->block)->write_mode == MB_WRITE_ON_CHANGE) write->only_changes = true;
+            }
+            if (write->only_changes) write->changed = (uint8_t *)malloc(write->write_count);
+        }
+    }
+
+    free(pieces);
+}
+
+//-----------------------------------------------------------------------------
+// Combines holding register writes with holding register reads of the same
+// task into Read/Write Multiple Registers (FC23) requests. Writes that only
+// send changes are left alone, since they may turn into several requests
+//-----------------------------------------------------------------------------
+void combineFC23(struct MB_poll_task *task)
+{
+    for (int w = 0; w < task->num_requests; w++)
+    {
+        struct MB_request *write = &task->requests[w];
+        if (write->function != MODBUS_FC_WRITE_MULTIPLE_REGISTERS || write->write_count > MODBUS_MAX_WR_WRITE_REGISTERS ||
+            write->only_changes) continue;
+
+        for (int r = 0; r < task->num_requests; r++)
+        {
+            struct MB_request *read = &task->requests[r];
+            if (read->function != MODBUS_FC_READ_HOLDING_REGISTERS) continue;
+
+            read->function = MODBUS_FC_WRITE_AND_READ_REGISTERS;
+            read->write_start = write->write_start;
+            read->write_count = write->write_count;
+            read->num_write_segments = write->num_write_segments;
+            read->write_segments = write->write_segments;
+
+            //remove the write request, which is now part of the FC23
+            memmove(write, write + 1, (task->num_requests - w - 1) * sizeof(struct MB_request));
+            task->num_requests--;
+            w--;
+            break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Plans the requests of a task. Requests are issued in the same order the
+// blocks of a device were always polled: discrete inputs, coils, input
+// registers, holding registers read and holding registers written
+//-----------------------------------------------------------------------------
+void planPollTask(struct MB_poll_task *task)
+{
+    int max_requests = 0;
+    bool use_fc23 = false;
+    for (int i = 0; i < task->num_blocks; i++)
+    {
+        max_requests += deviceBlock(task->blocks[i].device, task->blocks[i].block)->num_regs / MODBUS_MAX_WRITE_REGISTERS + 1;
+        if (mb_devices[task->blocks[i].device].use_fc23) use_fc23 = true;
+    }
+    task->requests = (struct MB_request *)malloc(max_requests * sizeof(struct MB_request));
+    task->num_requests = 0;
+
+    planRequests(task, MB_BLOCK_DI, MODBUS_FC_READ_DISCRETE_INPUTS, MODBUS_MAX_READ_BITS, coalesce_gap, false);
+    planRequests(task, MB_BLOCK_COILS, MODBUS_FC_WRITE_MULTIPLE_COILS, MODBUS_MAX_WRITE_BITS, 0, true);
+    planRequests(task, MB_BLOCK_IR, MODBUS_FC_READ_INPUT_REGISTERS, MODBUS_MAX_READ_REGISTERS, coalesce_gap, false);
+    planRequests(task, MB_BLOCK_HR_READ, MODBUS_FC_READ_HOLDING_REGISTERS, MODBUS_MAX_READ_REGISTERS, coalesce_gap, false);
+    planRequests(task, MB_BLOCK_HR_WRITE, MODBUS_FC_WRITE_MULTIPLE_REGISTERS, MODBUS_MAX_WRITE_REGISTERS, 0, true);
+
+    if (use_fc23) combineFC23(task);
+}
+
+//-----------------------------------------------------------------------------
+// Creates the polling tasks of a worker. Blocks of the same slave with the
+// same period and offset are polled by the same task, so that their requests
+// can be planned together. A block without its own period or offset inherits
+// the device's, and a device without a period uses the global Polling_Period
+//-----------------------------------------------------------------------------
+void createPollTasks(struct MB_worker *worker)
+{
+    unsigned char log_msg[1000];
+    int num_blocks = 0;
+
+    worker->tasks = (struct MB_poll_task *)malloc(worker->num_devices * MB_NUM_BLOCKS * sizeof(struct MB_poll_task));
+    worker->num_tasks = 0;
+
+    for (int i = 0; i < worker->num_devices; i++)
+    {
+        int dev = worker->devices[i];
+        uint32_t device_period = mb_devices[dev].polling_period ? mb_devices[dev].polling_period : polling_period;
+        if (device_period == 0) device_period = 1;
+
+        for (int block = 0; block < MB_NUM_BLOCKS; block++)
+        {
+            struct MB_address *address = deviceBlock(dev, block);
+            if (address->num_regs == 0) continue;
+
+            uint32_t period = address->period ? address->period : device_period;
+            uint32_t offset = address->offset ? address->offset : mb_devices[dev].polling_offset;
+
+            struct MB_poll_task *task = findPollTask(worker, dev, period, offset);
+            mb_devices[dev].link = task->device;
+            task->blocks[task->num_blocks].device = dev;
+            task->blocks[task->num_blocks].block = block;
+            task->blocks[task->num_blocks].failed = false;
+            task->num_blocks++;
+            num_blocks++;
+        }
+    }
+
+    int num_requests = 0;
+    for (int i = 0; i < worker->num_tasks; i++)
+    {
+        struct MB_poll_task *task = &worker->tasks[i];
+        planPollTask(task);
+        num_requests += task->num_requests;
+
+        //outputs written on change may take one transaction for each value
+        int max_transactions = 0;
+        for (int r = 0; r < task->num_requests; r++)
+            max_transactions += task->requests[r].only_changes ? task->requests[r].write_count : 1;
+        if (max_transactions > worker->max_transactions) worker->max_transactions = max_transactions;
+    }
+
+    bool pipelined = false;
+    for (int i = 0; i < worker->num_devices; i++)
+    {
+        if (mb_devices[worker->devices[i]].pipeline != NULL) pipelined = true;
+    }
+
+    if (pipelined)
+    {
+        worker->transactions = (struct MB_transaction *)malloc(worker->max_transactions * sizeof(struct MB_transaction));
+        worker->transaction_requests = (int *)malloc(worker->max_transactions * sizeof(int));
+    }
+
+    sprintf(log_msg, "Modbus Master: %s polls %d blocks with %d requests\n", worker->port, num_blocks, num_requests);
+    log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Groups the devices into polling workers: one for each TCP endpoint and one
+// for each serial port with RTU devices. Devices that share a worker have
+// their requests planned together
+//-----------------------------------------------------------------------------
+void createWorkers()
+{
+    mb_workers = (struct MB_worker *)calloc(num_devices, sizeof(struct MB_worker));
+    num_workers = 0;
+
+    for (int i = 0; i < num_devices; i++)
+    {
+        struct MB_worker *worker = NULL;
+
+        for (int j = 0; j < num_workers; j++)
+        {
+            if (mb_workers[j].protocol == mb_devices[i].protocol && !strcmp(mb_workers[j].port, mb_devices[i].dev_address) &&
+                (mb_devices[i].protocol == MB_RTU || mb_workers[j].ip_port == mb_devices[i].ip_port))
+                worker = &mb_workers[j];
+        }
+
+        if (worker == NULL)
+        {
+            worker = &mb_workers[num_workers];
+            num_workers++;
+            strncpy(worker->port, mb_devices[i].dev_address, sizeof(worker->port));
+            worker->protocol = mb_devices[i].protocol;
+            worker->ip_port = mb_devices[i].ip_port;
+            worker->num_devices = 0;
+            worker->devices = (int *)malloc(num_devices * sizeof(int));
+        }
+
+        worker->devices[worker->num_devices] = i;
+        worker->num_devices++;
+    }
+
+    for (int w = 0; w < num_workers; w++)
+    {
+        createPollTasks(&mb_workers[w]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the RTU bus of a serial port, creating it if it doesn't exist. All
+// devices on a port share the bus' context, so the port is opened once and
+// the serial settings of the first device on the port are used for all
+//-----------------------------------------------------------------------------
+struct MB_rtu_bus *getBus(int dev)
+{
+    unsigned char log_msg[1000];
+    struct MB_device *device = &mb_devices[dev];
+
+    for (int i = 0; i < num_buses; i++)
+    {
+        struct MB_rtu_bus *bus = &mb_buses[i];
+        if (strcmp(bus->port, device->dev_address)) continue;
+
+        if (bus->baud != device->rtu_baud || bus->parity != device->rtu_parity ||
+            bus->data_bits != device->rtu_data_bit || bus->stop_bits != device->rtu_stop_bit)
+        {
+            sprintf(log_msg, "Modbus Master: MB device %s uses different serial settings than other devices on %s. Using %d,%c,%d,%d\n",
+                    device->dev_name, bus->port, bus->baud, bus->parity, bus->data_bits, bus->stop_bits);
+            log(log_msg);
+        }
+        return bus;
+    }
+
+    struct MB_rtu_bus *bus = &mb_buses[num_buses];
+    num_buses++;
+    strncpy(bus->port, device->dev_address, sizeof(bus->port));
+    bus->baud = device->rtu_baud;
+    bus->parity = device->rtu_parity;
+    bus->data_bits = device->rtu_data_bit;
+    bus->stop_bits = device->rtu_stop_bit;
+    bus->ctx = NULL;
+    bus->open = false;
+    bus->idle_at = 0;
+
+    //after a reload, a port with the same settings stays open
+    for (int i = 0; i < num_retired_buses; i++)
+    {
+        struct MB_rtu_bus *old = &retired_buses[i];
+        if (old->ctx == NULL || strcmp(old->port, bus->port) || old->baud != bus->baud || old->parity != bus->parity ||
+            old->data_bits != bus->data_bits || old->stop_bits != bus->stop_bits)
+            continue;
+
+        bus->ctx = old->ctx;
+        bus->open = old->open;
+        bus->idle_at = old->idle_at;
+        old->ctx = NULL;
+        break;
+    }
+
+    if (bus->ctx == NULL) bus->ctx = modbus_new_rtu(bus->port, bus->baud, bus->parity, bus->data_bits, bus->stop_bits);
+    bus->frame_gap = (uint64_t)rtuInterFrameDelay(bus->baud, bus->parity, bus->data_bits, bus->stop_bits) * 1000ULL;
+    bus->turnaround = (uint64_t)rtu_turnaround * 1000000ULL;
+
+    sprintf(log_msg, "Modbus Master: RTU bus on %s with t3.5 = %lluus\n", bus->port, (unsigned long long)(bus->frame_gap / 1000));
+    log(log_msg);
+
+    return bus;
+}
+
+//-----------------------------------------------------------------------------
+// Waits until the RTU bus of a device has been silent for long enough to
+// send the next frame, and addresses the bus' context to the device. Does
+// nothing for TCP devices
+//-----------------------------------------------------------------------------
+void acquireBus(int dev)
+{
+    struct MB_rtu_bus *bus = mb_devices[dev].bus;
+    if (bus == NULL) return;
+
+    if (monotonicTime() < bus->idle_at)
+    {
+        struct timespec ts;
+        ts.tv_sec = bus->idle_at / 1000000000ULL;
+        ts.tv_nsec = bus->idle_at % 1000000000ULL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+
+    modbus_set_slave(bus->ctx, mb_devices[dev].dev_id);
+}
+
+//-----------------------------------------------------------------------------
+// Marks the end of a transaction on the RTU bus of a device. The next frame
+// may go out after a t3.5 silence, or after the turnaround delay if the
+// request was a broadcast, which slaves execute without answering
+//-----------------------------------------------------------------------------
+void releaseBus(int dev)
+{
+    struct MB_rtu_bus *bus = mb_devices[dev].bus;
+    if (bus == NULL) return;
+
+    bus->idle_at = monotonicTime() + ((mb_devices[dev].dev_id == 0) ? bus->turnaround : bus->frame_gap);
+}
+
+//-----------------------------------------------------------------------------
+// Records the outcome of one transaction with a device. Only transactions
+// that got a valid response count for the latency histogram
+//-----------------------------------------------------------------------------
+void recordTransaction(int dev, bool succeeded, uint64_t latency)
+{
+    struct MB_device *device = &mb_devices[dev];
+
+    if (!succeeded)
+    {
+        device->failed_transactions++;
+        return;
+    }
+
+    device->transactions++;
+    device->last_latency = (uint32_t)latency;
+    histogramRecord(device->latency, latency);
+}
+
+//-----------------------------------------------------------------------------
+// Marks a device as disconnected after a failed request. RTU devices are never
+// disconnected, since the serial port is still open
+//-----------------------------------------------------------------------------
+void requestFailed(int dev)
+{
+    if (mb_devices[dev].pipeline != NULL)
+    {
+        pipelineClose(mb_devices[dev].pipeline);
+        mb_devices[dev].isConnected = false;
+        mb_devices[dev].link_state = MB_LINK_BACKOFF;
+    }
+    else if (mb_devices[dev].protocol != MB_RTU)
+    {
+        modbus_close(mb_devices[dev].mb_ctx);
+        mb_devices[dev].isConnected = false;
+        mb_devices[dev].link_state = MB_LINK_BACKOFF;
+    }
+
+    comm_errors++;
+}
+
+//-----------------------------------------------------------------------------
+// Records a poll or connection attempt in which nothing got through to a
+// device. After Breaker_Threshold failures in a row the device's circuit
+// breaker opens: the device isn't polled or connected again until its
+// backoff expires, so a dead slave doesn't hold up the ones that share its
+// worker. The backoff doubles on every failure, between Reconnect_Min and
+// Reconnect_Max, and is randomized to half its length or more so that
+// devices that failed together don't retry together
+//-----------------------------------------------------------------------------
+void deviceFailed(int dev)
+{
+    unsigned char log_msg[1000];
+    struct MB_device *device = &mb_devices[dev];
+    uint32_t failures = ++device->consecutive_failures;
+
+    if (failures < breaker_threshold)
+    {
+        device->next_attempt = monotonicTime();
+        return;
+    }
+
+    uint64_t backoff = reconnect_min;
+    for (uint32_t i = breaker_threshold; i < failures && backoff < reconnect_max; i++) backoff *= 2;
+    if (backoff > reconnect_max) backoff = reconnect_max;
+    backoff = backoff / 2 + rand_r(&device->jitter_seed) % (backoff / 2 + 1);
+
+    device->next_attempt = monotonicTime() + backoff * 1000000ULL;
+    device->link_state = MB_LINK_BACKOFF;
+
+    //a slave behind a gateway may stop answering while the connection stays up
+    if (device->protocol == MB_TCP && device->isConnected)
+    {
+        if (device->pipeline != NULL) pipelineClose(device->pipeline);
+        else modbus_close(device->mb_ctx);
+        device->isConnected = false;
+    }
+
+    if (failures == breaker_threshold)
+    {
+        device->breaker_trips++;
+        sprintf(log_msg, "MB device %s is not responding. Backing off...\n", device->dev_name);
+        log(log_msg);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Advances the connection of a device without blocking. A disconnected TCP
+// device starts a non-blocking connect once its backoff expires, and the
+// connect is checked again on every poll of the device until it completes
+// or the Timeout runs out. Returns true if the device can be polled now
+//-----------------------------------------------------------------------------
+bool connectDevice(int i)
+{
+    unsigned char log_msg[1000];
+    struct MB_device *device = &mb_devices[i];
+
+    if (device->link_state == MB_LINK_ONLINE) return true;
+
+    uint64_t now = monotonicTime();
+    if (device->link_state == MB_LINK_BACKOFF)
+    {
+        if (now < device->next_attempt) return false;
+
+        //the serial port of an RTU bus is opened only once
+        if (device->protocol == MB_RTU)
+        {
+            if (!device->bus->open && modbus_connect(device->mb_ctx) == -1)
+            {
+                sprintf(log_msg, "Connection failed on MB device %s: %s\n", device->dev_name, modbus_strerror(errno));
+                log(log_msg);
+                deviceFailed(i);
+                return false;
+            }
+            device->bus->open = true;
+            device->isConnected = true;
+            device->link_state = MB_LINK_ONLINE;
+            return true;
+        }
+
+        sprintf(log_msg, "Device %s is disconnected. Attempting to reconnect...\n", device->dev_name);
+        log(log_msg);
+
+        device->connect_fd = startConnect(device->dev_address, device->ip_port);
+        if (device->connect_fd < 0)
+        {
+            sprintf(log_msg, "Connection failed on MB device %s: %s\n", device->dev_name, modbus_strerror(errno));
+            log(log_msg);
+            comm_errors++;
+            deviceFailed(i);
+            return false;
+        }
+        device->connect_deadline = now + (uint64_t)timeout * 1000000ULL;
+        device->link_state = MB_LINK_CONNECTING;
+    }
+
+    int ret = finishConnect(device->connect_fd);
+    if (ret == 0 && now < device->connect_deadline) return false;
+    if (ret <= 0)
+    {
+        if (ret == 0) errno = ETIMEDOUT;
+        sprintf(log_msg, "Connection failed on MB device %s: %s\n", device->dev_name, modbus_strerror(errno));
+        log(log_msg);
+
+        //below Breaker_Threshold deviceFailed() keeps next_attempt at now, so
+        //the connect is started again on the next poll of the device
+        close(device->connect_fd);
+        device->connect_fd = -1;
+        device->link_state = MB_LINK_BACKOFF;
+        comm_errors++;
+        deviceFailed(i);
+        return false;
+    }
+
+    if (device->pipeline != NULL) pipelineSetSocket(device->pipeline, device->connect_fd);
+    else modbus_set_socket(device->mb_ctx, device->connect_fd);
+    device->connect_fd = -1;
+
+    sprintf(log_msg, "Connected to MB device %s\n", device->dev_name);
+    log(log_msg);
+    device->isConnected = true;
+    device->link_state = MB_LINK_ONLINE;
+    device->connects++;
+
+    //the slave may have restarted, so outputs written on change are sent in full
+    device->coils.acked_valid = false;
+    device->holding_registers.acked_valid = false;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Returns where the values read by a request go: straight into the back
+// buffer of its block when the request covers a single block, or the
+// worker's scratch buffers otherwise
+//-----------------------------------------------------------------------------
+uint8_t *readDestination(struct MB_worker *worker, struct MB_poll_task *task, struct MB_request *request, bool is_bits, bool *direct)
+{
+    struct MB_segment *segment = &request->read_segments[0];
+    struct MB_block_ref *ref = &task->blocks[segment->ref];
+    struct MB_triple_buffer *tb = &deviceBlock(ref->device, ref->block)->data;
+    int value_size = is_bits ? sizeof(uint8_t) : sizeof(uint16_t);
+
+    *direct = (request->num_read_segments == 1 && segment->count == request->read_count);
+    if (*direct) return (uint8_t *)tb->buffers[tb->back] + segment->block_offset * value_size;
+
+    return is_bits ? worker->bits : (uint8_t *)worker->read_registers;
+}
+
+//-----------------------------------------------------------------------------
+// Copies the values read by a request from the scratch buffers to the back
+// buffers of its blocks
+//-----------------------------------------------------------------------------
+void scatterRead(struct MB_poll_task *task, struct MB_request *request, uint8_t *values, bool is_bits)
+{
+    int value_size = is_bits ? sizeof(uint8_t) : sizeof(uint16_t);
+
+    for (int s = 0; s < request->num_read_segments; s++)
+    {
+        struct MB_segment *segment = &request->read_segments[s];
+        struct MB_block_ref *ref = &task->blocks[segment->ref];
+        struct MB_triple_buffer *tb = &deviceBlock(ref->device, ref->block)->data;
+        memcpy((uint8_t *)tb->buffers[tb->back] + segment->block_offset * value_size,
+               values + segment->request_offset * value_size, segment->count * value_size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the values written by a request: the front buffer of its block when
+// the request covers a single block, or the worker's scratch buffers with the
+// values of all its blocks otherwise
+//-----------------------------------------------------------------------------
+uint8_t *writeSource(struct MB_worker *worker, struct MB_poll_task *task, struct MB_request *request, bool is_bits, bool gather)
+{
+    int value_size = is_bits ? sizeof(uint8_t) : sizeof(uint16_t);
+    struct MB_segment *segment = &request->write_segments[0];
+    struct MB_block_ref *ref = &task->blocks[segment->ref];
+    struct MB_triple_buffer *tb = &deviceBlock(ref->device, ref->block)->data;
+
+    if (request->num_write_segments == 1 && !gather)
+        return (uint8_t *)tb->buffers[tb->front] + segment->block_offset * value_size;
+
+    uint8_t *values = is_bits ? worker->bits : (uint8_t *)worker->write_registers;
+    for (int s = 0; s < request->num_write_segments; s++)
+    {
+        segment = &request->write_segments[s];
+        ref = &task->blocks[segment->ref];
+        tb = &deviceBlock(ref->device, ref->block)->data;
+        memcpy(values + segment->request_offset * value_size,
+               (uint8_t *)tb->buffers[tb->front] + segment->block_offset * value_size, segment->count * value_size);
+    }
+
+    return values;
+}
+
+//-----------------------------------------------------------------------------
+// Marks the outputs of a request that changed since the slave last
+// acknowledged them. Blocks written always, blocks not yet acknowledged and
+// blocks due for their refresh are marked in full, as decided by pollTask()
+// for the whole block before its first request
+//-----------------------------------------------------------------------------
+void markChanges(struct MB_poll_task *task, struct MB_request *request, bool is_bits)
+{
+    int value_size = is_bits ? sizeof(uint8_t) : sizeof(uint16_t);
+
+    for (int s = 0; s < request->num_write_segments; s++)
+    {
+        struct MB_segment *segment = &request->write_segments[s];
+        struct MB_address *address = deviceBlock(task->blocks[segment->ref].device, task->blocks[segment->ref].block);
+        uint8_t *front = (uint8_t *)address->data.buffers[address->data.front] + segment->block_offset * value_size;
+
+        for (int i = 0; i < segment->count; i++)
+        {
+            int n = segment->block_offset + i;
+            bool changed;
+            if (address->write_all) changed = true;
+            else if (is_bits) changed = (front[i] != ((uint8_t *)address->acked)[n]);
+            else changed = (abs((int)((uint16_t *)front)[i] - (int)((uint16_t *)address->acked)[n]) > address->deadband);
+
+            request->changed[segment->request_offset + i] = changed;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Records the outputs of a request marked as changed as acknowledged by the
+// slave, once all of them were written. The block itself only counts as
+// acknowledged once all its requests succeeded, see pollTask()
+//-----------------------------------------------------------------------------
+void acknowledgeChanges(struct MB_poll_task *task, struct MB_request *request, bool is_bits)
+{
+    int value_size = is_bits ? sizeof(uint8_t) : sizeof(uint16_t);
+
+    for (int s = 0; s < request->num_write_segments; s++)
+    {
+        struct MB_segment *segment = &request->write_segments[s];
+        struct MB_address *address = deviceBlock(task->blocks[segment->ref].device, task->blocks[segment->ref].block);
+        if (address->acked == NULL) continue;
+
+        uint8_t *front = (uint8_t *)address->data.buffers[address->data.front] + segment->block_offset * value_size;
+        for (int i = 0; i < segment->count; i++)
+        {
+            if (request->changed[segment->request_offset + i])
+                memcpy((uint8_t *)address->acked + (segment->block_offset + i) * value_size, front + i * value_size, value_size);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Returns the length of the run of changed outputs starting at the position
+// provided, or 0 if the output there didn't change
+//-----------------------------------------------------------------------------
+int changedRun(struct MB_request *request, int start)
+{
+    int end = start;
+    while (end < request->write_count && request->changed[end]) end++;
+    return end - start;
+}
+
+//-----------------------------------------------------------------------------
+// Writes only the outputs of a request that changed since the slave last
+// acknowledged them. Changed values are grouped in contiguous runs: a run of
+// a single value goes out as Write Single Coil/Register (FC5/FC6) and longer
+// runs as Write Multiple Coils/Registers (FC15/FC16). Returns false if a
+// write failed
+//-----------------------------------------------------------------------------
+bool writeChanges(struct MB_worker *worker, struct MB_poll_task *task, struct MB_request *request, bool is_bits)
+{
+    unsigned char log_msg[1000];
+    int dev = task->device;
+
+    markChanges(task, request, is_bits);
+    uint8_t *values = writeSource(worker, task, request, is_bits, true);
+
+    modbus_t *ctx = mb_devices[dev].mb_ctx;
+    int i = 0;
+    while (i < request->write_count)
+    {
+        int run_count = changedRun(request, i);
+        if (run_count == 0)
+        {
+            i++;
+            continue;
+        }
+
+        int start_address = request->write_start + i;
+        acquireBus(dev);
+        uint64_t sent = monotonicTime();
+        int return_val;
+        const char *request_name;
+        if (is_bits && run_count == 1)
+        {
+            request_name = "Write Single Coil";
+            return_val = modbus_write_bit(ctx, start_address, values[i]);
+        }
+        else if (is_bits)
+        {
+            request_name = "Write Coils";
+            return_val = modbus_write_bits(ctx, start_address, run_count, &values[i]);
+        }
+        else if (run_count == 1)
+        {
+            request_name = "Write Single Register";
+            return_val = modbus_write_register(ctx, start_address, ((uint16_t *)values)[i]);
+        }
+        else
+        {
+            request_name = "Write Holding Registers";
+            return_val = modbus_write_registers(ctx, start_address, run_count, &((uint16_t *)values)[i]);
+        }
+        recordTransaction(dev, return_val != -1, (monotonicTime() - sent) / 1000);
+        releaseBus(dev);
+
+        if (return_val == -1)
+        {
+            requestFailed(dev);
+            sprintf(log_msg, "Modbus %s failed on MB device %s: %s\n", request_name, mb_devices[dev].dev_name, modbus_strerror(errno));
+            log(log_msg);
+            return false;
+        }
+
+        i += run_count;
+    }
+
+    acknowledgeChanges(task, request, is_bits);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the name of a function code for the log
+//-----------------------------------------------------------------------------
+const char *requestName(uint8_t function)
+{
+    switch (function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS: return "Read Discrete Input Registers";
+        case MODBUS_FC_READ_INPUT_REGISTERS: return "Read Input Registers";
+        case MODBUS_FC_READ_HOLDING_REGISTERS: return "Read Holding Registers";
+        case MODBUS_FC_WRITE_SINGLE_COIL: return "Write Single Coil";
+        case MODBUS_FC_WRITE_SINGLE_REGISTER: return "Write Single Register";
+        case MODBUS_FC_WRITE_MULTIPLE_COILS: return "Write Coils";
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS: return "Write Holding Registers";
+        case MODBUS_FC_WRITE_AND_READ_REGISTERS: return "Read/Write Holding Registers";
+        default: return "Request";
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Encodes the PDU of a request for the pipelined transport. Coils are
+// written from one byte per value and registers from native 16-bit values.
+// Returns the size of the PDU
+//-----------------------------------------------------------------------------
+int encodeRequest(uint8_t *pdu, uint8_t function, uint16_t read_start, uint16_t read_count,
+                  uint16_t write_start, uint16_t write_count, uint8_t *values)
+{
+    int size = 0;
+    pdu[size++] = function;
+
+    switch (function)
+    {
+        case MODBUS_FC_READ_DISCRETE_INPUTS:
+        case MODBUS_FC_READ_INPUT_REGISTERS:
+        case MODBUS_FC_READ_HOLDING_REGISTERS:
+            pdu[size++] = read_start >> 8;
+            pdu[size++] = read_start & 0xFF;
+            pdu[size++] = read_count >> 8;
+            pdu[size++] = read_count & 0xFF;
+            break;
+
+        case MODBUS_FC_WRITE_SINGLE_COIL:
+            pdu[size++] = write_start >> 8;
+            pdu[size++] = write_start & 0xFF;
+            pdu[size++] = values[0] ? 0xFF : 0x00;
+            pdu[size++] = 0x00;
+            break;
+
+        case MODBUS_FC_WRITE_SINGLE_REGISTER:
+            pdu[size++] = write_start >> 8;
+            pdu[size++] = write_start & 0xFF;
+            pdu[size++] = ((uint16_t *)values)[0] >> 8;
+            pdu[size++] = ((uint16_t *)values)[0] & 0xFF;
+            break;
+
+        case MODBUS_FC_WRITE_MULTIPLE_COILS:
+            pdu[size++] = write_start >> 8;
+            pdu[size++] = write_start & 0xFF;
+            pdu[size++] = write_count >> 8;
+            pdu[size++] = write_count & 0xFF;
+            pdu[size++] = (write_count + 7) / 8;
+            memset(&pdu[size], 0, (write_count + 7) / 8);
+            for (int i = 0; i < write_count; i++)
+            {
+                if (values[i]) pdu[size + i / 8] |= (1 << (i % 8));
+            }
+            size += (write_count + 7) / 8;
+            break;
+
+        case MODBUS_FC_WRITE_AND_READ_REGISTERS:
+        case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+            if (function == MODBUS_FC_WRITE_AND_READ_REGISTERS)
+            {
+                pdu[size++] = read_start >> 8;
+                pdu[size++] = read_start & 0xFF;
+                pdu[size++] = read_count >> 8;
+                pdu[size++] = read_count & 0xFF;
+            }
+            pdu[size++] = write_start >> 8;
+            pdu[size++] = write_start & 0xFF;
+            pdu[size++] = write_count >> 8;
+            pdu[size++] = write_count & 0xFF;
+            pdu[size++] = write_count * 2;
+            for (int i = 0; i < write_count; i++)
+            {
+                pdu[size++] = ((uint16_t *)values)[i] >> 8;
+                pdu[size++] = ((uint16_t *)values)[i] & 0xFF;
+            }
+            break;
+    }
+
+    return size;
+}
+
+//-----------------------------------------------------------------------------
+// Decodes the values of a read response received by the pipelined transport.
+// Returns false if the response doesn't carry the number of values requested
+//-----------------------------------------------------------------------------
+bool decodeResponse(struct MB_transaction *transaction, uint16_t count, bool is_bits, uint8_t *values)
+{
+    uint8_t *pdu = transaction->response;
+    int byte_count = is_bits ? (count + 7) / 8 : count * 2;
+
+    if (transaction->response_size != 2 + byte_count || pdu[1] != byte_count) return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (is_bits) values[i] = (pdu[2 + i / 8] >> (i % 8)) & 1;
+        else ((uint16_t *)values)[i] = (pdu[2 + 2 * i] << 8) | pdu[3 + 2 * i];
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Poll all the requests of a task through the pipelined transport. All
+// requests are encoded up front, sent with up to Pipeline_Depth of them in
+// flight, and decoded once the batch completes. Outputs written on change
+// become one transaction for each run of changed values
+//-----------------------------------------------------------------------------
+void pollPipelined(struct MB_worker *worker, struct MB_poll_task *task)
+{
+    unsigned char log_msg[1000];
+    int dev = task->device;
+    int count = 0;
+
+    for (int r = 0; r < task->num_requests; r++)
+    {
+        struct MB_request *request = &task->requests[r];
+        bool is_bits = (request->function == MODBUS_FC_READ_DISCRETE_INPUTS || request->function == MODBUS_FC_WRITE_MULTIPLE_COILS);
+        uint8_t *values = NULL;
+        if (request->num_write_segments > 0) values = writeSource(worker, task, request, is_bits, false);
+
+        if (!request->only_changes)
+        {
+            struct MB_transaction *transaction = &worker->transactions[count];
+            worker->transaction_requests[count] = r;
+            count++;
+
+            transaction->unit_id = mb_devices[dev].dev_id;
+            transaction->request_size = encodeRequest(transaction->request, request->function, request->read_start, request->read_count,
+                                                      request->write_start, request->write_count, values);
+            continue;
+        }
+
+        markChanges(task, request, is_bits);
+        int i = 0;
+        while (i < request->write_count)
+        {
+            int run_count = changedRun(request, i);
+            if (run_count == 0)
+            {
+                i++;
+                continue;
+            }
+
+            uint8_t function;
+            if (is_bits) function = (run_count == 1) ? MODBUS_FC_WRITE_SINGLE_COIL : MODBUS_FC_WRITE_MULTIPLE_COILS;
+            else function = (run_count == 1) ? MODBUS_FC_WRITE_SINGLE_REGISTER : MODBUS_FC_WRITE_MULTIPLE_REGISTERS;
+
+            struct MB_transaction *transaction = &worker->transactions[count];
+            worker->transaction_requests[count] = r;
+            count++;
+
+            transaction->unit_id = mb_devices[dev].dev_id;
+            transaction->request_size = encodeRequest(transaction->request, function, 0, 0, request->write_start + i, run_count,
+                                                      values + i * (is_bits ? sizeof(uint8_t) : sizeof(uint16_t)));
+            i += run_count;
+        }
+    }
+
+    bool connected = pipelineExecute(mb_devices[dev].pipeline, worker->transactions, count);
+
+    //a request fails if any of its transactions failed
+    int t = 0;
+    for (int r = 0; r < task->num_requests; r++)
+    {
+        struct MB_request *request = &task->requests[r];
+        bool is_bits = (request->function == MODBUS_FC_READ_DISCRETE_INPUTS || request->function == MODBUS_FC_WRITE_MULTIPLE_COILS);
+        bool failed = false;
+
+        for (; t < count && worker->transaction_requests[t] == r; t++)
+        {
+            struct MB_transaction *transaction = &worker->transactions[t];
+            if (transaction->status == MB_TX_OK || transaction->status == MB_TX_EXCEPTION)
+                recordTransaction(dev, transaction->status == MB_TX_OK, transaction->latency);
+            else if (connected)
+                recordTransaction(dev, false, 0);
+
+            if (transaction->status == MB_TX_OK && request->num_read_segments > 0)
+            {
+                bool direct;
+                uint8_t *values = readDestination(worker, task, request, is_bits, &direct);
+                if (!decodeResponse(transaction, request->read_count, is_bits, values)) transaction->status = MB_TX_ERROR;
+                else if (!direct) scatterRead(task, request, values, is_bits);
+            }
+
+            if (transaction->status != MB_TX_OK)
+            {
+                if (!failed && connected)
+                {
+                    const char *reason = "invalid response";
+                    if (transaction->status == MB_TX_TIMEOUT) reason = "timed out";
+                    else if (transaction->status == MB_TX_EXCEPTION) reason = modbus_strerror(MODBUS_ENOBASE + transaction->response[1]);
+
+                    sprintf(log_msg, "Modbus %s failed on MB device %s: %s\n", requestName(transaction->request[0]), mb_devices[dev].dev_name, reason);
+                    log(log_msg);
+                }
+                failed = true;
+            }
+        }
+
+        if (failed)
+        {
+            comm_errors++;
+            for (int s = 0; s < request->num_read_segments; s++) task->blocks[request->read_segments[s].ref].failed = true;
+            for (int s = 0; s < request->num_write_segments; s++) task->blocks[request->write_segments[s].ref].failed = true;
+        }
+        else if (request->only_changes)
+        {
+            acknowledgeChanges(task, request, is_bits);
+        }
+    }
+
+    if (!connected)
+    {
+        sprintf(log_msg, "Connection lost on MB device %s: %s\n", mb_devices[dev].dev_name, modbus_strerror(errno));
+        log(log_msg);
+        requestFailed(dev);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Poll all the requests of a task. Inputs are decoded straight into the back
+// buffer of their block when a request covers a single block, or scattered
+// from the worker's scratch buffers otherwise. Input blocks are published to
+// the scan thread only if all their requests succeeded. Outputs are written
+// from the latest buffer published by the scan thread, in full or only the
+// values that changed, depending on the block's write mode
+//-----------------------------------------------------------------------------
+void pollTask(struct MB_worker *worker, struct MB_poll_task *task)
+{
+    unsigned char log_msg[1000];
+    int dev = task->device;
+
+    if (!connectDevice(dev)) return;
+
+    //a block written on change is written in full, or acknowledged, across
+    //all its requests at once, since blocks too large for one request are
+    //split in several
+    uint64_t now = monotonicTime();
+    for (int i = 0; i < task->num_blocks; i++)
+    {
+        struct MB_block_ref *ref = &task->blocks[i];
+        ref->failed = false;
+        if (ref->block == MB_BLOCK_COILS || ref->block == MB_BLOCK_HR_WRITE)
+        {
+            struct MB_address *address = deviceBlock(ref->device, ref->block);
+            takeBuffer(&address->data);
+            address->write_all = (address->acked == NULL || !address->acked_valid || (address->refresh && now >= address->next_refresh));
+        }
+    }
+
+    if (mb_devices[dev].pipeline != NULL)
+    {
+        pollPipelined(worker, task);
+    }
+    else for (int r = 0; r < task->num_requests; r++)
+    {
+        struct MB_request *request = &task->requests[r];
+        bool is_bits = (request->function == MODBUS_FC_READ_DISCRETE_INPUTS || request->function == MODBUS_FC_WRITE_MULTIPLE_COILS);
+
+        //a TCP device that dropped its connection is retried on the next poll
+        if (!mb_devices[dev].isConnected)
+        {
+            for (int i = 0; i < task->num_blocks; i++) task->blocks[i].failed = true;
+            break;
+        }
+
+        if (request->only_changes)
+        {
+            if (!writeChanges(worker, task, request, is_bits))
+            {
+                for (int s = 0; s < request->num_write_segments; s++) task->blocks[request->write_segments[s].ref].failed = true;
+            }
+            continue;
+        }
+
+        //where the read values go and where the written values come from
+        uint8_t *read_values = NULL;
+        uint8_t *write_values = NULL;
+        bool direct_read = false;
+        if (request->num_read_segments > 0) read_values = readDestination(worker, task, request, is_bits, &direct_read);
+        if (request->num_write_segments > 0) write_values = writeSource(worker, task, request, is_bits, false);
+
+        acquireBus(dev);
+        modbus_t *ctx = mb_devices[dev].mb_ctx;
+        uint64_t sent = monotonicTime();
+        int return_val = -1;
+
+        switch (request->function)
+        {
+            case MODBUS_FC_READ_DISCRETE_INPUTS:
+                return_val = modbus_read_input_bits(ctx, request->read_start, request->read_count, read_values);
+                break;
+            case MODBUS_FC_WRITE_MULTIPLE_COILS:
+                return_val = modbus_write_bits(ctx, request->write_start, request->write_count, write_values);
+                break;
+            case MODBUS_FC_READ_INPUT_REGISTERS:
+                return_val = modbus_read_input_registers(ctx, request->read_start, request->read_count, (uint16_t *)read_values);
+                break;
+            case MODBUS_FC_READ_HOLDING_REGISTERS:
+                return_val = modbus_read_registers(ctx, request->read_start, request->read_count, (uint16_t *)read_values);
+                break;
+            case MODBUS_FC_WRITE_MULTIPLE_REGISTERS:
+                return_val = modbus_write_registers(ctx, request->write_start, request->write_count, (uint16_t *)write_values);
+                break;
+            case MODBUS_FC_WRITE_AND_READ_REGISTERS:
+                return_val = modbus_write_and_read_registers(ctx, request->write_start, request->write_count, (uint16_t *)write_values,
+                                                             request->read_start, request->read_count, (uint16_t *)read_values);
+                break;
+        }
+        recordTransaction(dev, return_val != -1, (monotonicTime() - sent) / 1000);
+        releaseBus(dev);
+
+        if (return_val == -1)
+        {
+            requestFailed(dev);
+            sprintf(log_msg, "Modbus %s failed on MB device %s: %s\n", requestName(request->function), mb_devices[dev].dev_name, modbus_strerror(errno));
+            log(log_msg);
+
+            for (int s = 0; s < request->num_read_segments; s++) task->blocks[request->read_segments[s].ref].failed = true;
+            for (int s = 0; s < request->num_write_segments; s++) task->blocks[request->write_segments[s].ref].failed = true;
+        }
+        else if (request->num_read_segments > 0 && !direct_read)
+        {
+            scatterRead(task, request, read_values, is_bits);
+        }
+    }
+
+    bool any_succeeded = false;
+    now = monotonicTime();
+    for (int i = 0; i < task->num_blocks; i++)
+    {
+        struct MB_block_ref *ref = &task->blocks[i];
+        struct MB_address *address = deviceBlock(ref->device, ref->block);
+        if (!ref->failed) any_succeeded = true;
+        if (!ref->failed && address->acked != NULL && address->write_all)
+        {
+            address->acked_valid = true;
+            address->next_refresh = now + (uint64_t)address->refresh * 1000000ULL;
+        }
+        if (!ref->failed && (ref->block == MB_BLOCK_DI || ref->block == MB_BLOCK_IR || ref->block == MB_BLOCK_HR_READ))
+        {
+            publishBuffer(&address->data);
+            mb_devices[ref->device].last_read = now;
+        }
+    }
+
+    if (any_succeeded) mb_devices[dev].consecutive_failures = 0;
+    else deviceFailed(dev);
+}
+
+//-----------------------------------------------------------------------------
+// Thread to poll the slave devices of a worker. Workers run concurrently, so
+// a slow or offline device only delays the devices sharing its serial port.
+// Inside a worker, tasks are polled earliest deadline first: the task whose
+// poll is due the soonest always goes next, and the worker sleeps only when
+// no task is due. A task that falls more than one period behind skips the
+// polls it missed instead of bursting to catch up
+//-----------------------------------------------------------------------------
+void *querySlaveDevices(void *arg)
+{
+    struct MB_worker *worker = (struct MB_worker *)arg;
+
+    if (worker->num_tasks == 0) return NULL;
+
+    while (run_openplc && !worker->stop)
+    {
+        struct MB_poll_task *task = &worker->tasks[0];
+        for (int i = 1; i < worker->num_tasks; i++)
+        {
+            if (worker->tasks[i].next_poll < task->next_poll) task = &worker->tasks[i];
+        }
+
+        //sleep at most 100ms at a time to check if the worker is stopping
+        uint64_t now = monotonicTime();
+        if (task->next_poll > now)
+        {
+            uint64_t wake_up = (task->next_poll - now > 100000000ULL) ? now + 100000000ULL : task->next_poll;
+            struct timespec ts;
+            ts.tv_sec = wake_up / 1000000000ULL;
+            ts.tv_nsec = wake_up % 1000000000ULL;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            continue;
+        }
+
+        pollTask(worker, task);
+
+        task->next_poll += task->period;
+        now = monotonicTime();
+        if (now >= task->next_poll + task->period)
+            task->next_poll += ((now - task->next_poll) / task->period) * task->period;
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Thread to poll the slave devices of a worker in Scan_Synchronous mode.
+// Instead of following its own clock, the worker polls all its tasks once
+// every time the scan thread publishes the outputs, and reports back when
+// it's done so that the next scan can pick up the fresh inputs
+//-----------------------------------------------------------------------------
+void *querySlaveDevicesSync(void *arg)
+{
+    struct MB_worker *worker = (struct MB_worker *)arg;
+
+    //workers without tasks aren't counted on sync_workers
+    if (worker->num_tasks == 0) return NULL;
+
+    while (run_openplc && !worker->stop)
+    {
+        pthread_mutex_lock(&sync_lock);
+        while (sync_cycle == worker->cycle && run_openplc && !worker->stop)
+        {
+            //wake up periodically to check if the runtime is stopping
+            struct timespec ts;
+            uint64_t deadline = monotonicTime() + 100000000ULL;
+            ts.tv_sec = deadline / 1000000000ULL;
+            ts.tv_nsec = deadline % 1000000000ULL;
+            pthread_cond_timedwait(&sync_start, &sync_lock, &ts);
+        }
+        worker->cycle = sync_cycle;
+        pthread_mutex_unlock(&sync_lock);
+
+        if (!run_openplc || worker->stop) break;
+
+        for (int i = 0; i < worker->num_tasks; i++) pollTask(worker, &worker->tasks[i]);
+
+        pthread_mutex_lock(&sync_lock);
+        sync_pending--;
+        if (sync_pending == 0) pthread_cond_broadcast(&sync_done);
+        pthread_mutex_unlock(&sync_lock);
+    }
+
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Takes over the connection, buffers and diagnostics of a device from the
+// previous config. The previous instance is left without them, so that
+// releaseDevice() doesn't close or free what was taken
+//-----------------------------------------------------------------------------
+void adoptDevice(struct MB_device *device, struct MB_device *old)
+{
+    device->mb_ctx = old->mb_ctx;
+    device->pipeline = old->pipeline;
+    device->isConnected = old->isConnected;
+    device->link_state = old->link_state.load();
+    device->next_attempt = old->next_attempt.load();
+    device->consecutive_failures = old->consecutive_failures.load();
+    device->breaker_trips = old->breaker_trips.load();
+    device->connects = old->connects.load();
+    device->connect_fd = old->connect_fd;
+    device->connect_deadline = old->connect_deadline;
+    device->jitter_seed = old->jitter_seed;
+    device->last_read = old->last_read.load();
+    device->last_latency = old->last_latency.load();
+    device->transactions = old->transactions.load();
+    device->failed_transactions = old->failed_transactions.load();
+    device->latency = old->latency;
+
+    for (int block = 0; block < MB_NUM_BLOCKS; block++)
+    {
+        struct MB_address *address = blockOf(device, block);
+        struct MB_address *old_address = blockOf(old, block);
+
+        for (int i = 0; i < 3; i++)
+        {
+            address->data.buffers[i] = old_address->data.buffers[i];
+            old_address->data.buffers[i] = NULL;
+        }
+        address->data.ready = old_address->data.ready.load();
+        address->data.back = old_address->data.back;
+        address->data.front = old_address->data.front;
+        address->copies = old_address->copies;
+        address->next_refresh = old_address->next_refresh;
+        address->acked = old_address->acked;
+        address->acked_valid = old_address->acked_valid;
+
+        old_address->copies = NULL;
+        old_address->acked = NULL;
+    }
+
+    old->mb_ctx = NULL;
+    old->pipeline = NULL;
+    old->connect_fd = -1;
+    old->latency = NULL;
+    free(old->config);
+    old->config = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the connection of a device that is no longer polled and frees its
+// buffers. The context of an RTU device belongs to its bus
+//-----------------------------------------------------------------------------
+void releaseDevice(struct MB_device *device)
+{
+    if (device->protocol == MB_TCP)
+    {
+        if (device->pipeline != NULL)
+        {
+            pipelineClose(device->pipeline);
+            free(device->pipeline);
+        }
+        if (device->mb_ctx != NULL)
+        {
+            modbus_close(device->mb_ctx);
+            modbus_free(device->mb_ctx);
+        }
+    }
+    if (device->connect_fd >= 0) close(device->connect_fd);
+
+    for (int block = 0; block < MB_NUM_BLOCKS; block++)
+    {
+        struct MB_address *address = blockOf(device, block);
+        for (int i = 0; i < 3; i++) free(address->data.buffers[i]);
+        free(address->copies);
+        free(address->acked);
+    }
+
+    free(device->latency);
+    free(device->config);
+}
+
+//-----------------------------------------------------------------------------
+// Sets up the connection and buffers of each device. When the config is
+// reloaded, a device whose lines on mbconfig.cfg didn't change takes over
+// its previous instance instead. Returns the number of devices taken over
+//-----------------------------------------------------------------------------
+int setupDevices(struct MB_device *old_devices, int old_num_devices, bool keep_connections)
+{
+    unsigned char log_msg[1000];
+    int adopted = 0;
+
+    for (int i = 0; i < num_devices; i++)
+    {
+        struct MB_device *device = &mb_devices[i];
+        struct MB_device *old = NULL;
+
+        for (int j = 0; keep_connections && j < old_num_devices && device->config != NULL; j++)
+        {
+            //devices already taken over have no config left
+            if (old_devices[j].config != NULL && !strcmp(old_devices[j].config, device->config))
+            {
+                old = &old_devices[j];
+                break;
+            }
+        }
+
+        if (old != NULL)
+        {
+            adoptDevice(device, old);
+            adopted++;
+        }
+        else
+        {
+            if (device->protocol == MB_TCP)
+            {
+                //connections are started without name resolution
+                struct in_addr numeric;
+                if (inet_pton(AF_INET, device->dev_address, &numeric) != 1)
+                {
+                    sprintf(log_msg, "MB device %s: %s is not a numeric IPv4 address\n", device->dev_name, device->dev_address);
+                    log(log_msg);
+                }
+
+                device->mb_ctx = modbus_new_tcp(device->dev_address, device->ip_port);
+                if (device->pipeline_depth > 1)
+                    device->pipeline = createPipeline(device->dev_address, device->ip_port, device->pipeline_depth, timeout);
+            }
+
+            device->isConnected = false;
+            device->link_state = MB_LINK_BACKOFF;
+            device->next_attempt = 0;
+            device->connect_fd = -1;
+            device->jitter_seed = time(NULL) + i;
+            device->latency = createHistogram();
+
+            allocateBlockBuffer(&device->discrete_inputs, sizeof(uint8_t));
+            allocateBlockBuffer(&device->coils, sizeof(uint8_t));
+            allocateBlockBuffer(&device->input_registers, sizeof(uint16_t));
+            allocateBlockBuffer(&device->holding_read_registers, sizeof(uint16_t));
+            allocateBlockBuffer(&device->holding_registers, sizeof(uint16_t));
+        }
+
+        if (device->protocol == MB_RTU)
+        {
+            device->bus = getBus(i);
+            device->mb_ctx = device->bus->ctx;
+            if (!device->bus->open)
+            {
+                device->isConnected = false;
+                device->link_state = MB_LINK_BACKOFF;
+                device->next_attempt = 0;
+            }
+        }
+
         //slave id
-		modbus_set_slave(mb_devices[i].mb_ctx, mb_devices[i].dev_id);
-        
+        modbus_set_slave(device->mb_ctx, device->dev_id);
+
         //timeout
         uint32_t to_sec = timeout / 1000;
         uint32_t to_usec = (timeout % 1000) * 1000;
-        modbus_set_response_timeout(mb_devices[i].mb_ctx, to_sec, to_usec);
-	}
-    
+        modbus_set_response_timeout(device->mb_ctx, to_sec, to_usec);
+
+        device->link = i;
+    }
+
+    return adopted;
+}
+
+//-----------------------------------------------------------------------------
+// Frees the polling plan of a set of workers that were stopped
+//-----------------------------------------------------------------------------
+void freeWorkers(struct MB_worker *workers, int count)
+{
+    if (workers == NULL) return;
+
+    for (int w = 0; w < count; w++)
+    {
+        struct MB_worker *worker = &workers[w];
+        for (int t = 0; t < worker->num_tasks; t++)
+        {
+            struct MB_poll_task *task = &worker->tasks[t];
+            for (int r = 0; r < task->num_requests; r++)
+            {
+                free(task->requests[r].read_segments);
+                free(task->requests[r].write_segments);
+                free(task->requests[r].changed);
+            }
+            free(task->requests);
+            free(task->blocks);
+        }
+        free(worker->tasks);
+        free(worker->devices);
+        free(worker->transactions);
+        free(worker->transaction_requests);
+    }
+
+    free(workers);
+}
+
+//-----------------------------------------------------------------------------
+// Replaces the devices being polled with the ones on mbconfig.cfg and plans
+// how to poll them. Must be called with the workers stopped and bufferLock
+// held, since the scan thread walks the device list. When reloading, devices
+// that didn't change keep their connection, unless the global Timeout changed.
+// Returns the number of devices that were kept
+//-----------------------------------------------------------------------------
+int loadDevices(bool reload)
+{
+    struct MB_device *old_devices = mb_devices;
+    int old_num_devices = num_devices;
+    struct MB_worker *old_workers = mb_workers;
+    int old_num_workers = num_workers;
+    uint16_t old_timeout = timeout;
+
+    struct MB_device *devices = NULL;
+    int count = parseConfig("mbconfig.cfg", &devices);
+    if (count < 0) count = 0;
+
+    mb_devices = devices;
+    num_devices = count;
+    retired_buses = mb_buses;
+    num_retired_buses = num_buses;
+    mb_buses = (struct MB_rtu_bus *)calloc(count ? count : 1, sizeof(struct MB_rtu_bus));
+    num_buses = 0;
+
+    int adopted = setupDevices(old_devices, old_num_devices, reload && timeout == old_timeout);
+    assignTargets();
+    planCopies();
+    createWorkers();
+
+    for (int i = 0; i < old_num_devices; i++) releaseDevice(&old_devices[i]);
+    free(old_devices);
+    freeWorkers(old_workers, old_num_workers);
+
+    //serial ports that no device uses anymore
+    for (int i = 0; i < num_retired_buses; i++)
+    {
+        if (retired_buses[i].ctx == NULL) continue;
+        modbus_close(retired_buses[i].ctx);
+        modbus_free(retired_buses[i].ctx);
+    }
+    free(retired_buses);
+    retired_buses = NULL;
+    num_retired_buses = 0;
+
+    return adopted;
+}
+
+//-----------------------------------------------------------------------------
+// Starts a polling thread for each worker
+//-----------------------------------------------------------------------------
+void startWorkers()
+{
+    pthread_mutex_lock(&sync_lock);
+    sync_workers = 0;
+    sync_pending = 0;
+    if (scan_sync_timeout == 0) scan_sync_timeout = common_ticktime__ / 1000000ULL;
+    for (int i = 0; i < num_workers; i++)
+    {
+        mb_workers[i].stop = false;
+        mb_workers[i].cycle = sync_cycle;
+        if (mb_workers[i].num_tasks > 0) sync_workers++;
+    }
+    pthread_mutex_unlock(&sync_lock);
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        int ret = pthread_create(&mb_workers[i].thread, NULL, scan_synchronous ? querySlaveDevicesSync : querySlaveDevices, &mb_workers[i]);
+        mb_workers[i].running = (ret == 0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Stops the polling threads. Each worker finishes the poll it's on, so no
+// transaction is cut in half
+//-----------------------------------------------------------------------------
+void stopWorkers()
+{
+    pthread_mutex_lock(&sync_lock);
+    for (int i = 0; i < num_workers; i++) mb_workers[i].stop = true;
+    pthread_cond_broadcast(&sync_start);
+    pthread_mutex_unlock(&sync_lock);
+
+    for (int i = 0; i < num_workers; i++)
+    {
+        if (mb_workers[i].running) pthread_join(mb_workers[i].thread, NULL);
+        mb_workers[i].running = false;
+    }
+
+    //a scan waiting for the cycle that was interrupted can go on
+    pthread_mutex_lock(&sync_lock);
+    sync_pending = 0;
+    pthread_cond_broadcast(&sync_done);
+    pthread_mutex_unlock(&sync_lock);
+}
+
+//-----------------------------------------------------------------------------
+// This function is called by the main OpenPLC routine when it is initializing.
+// Modbus master initialization procedures are here.
+//-----------------------------------------------------------------------------
+void initializeMB()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sync_start, &attr);
+    pthread_cond_init(&sync_done, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_mutex_lock(&reloadLock);
+    pthread_mutex_lock(&bufferLock);
+    loadDevices(false);
+    pthread_mutex_unlock(&bufferLock);
+
     //Initialize comm error counter
+    comm_errors = 0;
     if (special_functions[2] != NULL) *special_functions[2] = 0;
-    
+
     if (num_devices > 0)
     {
-        pthread_t thread;
-        int ret = pthread_create(&thread, NULL, querySlaveDevices, NULL);
-        if (ret==0) 
+        startWorkers();
+
+        unsigned char log_msg[1000];
+        sprintf(log_msg, "Modbus Master: polling %d devices with %d workers\n", num_devices, num_workers);
+        log(log_msg);
+    }
+    pthread_mutex_unlock(&reloadLock);
+}
+
+//-----------------------------------------------------------------------------
+// Reloads mbconfig.cfg while the PLC is running. The workers are stopped
+// between polls, the new devices are set up while the scan waits on
+// bufferLock, and the workers start again with the new polling plan.
+// Devices whose config didn't change keep their connection and their last
+// inputs, so the PLC program doesn't see their data go away
+//-----------------------------------------------------------------------------
+void reloadMB()
+{
+    unsigned char log_msg[1000];
+
+    if (access("mbconfig.cfg", R_OK) != 0)
+    {
+        sprintf(log_msg, "Modbus Master: can't reload mbconfig.cfg => %s\n", strerror(errno));
+        log(log_msg);
+        return;
+    }
+
+    pthread_mutex_lock(&reloadLock);
+    int old_num_devices = num_devices;
+    stopWorkers();
+
+    pthread_mutex_lock(&bufferLock);
+    int adopted = loadDevices(true);
+    pthread_mutex_unlock(&bufferLock);
+
+    if (num_devices > 0) startWorkers();
+    pthread_mutex_unlock(&reloadLock);
+
+    sprintf(log_msg, "Modbus Master: reloaded mbconfig.cfg. %d devices kept, %d added or changed, %d removed or changed\n",
+            adopted, num_devices - adopted, old_num_devices - adopted);
+    log(log_msg);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the latest data of an input block to the process image, if the
+// block was polled since the last scan
+//-----------------------------------------------------------------------------
+void copyInputBlock(struct MB_address *address, int value_size)
+{
+    if (address->num_copies == 0 || !takeBuffer(&address->data)) return;
+
+    uint8_t *values = (uint8_t *)address->data.buffers[address->data.front];
+    for (int i = 0; i < address->num_copies; i++)
+    {
+        struct MB_copy *copy = &address->copies[i];
+        memcpy(copy->variable, values + copy->block_offset * value_size, copy->count * value_size);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copies the process image to the back buffer of an output block and
+// publishes it to the polling worker. Values without a variable on the image
+// are always written as 0
+//-----------------------------------------------------------------------------
+void copyOutputBlock(struct MB_address *address, int value_size)
+{
+    if (address->num_regs == 0) return;
+
+    uint8_t *values = (uint8_t *)address->data.buffers[address->data.back];
+    for (int i = 0; i < address->num_copies; i++)
+    {
+        struct MB_copy *copy = &address->copies[i];
+        memcpy(values + copy->block_offset * value_size, copy->variable, copy->count * value_size);
+    }
+
+    publishBuffer(&address->data);
+}
+
+//-----------------------------------------------------------------------------
+// Copies the diagnostics of each device to its Diagnostics_Target, so that
+// the PLC program can react to a device that went offline or to inputs that
+// are getting old. The block has MB_DIAG_SIZE %MD values:
+//   0: connection state (0 online, 1 connecting, 2 backing off)
+//   1: consecutive polls with no answer
+//   2: age of the inputs in ms, or -1 if they were never received
+//   3: round trip time of the last transaction in us
+//   4: successful transactions
+//   5: failed transactions
+//   6: connections established
+//   7: times the circuit breaker opened
+//-----------------------------------------------------------------------------
+void updateDiagnostics()
+{
+    uint64_t now = monotonicTime();
+
+    for (int i = 0; i < num_devices; i++)
+    {
+        int target = mb_devices[i].diagnostics_target;
+        if (target < 0) continue;
+
+        struct MB_device *device = &mb_devices[mb_devices[i].link];
+        uint64_t last_read = mb_devices[i].last_read;
+        IEC_DINT values[MB_DIAG_SIZE];
+
+        values[0] = device->link_state;
+        values[1] = device->consecutive_failures;
+        values[2] = (last_read == 0) ? -1 : (IEC_DINT)((now - last_read) / 1000000ULL);
+        values[3] = device->last_latency;
+        values[4] = (IEC_DINT)device->transactions;
+        values[5] = (IEC_DINT)device->failed_transactions;
+        values[6] = device->connects;
+        values[7] = device->breaker_trips;
+
+        for (int j = 0; j < MB_DIAG_SIZE && target + j < BUFFER_SIZE; j++)
+        {
+            if (dint_memory[target + j] != NULL) *dint_memory[target + j] = values[j];
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// This function is called by the OpenPLC in a loop, before the input image
+// is locked. In Scan_Synchronous mode it waits for the workers to finish the
+// poll cycle started by the previous scan, for up to Scan_Sync_Timeout, so
+// that the inputs copied by updateBuffersIn_MB() are the ones just read
+//-----------------------------------------------------------------------------
+void waitBuffersIn_MB()
+{
+    if (!scan_synchronous) return;
+
+    pthread_mutex_lock(&sync_lock);
+    if (sync_pending > 0)
+    {
+        uint64_t deadline = monotonicTime() + (uint64_t)scan_sync_timeout * 1000000ULL;
+        struct timespec ts;
+        ts.tv_sec = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
+
+        while (sync_pending > 0)
         {
-            pthread_detach(thread);
+            if (pthread_cond_timedwait(&sync_done, &sync_lock, &ts) == ETIMEDOUT) break;
         }
+        if (sync_pending > 0) sync_timeouts++;
+    }
+    pthread_mutex_unlock(&sync_lock);
+}
+
+//-----------------------------------------------------------------------------
+// Starts a poll cycle on all workers in Scan_Synchronous mode. If a worker
+// is still busy with the previous cycle, no cycle is started on this scan
+//-----------------------------------------------------------------------------
+void startSyncCycle()
+{
+    pthread_mutex_lock(&sync_lock);
+    if (sync_pending > 0)
+    {
+        sync_overruns++;
+    }
+    else
+    {
+        sync_cycle++;
+        sync_pending = sync_workers;
+        pthread_cond_broadcast(&sync_start);
     }
+    pthread_mutex_unlock(&sync_lock);
 }
 
 //-----------------------------------------------------------------------------
@@ -613,15 +2768,17 @@ void initializeMB()
 //-----------------------------------------------------------------------------
 void updateBuffersIn_MB()
 {
-	pthread_mutex_lock(&ioLock);
+	if (copy_plan_generation != io_map_generation) planCopies();
 
-	for (int i = 0; i < MAX_MB_IO; i++)
+	for (int i = 0; i < num_devices; i++)
 	{
-		if (bool_input[100+(i/8)][i%8] != NULL) *bool_input[100+(i/8)][i%8] = bool_input_buf[i];
-		if (int_input[100+i] != NULL) *int_input[100+i] = int_input_buf[i];
+		copyInputBlock(&mb_devices[i].discrete_inputs, sizeof(IEC_BOOL));
+		copyInputBlock(&mb_devices[i].input_registers, sizeof(IEC_UINT));
+		copyInputBlock(&mb_devices[i].holding_read_registers, sizeof(IEC_UINT));
 	}
 
-	pthread_mutex_unlock(&ioLock);
+	if (special_functions[2] != NULL) *special_functions[2] = comm_errors;
+	updateDiagnostics();
 }
 
 
@@ -631,13 +2788,115 @@ void updateBuffersIn_MB()
 //-----------------------------------------------------------------------------
 void updateBuffersOut_MB()
 {
-	pthread_mutex_lock(&ioLock);
+	if (copy_plan_generation != io_map_generation) planCopies();
 
-	for (int i = 0; i < MAX_MB_IO; i++)
+	for (int i = 0; i < num_devices; i++)
 	{
-		if (bool_output[100+(i/8)][i%8] != NULL) bool_output_buf[i] = *bool_output[100+(i/8)][i%8];
-		if (int_output[100+i] != NULL) int_output_buf[i] = *int_output[100+i];
+		copyOutputBlock(&mb_devices[i].coils, sizeof(IEC_BOOL));
+		copyOutputBlock(&mb_devices[i].holding_registers, sizeof(IEC_UINT));
 	}
 
-	pthread_mutex_unlock(&ioLock);
+	if (scan_synchronous && num_devices > 0) startSyncCycle();
+}
+
+//-----------------------------------------------------------------------------
+// Print the connection health and the diagnostics of each device. Devices
+// polled through another device's connection share its state and latency.
+// Returns the number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printModbusMasterHealth(char *buffer, int size)
+{
+    const char *state_names[] = {"online", "connecting", "backoff"};
+    int count = 0;
+    uint64_t now = monotonicTime();
+
+    pthread_mutex_lock(&reloadLock);
+
+    if (scan_synchronous)
+    {
+        pthread_mutex_lock(&sync_lock);
+        count += snprintf(&buffer[count], size - count, "scan_synchronous cycles=%llu timeouts=%llu overruns=%llu timeout_ms=%u\n",
+                          (unsigned long long)sync_cycle, (unsigned long long)sync_timeouts, (unsigned long long)sync_overruns, scan_sync_timeout);
+        pthread_mutex_unlock(&sync_lock);
+    }
+
+    for (int i = 0; i < num_devices && count < size; i++)
+    {
+        struct MB_device *device = &mb_devices[mb_devices[i].link];
+        uint64_t next_attempt = device->next_attempt;
+        uint64_t last_read = mb_devices[i].last_read;
+        uint8_t state = device->link_state;
+        uint32_t failures = device->consecutive_failures;
+
+        count += snprintf(&buffer[count], size - count,
+                          "%s %s breaker=%s failures=%u trips=%u connects=%u retry_in_ms=%llu",
+                          mb_devices[i].dev_name, state_names[state], (failures >= breaker_threshold) ? "open" : "closed",
+                          failures, device->breaker_trips.load(), device->connects.load(),
+                          (unsigned long long)((state == MB_LINK_BACKOFF && next_attempt > now) ? (next_attempt - now) / 1000000ULL : 0));
+        if (count < size)
+        {
+            if (last_read == 0) count += snprintf(&buffer[count], size - count, " age_ms=never");
+            else count += snprintf(&buffer[count], size - count, " age_ms=%llu", (unsigned long long)((now - last_read) / 1000000ULL));
+        }
+        if (count < size)
+            count += snprintf(&buffer[count], size - count,
+                              " transactions=%llu failed=%llu latency_us p50=%llu p99=%llu max=%llu",
+                              (unsigned long long)device->transactions.load(), (unsigned long long)device->failed_transactions.load(),
+                              (unsigned long long)histogramPercentile(device->latency, 0.5),
+                              (unsigned long long)histogramPercentile(device->latency, 0.99),
+                              (unsigned long long)histogramPercentile(device->latency, 1.0));
+        if (mb_devices[i].link != i && count < size)
+            count += snprintf(&buffer[count], size - count, " via=%s", device->dev_name);
+        if (count < size)
+            count += snprintf(&buffer[count], size - count, "\n");
+    }
+    pthread_mutex_unlock(&reloadLock);
+
+    return (count < size) ? count : size - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Print the diagnostics of each device in the Prometheus text format.
+// Returns the number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printModbusMasterMetrics(char *buffer, int size)
+{
+    const char *names[] = {"openplc_modbus_master_state", "openplc_modbus_master_consecutive_failures",
+                           "openplc_modbus_master_data_age_seconds", "openplc_modbus_master_transactions_total",
+                           "openplc_modbus_master_failed_transactions_total", "openplc_modbus_master_connects_total",
+                           "openplc_modbus_master_breaker_trips_total"};
+    const char *types[] = {"gauge", "gauge", "gauge", "counter", "counter", "counter", "counter"};
+    int count = 0;
+    uint64_t now = monotonicTime();
+
+    pthread_mutex_lock(&reloadLock);
+    for (int c = 0; c < 7 && count < size; c++)
+    {
+        count += snprintf(&buffer[count], size - count, "# TYPE %s %s\n", names[c], types[c]);
+        for (int i = 0; i < num_devices && count < size; i++)
+        {
+            struct MB_device *device = &mb_devices[mb_devices[i].link];
+            uint64_t last_read = mb_devices[i].last_read;
+            double values[] = {(double)device->link_state, (double)device->consecutive_failures,
+                               (last_read == 0) ? -1 : (now - last_read) / 1e9, (double)device->transactions,
+                               (double)device->failed_transactions, (double)device->connects, (double)device->breaker_trips};
+
+            count += snprintf(&buffer[count], size - count, "%s{device=\"%s\"} %g\n", names[c], mb_devices[i].dev_name, values[c]);
+        }
+    }
+
+    if (count < size)
+        count += snprintf(&buffer[count], size - count, "# TYPE openplc_modbus_master_latency_seconds histogram\n");
+    for (int i = 0; i < num_devices && count < size; i++)
+    {
+        //devices that share a connection share its histogram
+        if (mb_devices[i].link != i) continue;
+
+        char labels[120];
+        snprintf(labels, sizeof(labels), "device=\"%s\"", mb_devices[i].dev_name);
+        count += printPrometheusHistogram(&buffer[count], size - count, "openplc_modbus_master_latency_seconds", labels, mb_devices[i].latency);
+    }
+    pthread_mutex_unlock(&reloadLock);
+
+    return (count < size) ? count : size - 1;
 }
@@ -0,0 +1,351 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This is the pipelined Modbus/TCP transport of the Modbus master. Unlike
+// libmodbus, which waits for each response before sending the next request,
+// it keeps several transactions in flight on the same connection and matches
+// the responses to the requests by their MBAP transaction id, so that slow
+// links are not limited to one transaction per round trip.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ladder.h"
+
+#define MBAP_HEADER_SIZE    7
+#define MAX_TCP_FRAME       (MBAP_HEADER_SIZE + MB_MAX_PDU_SIZE)
+
+struct MB_pipeline
+{
+    char address[100];
+    uint16_t port;
+    int fd;
+    int depth;              //maximum number of transactions in flight
+    int timeout;            //ms, for each transaction
+    uint16_t next_transaction_id;
+
+    //bytes received that don't make a whole frame yet
+    unsigned char rx_buffer[2 * MAX_TCP_FRAME];
+    int rx_size;
+};
+
+//A transaction waiting for its response
+struct MB_in_flight
+{
+    int transaction;        //index on the caller's array
+    uint16_t transaction_id;
+    uint64_t sent;          //ns, on CLOCK_MONOTONIC
+    uint64_t deadline;      //ns, on CLOCK_MONOTONIC
+};
+
+//-----------------------------------------------------------------------------
+// Returns the current time of the monotonic clock in nanoseconds
+//-----------------------------------------------------------------------------
+static uint64_t pipelineTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Creates a pipelined connection to a Modbus/TCP slave. Nothing is sent
+// until a connected socket is handed to it with pipelineSetSocket()
+//-----------------------------------------------------------------------------
+struct MB_pipeline *createPipeline(const char *address, uint16_t port, int depth, int timeout)
+{
+    struct MB_pipeline *pipeline = (struct MB_pipeline *)calloc(1, sizeof(struct MB_pipeline));
+
+    strncpy(pipeline->address, address, sizeof(pipeline->address) - 1);
+    pipeline->port = port;
+    pipeline->fd = -1;
+    pipeline->depth = (depth > 0) ? depth : 1;
+    pipeline->timeout = timeout;
+
+    return pipeline;
+}
+
+//-----------------------------------------------------------------------------
+// Closes the connection to the slave. Responses still on their way are lost
+//-----------------------------------------------------------------------------
+void pipelineClose(struct MB_pipeline *pipeline)
+{
+    if (pipeline->fd < 0) return;
+
+    shutdown(pipeline->fd, SHUT_RDWR);
+    close(pipeline->fd);
+    pipeline->fd = -1;
+    pipeline->rx_size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Starts a non-blocking connection to a Modbus/TCP slave. The address must be
+// a numeric IPv4 address, so that the worker never blocks on a DNS lookup.
+// Returns the socket, which is connecting in the background, or -1 on error
+//-----------------------------------------------------------------------------
+int startConnect(const char *address, uint16_t port)
+{
+    struct addrinfo hints, *result;
+    char port_str[10];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    sprintf(port_str, "%d", port);
+
+    int ret = getaddrinfo(address, port_str, &hints, &result);
+    if (ret != 0)
+    {
+        errno = (ret == EAI_NONAME) ? EINVAL : EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK, result->ai_protocol);
+    if (fd < 0)
+    {
+        freeaddrinfo(result);
+        return -1;
+    }
+
+    if (connect(fd, result->ai_addr, result->ai_addrlen) < 0 && errno != EINPROGRESS)
+    {
+        int err = errno;
+        close(fd);
+        freeaddrinfo(result);
+        errno = err;
+        return -1;
+    }
+    freeaddrinfo(result);
+
+    //requests are small and must not wait for each other
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Checks a connection started by startConnect() without blocking. Returns 1
+// if it is established, 0 if it is still in progress or -1 if it failed, in
+// which case errno has the reason
+//-----------------------------------------------------------------------------
+int finishConnect(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+
+    int ret = poll(&pfd, 1, 0);
+    if (ret < 0) return (errno == EINTR) ? 0 : -1;
+    if (ret == 0) return 0;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return -1;
+    if (err != 0)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Hands a connected socket to the pipeline
+//-----------------------------------------------------------------------------
+void pipelineSetSocket(struct MB_pipeline *pipeline, int fd)
+{
+    pipelineClose(pipeline);
+
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+    pipeline->fd = fd;
+    pipeline->rx_size = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Sends one request with a new transaction id. Returns false if the
+// connection failed
+//-----------------------------------------------------------------------------
+static bool sendTransaction(struct MB_pipeline *pipeline, struct MB_transaction *transaction, uint16_t transaction_id)
+{
+    unsigned char frame[MAX_TCP_FRAME];
+
+    frame[0] = transaction_id >> 8;
+    frame[1] = transaction_id & 0xFF;
+    frame[2] = 0;
+    frame[3] = 0;
+    frame[4] = (transaction->request_size + 1) >> 8;
+    frame[5] = (transaction->request_size + 1) & 0xFF;
+    frame[6] = transaction->unit_id;
+    memcpy(&frame[MBAP_HEADER_SIZE], transaction->request, transaction->request_size);
+
+    int size = MBAP_HEADER_SIZE + transaction->request_size;
+    int sent = 0;
+    while (sent < size)
+    {
+        int n = send(pipeline->fd, &frame[sent], size - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        sent += n;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Executes a batch of transactions, keeping up to the pipeline depth in
+// flight at any time. Each transaction gets its own timeout, counted from
+// the moment its request is sent. A response that arrives after its
+// transaction timed out carries an id that is no longer in flight and is
+// discarded. Returns false if the connection failed, in which case the
+// transactions that didn't complete are marked with MB_TX_ERROR and the
+// connection is closed
+//-----------------------------------------------------------------------------
+bool pipelineExecute(struct MB_pipeline *pipeline, struct MB_transaction *transactions, int count)
+{
+    struct MB_in_flight in_flight[MB_MAX_PIPELINE_DEPTH];
+    int num_in_flight = 0;
+    int next = 0;
+    int completed = 0;
+    uint64_t timeout = (uint64_t)pipeline->timeout * 1000000ULL;
+    int depth = (pipeline->depth < MB_MAX_PIPELINE_DEPTH) ? pipeline->depth : MB_MAX_PIPELINE_DEPTH;
+
+    for (int i = 0; i < count; i++) transactions[i].status = MB_TX_ERROR;
+    if (pipeline->fd < 0) return false;
+
+    while (completed < count)
+    {
+        //fill the pipeline
+        while (next < count && num_in_flight < depth)
+        {
+            uint16_t transaction_id = pipeline->next_transaction_id++;
+            if (!sendTransaction(pipeline, &transactions[next], transaction_id))
+            {
+                pipelineClose(pipeline);
+                return false;
+            }
+
+            in_flight[num_in_flight].transaction = next;
+            in_flight[num_in_flight].transaction_id = transaction_id;
+            in_flight[num_in_flight].sent = pipelineTime();
+            in_flight[num_in_flight].deadline = in_flight[num_in_flight].sent + timeout;
+            num_in_flight++;
+            next++;
+        }
+
+        //wait for a response until the oldest transaction times out
+        uint64_t now = pipelineTime();
+        uint64_t deadline = in_flight[0].deadline;
+        for (int i = 1; i < num_in_flight; i++)
+        {
+            if (in_flight[i].deadline < deadline) deadline = in_flight[i].deadline;
+        }
+
+        struct pollfd pfd;
+        pfd.fd = pipeline->fd;
+        pfd.events = POLLIN;
+        int wait_ms = (deadline > now) ? (int)((deadline - now + 999999) / 1000000) : 0;
+        int ret = poll(&pfd, 1, wait_ms);
+        if (ret < 0 && errno != EINTR)
+        {
+            pipelineClose(pipeline);
+            return false;
+        }
+
+        if (ret > 0)
+        {
+            int n = recv(pipeline->fd, &pipeline->rx_buffer[pipeline->rx_size], sizeof(pipeline->rx_buffer) - pipeline->rx_size, 0);
+            if (n <= 0)
+            {
+                if (n < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+                if (n == 0) errno = ECONNRESET;
+                pipelineClose(pipeline);
+                return false;
+            }
+            pipeline->rx_size += n;
+
+            //take every complete frame out of the buffer
+            while (pipeline->rx_size >= MBAP_HEADER_SIZE)
+            {
+                unsigned char *frame = pipeline->rx_buffer;
+                int length = (frame[4] << 8) | frame[5];
+                if (frame[2] != 0 || frame[3] != 0 || length < 2 || length > MB_MAX_PDU_SIZE + 1)
+                {
+                    errno = EPROTO;
+                    pipelineClose(pipeline);
+                    return false;
+                }
+
+                int size = MBAP_HEADER_SIZE - 1 + length;
+                if (pipeline->rx_size < size) break;
+
+                uint16_t transaction_id = (frame[0] << 8) | frame[1];
+                for (int i = 0; i < num_in_flight; i++)
+                {
+                    if (in_flight[i].transaction_id != transaction_id) continue;
+
+                    struct MB_transaction *transaction = &transactions[in_flight[i].transaction];
+                    transaction->response_size = length - 1;
+                    transaction->latency = (uint32_t)((pipelineTime() - in_flight[i].sent) / 1000);
+                    memcpy(transaction->response, &frame[MBAP_HEADER_SIZE], transaction->response_size);
+
+                    if ((transaction->response[0] & 0x7F) != transaction->request[0]) transaction->status = MB_TX_ERROR;
+                    else if (transaction->response[0] & 0x80) transaction->status = MB_TX_EXCEPTION;
+                    else transaction->status = MB_TX_OK;
+
+                    in_flight[i] = in_flight[num_in_flight - 1];
+                    num_in_flight--;
+                    completed++;
+                    break;
+                }
+
+                memmove(pipeline->rx_buffer, &pipeline->rx_buffer[size], pipeline->rx_size - size);
+                pipeline->rx_size -= size;
+            }
+        }
+
+        //expire the transactions that ran out of time
+        now = pipelineTime();
+        for (int i = 0; i < num_in_flight; i++)
+        {
+            if (in_flight[i].deadline > now) continue;
+
+            transactions[in_flight[i].transaction].status = MB_TX_TIMEOUT;
+            in_flight[i] = in_flight[num_in_flight - 1];
+            num_in_flight--;
+            completed++;
+            i--;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,291 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// This is the Modbus RTU slave of the OpenPLC. It opens a serial port,
+// detects the end of each frame by timing the t3.5 silence on the line and
+// hands the request to the same engine used by the Modbus/TCP server.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "ladder.h"
+
+#define MAX_RTU_FRAME       256
+#define MBAP_HEADER_SIZE    6
+
+//-----------------------------------------------------------------------------
+// Calculates the Modbus CRC16 of a buffer
+//-----------------------------------------------------------------------------
+uint16_t calculateCRC16(unsigned char *buffer, int size)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (int i = 0; i < size; i++)
+    {
+        crc ^= buffer[i];
+        for (int j = 0; j < 8; j++)
+        {
+            if (crc & 0x0001)
+                crc = (crc >> 1) ^ 0xA001;
+            else
+                crc = crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+//-----------------------------------------------------------------------------
+// Converts a numeric baud rate into a termios speed. Returns B0 if the baud
+// rate is not supported
+//-----------------------------------------------------------------------------
+speed_t baudToSpeed(int baud)
+{
+    switch (baud)
+    {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+#ifdef B230400
+        case 230400: return B230400;
+#endif
+        default: return B0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Calculates the t3.5 inter-frame silence in microseconds for the serial
+// settings provided. Above 19200 bps the Modbus specification fixes it at
+// 1750us
+//-----------------------------------------------------------------------------
+int rtuInterFrameDelay(int baud, char parity, int data_bits, int stop_bits)
+{
+    if (baud > 19200) return 1750;
+
+    int char_bits = 1 + data_bits + (parity == 'N' ? 0 : 1) + stop_bits;
+    return (int)((3.5 * char_bits * 1000000) / baud);
+}
+
+//-----------------------------------------------------------------------------
+// Opens and configures the serial port in raw mode. Returns the file
+// descriptor for the port or -1 on error
+//-----------------------------------------------------------------------------
+int openSerialPort(const char *device, int baud, char parity, int data_bits, int stop_bits)
+{
+    unsigned char log_msg[1000];
+    struct termios tios;
+
+    speed_t speed = baudToSpeed(baud);
+    if (speed == B0)
+    {
+        sprintf(log_msg, "Modbus RTU Slave: unsupported baud rate %d\n", baud);
+        log(log_msg);
+        return -1;
+    }
+
+    int fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
+    {
+        sprintf(log_msg, "Modbus RTU Slave: error opening %s => %s\n", device, strerror(errno));
+        log(log_msg);
+        return -1;
+    }
+
+    bzero(&tios, sizeof(tios));
+    cfsetispeed(&tios, speed);
+    cfsetospeed(&tios, speed);
+    tios.c_cflag |= (CREAD | CLOCAL);
+
+    tios.c_cflag &= ~CSIZE;
+    switch (data_bits)
+    {
+        case 5: tios.c_cflag |= CS5; break;
+        case 6: tios.c_cflag |= CS6; break;
+        case 7: tios.c_cflag |= CS7; break;
+        default: tios.c_cflag |= CS8; break;
+    }
+
+    if (stop_bits == 2) tios.c_cflag |= CSTOPB;
+
+    if (parity == 'E')
+    {
+        tios.c_cflag |= PARENB;
+        tios.c_iflag |= INPCK;
+    }
+    else if (parity == 'O')
+    {
+        tios.c_cflag |= (PARENB | PARODD);
+        tios.c_iflag |= INPCK;
+    }
+
+    //raw mode, no echo and no software flow control
+    tios.c_cc[VMIN] = 0;
+    tios.c_cc[VTIME] = 0;
+
+    if (tcsetattr(fd, TCSANOW, &tios) < 0)
+    {
+        sprintf(log_msg, "Modbus RTU Slave: error configuring %s => %s\n", device, strerror(errno));
+        log(log_msg);
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Process one complete RTU frame. The frame is converted into a Modbus/TCP
+// frame so that it can be handled by processModbusMessage(), and the response
+// is converted back to RTU. Returns the size of the RTU response, or 0 if no
+// response must be sent
+//-----------------------------------------------------------------------------
+int processRTUFrame(unsigned char *frame, int frameSize, uint8_t slave_id, unsigned char *response)
+{
+    unsigned char buffer[1024];
+    struct timespec received;
+    clock_gettime(CLOCK_MONOTONIC, &received);
+
+    //address + function code + CRC
+    if (frameSize < 4) return 0;
+
+    uint16_t crc = calculateCRC16(frame, frameSize - 2);
+    if (frame[frameSize - 2] != (crc & 0xFF) || frame[frameSize - 1] != (crc >> 8)) return 0;
+
+    uint8_t address = frame[0];
+    if (address != slave_id && address != 0) return 0;
+
+    //MBAP header: transaction id, protocol id, length and unit id
+    int pduSize = frameSize - 3;
+    buffer[0] = 0;
+    buffer[1] = 0;
+    buffer[2] = 0;
+    buffer[3] = 0;
+    buffer[4] = (pduSize + 1) >> 8;
+    buffer[5] = (pduSize + 1) & 0xFF;
+    buffer[6] = address;
+    memcpy(&buffer[MBAP_HEADER_SIZE + 1], &frame[1], pduSize);
+
+    int messageSize = processModbusMessage(buffer, MBAP_HEADER_SIZE + 1 + pduSize);
+    recordModbusRequest(frame[1], buffer, MBAP_HEADER_SIZE + 1 + pduSize, messageSize, &received);
+
+    //broadcast requests are executed but never answered
+    if (address == 0 || messageSize <= MBAP_HEADER_SIZE + 1) return 0;
+
+    int responseSize = messageSize - MBAP_HEADER_SIZE;
+    memcpy(response, &buffer[MBAP_HEADER_SIZE], responseSize);
+    response[0] = slave_id;
+
+    crc = calculateCRC16(response, responseSize);
+    response[responseSize++] = crc & 0xFF;
+    response[responseSize++] = crc >> 8;
+
+    return responseSize;
+}
+
+//-----------------------------------------------------------------------------
+// Function to start the Modbus RTU slave. Bytes are accumulated while they
+// keep arriving, and the frame is considered complete when select() times
+// out after a t3.5 silence on the line.
+//-----------------------------------------------------------------------------
+void startRTUSlave(const char *device, int baud, char parity, int data_bits, int stop_bits, uint8_t slave_id)
+{
+    unsigned char log_msg[1000];
+    unsigned char frame[MAX_RTU_FRAME];
+    unsigned char response[MAX_RTU_FRAME + 16];
+    int frameSize = 0;
+    bool frameOverflow = false;
+
+    int fd = openSerialPort(device, baud, parity, data_bits, stop_bits);
+    if (fd < 0) return;
+
+    mapUnusedIO();
+
+    int t35 = rtuInterFrameDelay(baud, parity, data_bits, stop_bits);
+    sprintf(log_msg, "Modbus RTU Slave: listening on %s as slave %d (t3.5 = %dus)\n", device, slave_id, t35);
+    log(log_msg);
+
+    while (run_modbus_rtu)
+    {
+        fd_set rfds;
+        FD_ZERO(&rfds);
+        FD_SET(fd, &rfds);
+
+        //while idle, wake up periodically to check if the slave must be stopped
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = (frameSize > 0 || frameOverflow) ? t35 : 100000;
+
+        int ret = select(fd + 1, &rfds, NULL, NULL, &tv);
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+            sprintf(log_msg, "Modbus RTU Slave: error waiting for data => %s\n", strerror(errno));
+            log(log_msg);
+            break;
+        }
+
+        if (ret > 0)
+        {
+            unsigned char chunk[MAX_RTU_FRAME];
+            int n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0) continue;
+
+            if (frameSize + n > MAX_RTU_FRAME)
+            {
+                frameOverflow = true;
+                frameSize = 0;
+            }
+            else
+            {
+                memcpy(&frame[frameSize], chunk, n);
+                frameSize += n;
+            }
+            continue;
+        }
+
+        //t3.5 silence: the frame is complete
+        if (frameSize > 0 && !frameOverflow)
+        {
+            int responseSize = processRTUFrame(frame, frameSize, slave_id, response);
+            if (responseSize > 0)
+            {
+                write(fd, response, responseSize);
+                tcdrain(fd);
+            }
+        }
+        frameSize = 0;
+        frameOverflow = false;
+    }
+
+    close(fd);
+    sprintf(log_msg, "Terminating Modbus RTU slave thread\r\n");
+    log(log_msg);
+}
@@ -0,0 +1,413 @@
+//-----------------------------------------------------------------------------
+// This file is part of the OpenPLC Software Stack.
+//
+// OpenPLC is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// OpenPLC is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with OpenPLC.  If not, see <http://www.gnu.org/licenses/>.
+//------
+//
+// Telemetry for the Modbus slave. Every request answered by the TCP, UDP and
+// RTU front ends is counted per function code, and its latency (receive to
+// send) and bufferLock wait time are recorded on log-linear histograms. All
+// counters are atomics, so recording never takes a lock. The statistics can
+// be printed on the interactive server or scraped in the Prometheus text
+// format from a local HTTP port.
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <atomic>
+
+#include "ladder.h"
+
+//Histograms store values in microseconds. Values below 16us get one bucket
+//each, and every power of two above that is split in 8 sub-buckets, which
+//keeps the error of any percentile below 12.5%
+#define HIST_LINEAR_BUCKETS     16
+#define HIST_SUB_BUCKETS        8
+#define HIST_MAX_MAGNITUDE      30
+#define HIST_NUM_BUCKETS        (HIST_LINEAR_BUCKETS + (HIST_MAX_MAGNITUDE - 3) * HIST_SUB_BUCKETS)
+
+#define MB_STATS_OTHER_FC       0
+#define METRICS_BUFFER_SIZE     262144
+
+struct MB_histogram
+{
+    std::atomic<uint64_t> counts[HIST_NUM_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+struct MB_fc_stats
+{
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> exceptions;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    struct MB_histogram latency;
+    struct MB_histogram lock_wait;
+};
+
+//Function codes with their own statistics. Everything else is accounted
+//under slot 0
+const unsigned char stats_function_codes[] = {0, 1, 2, 3, 4, 5, 6, 15, 16, 22, 23, 43};
+#define MB_STATS_NUM_FC (sizeof(stats_function_codes) / sizeof(stats_function_codes[0]))
+
+struct MB_fc_stats fc_stats[MB_STATS_NUM_FC];
+
+//-----------------------------------------------------------------------------
+// Returns the statistics slot for a function code
+//-----------------------------------------------------------------------------
+int statsSlot(unsigned char function_code)
+{
+    for (unsigned int i = 1; i < MB_STATS_NUM_FC; i++)
+    {
+        if (stats_function_codes[i] == function_code) return i;
+    }
+
+    return MB_STATS_OTHER_FC;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the histogram bucket for a value in microseconds
+//-----------------------------------------------------------------------------
+int histogramIndex(uint64_t value)
+{
+    if (value < HIST_LINEAR_BUCKETS) return (int)value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > HIST_MAX_MAGNITUDE) return HIST_NUM_BUCKETS - 1;
+
+    return HIST_LINEAR_BUCKETS + (magnitude - 4) * HIST_SUB_BUCKETS + (int)((value >> (magnitude - 3)) & 7);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the smallest value that falls on a histogram bucket
+//-----------------------------------------------------------------------------
+uint64_t bucketLowerBound(int index)
+{
+    if (index < HIST_LINEAR_BUCKETS) return index;
+
+    int magnitude = (index - HIST_LINEAR_BUCKETS) / HIST_SUB_BUCKETS + 4;
+    int sub_bucket = (index - HIST_LINEAR_BUCKETS) % HIST_SUB_BUCKETS;
+
+    return (uint64_t)(HIST_SUB_BUCKETS + sub_bucket) << (magnitude - 3);
+}
+
+//-----------------------------------------------------------------------------
+// Allocates an empty histogram, for modules that keep their own latencies
+//-----------------------------------------------------------------------------
+struct MB_histogram *createHistogram()
+{
+    return (struct MB_histogram *)calloc(1, sizeof(struct MB_histogram));
+}
+
+//-----------------------------------------------------------------------------
+// Records a value in microseconds on a histogram
+//-----------------------------------------------------------------------------
+void histogramRecord(struct MB_histogram *hist, uint64_t value)
+{
+    hist->counts[histogramIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    hist->total.fetch_add(1, std::memory_order_relaxed);
+    hist->sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = hist->max.load(std::memory_order_relaxed);
+    while (value > max && !hist->max.compare_exchange_weak(max, value, std::memory_order_relaxed));
+}
+
+//-----------------------------------------------------------------------------
+// Returns an upper estimate of the percentile provided (0 to 1) of the values
+// recorded on a histogram
+//-----------------------------------------------------------------------------
+uint64_t histogramPercentile(struct MB_histogram *hist, double percentile)
+{
+    uint64_t total = hist->total.load(std::memory_order_relaxed);
+    uint64_t max = hist->max.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    uint64_t target = (uint64_t)(percentile * total + 0.5);
+    if (target < 1) target = 1;
+
+    uint64_t count = 0;
+    for (int i = 0; i < HIST_NUM_BUCKETS - 1; i++)
+    {
+        count += hist->counts[i].load(std::memory_order_relaxed);
+        if (count >= target)
+        {
+            uint64_t upper = bucketLowerBound(i + 1) - 1;
+            return (upper < max) ? upper : max;
+        }
+    }
+
+    return max;
+}
+
+//-----------------------------------------------------------------------------
+// Records a request answered by one of the Modbus front ends. The request's
+// function code must be saved before processing, since the response is
+// written over the request buffer
+//-----------------------------------------------------------------------------
+void recordModbusRequest(unsigned char function_code, unsigned char *response, int requestSize, int responseSize, struct timespec *received)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t latency = ((now.tv_sec - received->tv_sec) * 1000000000ULL + now.tv_nsec - received->tv_nsec) / 1000;
+
+    struct MB_fc_stats *stats = &fc_stats[statsSlot(function_code)];
+    stats->requests.fetch_add(1, std::memory_order_relaxed);
+    stats->bytes_in.fetch_add(requestSize, std::memory_order_relaxed);
+    stats->bytes_out.fetch_add(responseSize, std::memory_order_relaxed);
+    if (responseSize >= 8 && (response[7] & 0x80))
+        stats->exceptions.fetch_add(1, std::memory_order_relaxed);
+
+    histogramRecord(&stats->latency, latency);
+    histogramRecord(&stats->lock_wait, modbusLockWait() / 1000);
+}
+
+//-----------------------------------------------------------------------------
+// Print the statistics of every function code that received requests.
+// Returns the number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printModbusStats(char *buffer, int size)
+{
+    int count = 0;
+
+    for (unsigned int i = 0; i < MB_STATS_NUM_FC && count < size; i++)
+    {
+        struct MB_fc_stats *stats = &fc_stats[i];
+        uint64_t requests = stats->requests.load(std::memory_order_relaxed);
+        if (requests == 0) continue;
+
+        char fc_name[10];
+        if (i == MB_STATS_OTHER_FC) sprintf(fc_name, "other");
+        else sprintf(fc_name, "%d", stats_function_codes[i]);
+
+        count += snprintf(&buffer[count], size - count,
+                          "fc=%s requests=%llu exceptions=%llu bytes_in=%llu bytes_out=%llu "
+                          "latency_us p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu "
+                          "lock_wait_us p50=%llu p99=%llu max=%llu\n",
+                          fc_name, (unsigned long long)requests,
+                          (unsigned long long)stats->exceptions.load(std::memory_order_relaxed),
+                          (unsigned long long)stats->bytes_in.load(std::memory_order_relaxed),
+                          (unsigned long long)stats->bytes_out.load(std::memory_order_relaxed),
+                          (unsigned long long)histogramPercentile(&stats->latency, 0.5),
+                          (unsigned long long)histogramPercentile(&stats->latency, 0.9),
+                          (unsigned long long)histogramPercentile(&stats->latency, 0.99),
+                          (unsigned long long)histogramPercentile(&stats->latency, 0.999),
+                          (unsigned long long)stats->latency.max.load(std::memory_order_relaxed),
+                          (unsigned long long)histogramPercentile(&stats->lock_wait, 0.5),
+                          (unsigned long long)histogramPercentile(&stats->lock_wait, 0.99),
+                          (unsigned long long)stats->lock_wait.max.load(std::memory_order_relaxed));
+    }
+
+    return (count < size) ? count : size - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Print a histogram in the Prometheus text format. Bucket bounds are the
+// powers of two between 16us and 2^30us, which fall exactly on histogram
+// bucket edges. The labels, such as fc="3", are added to every sample.
+// Returns the number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printPrometheusHistogram(char *buffer, int size, const char *name, const char *labels, struct MB_histogram *hist)
+{
+    int count = 0;
+    uint64_t cumulative = 0;
+    int index = 0;
+
+    for (int magnitude = 4; magnitude <= HIST_MAX_MAGNITUDE && count < size; magnitude++)
+    {
+        uint64_t bound = 1ULL << magnitude;
+        while (index < HIST_NUM_BUCKETS - 1 && bucketLowerBound(index) < bound)
+        {
+            cumulative += hist->counts[index].load(std::memory_order_relaxed);
+            index++;
+        }
+        count += snprintf(&buffer[count], size - count, "%s_bucket{%s,le=\"%g\"} %llu\n",
+                          name, labels, bound / 1e6, (unsigned long long)cumulative);
+    }
+
+    if (count < size)
+    {
+        count += snprintf(&buffer[count], size - count,
+                          "%s_bucket{%s,le=\"+Inf\"} %llu\n%s_sum{%s} %g\n%s_count{%s} %llu\n",
+                          name, labels, (unsigned long long)hist->total.load(std::memory_order_relaxed),
+                          name, labels, hist->sum.load(std::memory_order_relaxed) / 1e6,
+                          name, labels, (unsigned long long)hist->total.load(std::memory_order_relaxed));
+    }
+
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+// Print all the Modbus statistics in the Prometheus text format. Returns the
+// number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printPrometheusMetrics(char *buffer, int size)
+{
+    const char *counter_names[] = {"openplc_modbus_requests_total", "openplc_modbus_exceptions_total",
+                                   "openplc_modbus_request_bytes_total", "openplc_modbus_response_bytes_total"};
+    int count = 0;
+
+    for (int c = 0; c < 4 && count < size; c++)
+    {
+        count += snprintf(&buffer[count], size - count, "# TYPE %s counter\n", counter_names[c]);
+        for (unsigned int i = 0; i < MB_STATS_NUM_FC && count < size; i++)
+        {
+            struct MB_fc_stats *stats = &fc_stats[i];
+            std::atomic<uint64_t> *counters[] = {&stats->requests, &stats->exceptions, &stats->bytes_in, &stats->bytes_out};
+            if (stats->requests.load(std::memory_order_relaxed) == 0) continue;
+
+            char fc_name[10];
+            if (i == MB_STATS_OTHER_FC) sprintf(fc_name, "other");
+            else sprintf(fc_name, "%d", stats_function_codes[i]);
+
+            count += snprintf(&buffer[count], size - count, "%s{fc=\"%s\"} %llu\n", counter_names[c], fc_name,
+                              (unsigned long long)counters[c]->load(std::memory_order_relaxed));
+        }
+    }
+
+    const char *histogram_names[] = {"openplc_modbus_latency_seconds", "openplc_modbus_lock_wait_seconds"};
+    for (int h = 0; h < 2 && count < size; h++)
+    {
+        count += snprintf(&buffer[count], size - count, "# TYPE %s histogram\n", histogram_names[h]);
+        for (unsigned int i = 0; i < MB_STATS_NUM_FC && count < size; i++)
+        {
+            struct MB_fc_stats *stats = &fc_stats[i];
+            if (stats->requests.load(std::memory_order_relaxed) == 0) continue;
+
+            char labels[20];
+            if (i == MB_STATS_OTHER_FC) sprintf(labels, "fc=\"other\"");
+            else sprintf(labels, "fc=\"%d\"", stats_function_codes[i]);
+
+            count += printPrometheusHistogram(&buffer[count], size - count, histogram_names[h], labels,
+                                              (h == 0) ? &stats->latency : &stats->lock_wait);
+        }
+    }
+
+    if (count < size)
+        count += printModbusClientMetrics(&buffer[count], size - count);
+
+    if (count < size)
+        count += printModbusMasterMetrics(&buffer[count], size - count);
+
+    return (count < size) ? count : size - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Answers one HTTP request on the metrics port. Only GET /metrics is served
+//-----------------------------------------------------------------------------
+void serveMetricsRequest(int client_fd, char *metrics)
+{
+    char request[1024];
+    char header[200];
+
+    //the request must arrive promptly, the scraper is on the same host
+    struct pollfd pfd;
+    pfd.fd = client_fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 1000) <= 0) return;
+
+    int size = read(client_fd, request, sizeof(request) - 1);
+    if (size <= 0) return;
+    request[size] = '\0';
+
+    if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0)
+    {
+        const char *not_found = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        write(client_fd, not_found, strlen(not_found));
+        return;
+    }
+
+    int length = printPrometheusMetrics(metrics, METRICS_BUFFER_SIZE);
+    int header_length = sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                        "Content-Length: %d\r\nConnection: close\r\n\r\n", length);
+    write(client_fd, header, header_length);
+
+    int sent = 0;
+    while (sent < length)
+    {
+        int ret = write(client_fd, &metrics[sent], length - sent);
+        if (ret <= 0) break;
+        sent += ret;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Function to start the metrics server. It only listens on the loopback
+// interface, so the metrics are not exposed to the plant network
+//-----------------------------------------------------------------------------
+void startMetricsServer(int port)
+{
+    unsigned char log_msg[1000];
+    struct sockaddr_in server_addr;
+
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (socket_fd < 0)
+    {
+        sprintf(log_msg, "Modbus Metrics: error creating stream socket => %s\n", strerror(errno));
+        log(log_msg);
+        return;
+    }
+
+    int enable = 1;
+    setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+
+    bzero((char *)&server_addr, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    server_addr.sin_port = htons(port);
+
+    if (bind(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 || listen(socket_fd, 5) < 0)
+    {
+        sprintf(log_msg, "Modbus Metrics: error binding socket => %s\n", strerror(errno));
+        log(log_msg);
+        close(socket_fd);
+        return;
+    }
+
+    sprintf(log_msg, "Modbus Metrics: Listening on 127.0.0.1:%d\n", port);
+    log(log_msg);
+
+    char *metrics = (char *)malloc(METRICS_BUFFER_SIZE);
+
+    struct pollfd pfd;
+    pfd.fd = socket_fd;
+    pfd.events = POLLIN;
+
+    while (run_modbus_metrics)
+    {
+        //wake up periodically to check if the server must be stopped
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+        int client_fd = accept(socket_fd, NULL, NULL);
+        if (client_fd < 0) continue;
+
+        serveMetricsRequest(client_fd, metrics);
+        close(client_fd);
+    }
+
+    free(metrics);
+    close(socket_fd);
+    sprintf(log_msg, "Terminating Modbus Metrics thread\r\n");
+    log(log_msg);
+}
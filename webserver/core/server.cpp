@@ -29,6 +29,12 @@
 #include <string.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <atomic>
 
 #include "ladder.h"
 
@@ -36,6 +42,52 @@
 #define MAX_OUTPUT 16
 #define MAX_MODBUS 100
 
+//Number of datagrams received and answered with a single system call
+#define UDP_BATCH_SIZE 16
+
+#define MAX_MB_CLIENTS 64
+#define MAX_UDP_CLIENTS 64
+#define MAX_CLIENT_POLICIES 64
+
+//Priority class and request rate limit for a client IP, loaded from
+//mbclients.cfg
+struct MB_client_policy
+{
+    char ip[INET_ADDRSTRLEN];
+    int priority;
+    double rate;                        //requests per second, 0 for no limit
+    double burst;                       //requests allowed back to back
+};
+
+//State of a client connected to one of the Modbus servers. TCP clients get
+//one slot per connection on mb_clients, UDP clients one slot per source IP
+//on udp_clients
+struct MB_client
+{
+    bool in_use;
+    int fd;                             //-1 for UDP clients
+    char ip[INET_ADDRSTRLEN];
+    struct timespec last_seen;          //last datagram received, UDP clients only
+    int priority;
+    double rate;
+    double burst;
+    double tokens;
+    struct timespec last_refill;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> throttled;
+    std::atomic<uint64_t> exceptions;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+};
+
+struct MB_client_policy default_policy = {"default", MB_PRIORITY_NORMAL, 0, 0};
+struct MB_client_policy client_policies[MAX_CLIENT_POLICIES];
+int num_client_policies = 0;
+
+struct MB_client mb_clients[MAX_MB_CLIENTS];
+struct MB_client udp_clients[MAX_UDP_CLIENTS];
+pthread_mutex_t clientsLock = PTHREAD_MUTEX_INITIALIZER;
+
 
 //-----------------------------------------------------------------------------
 // Verify if all errors were cleared on a socket
@@ -79,6 +131,306 @@ bool SetSocketBlockingEnabled(int fd, bool blocking)
    return (fcntl(fd, F_SETFL, flags) == 0) ? true : false;
 }
 
+//-----------------------------------------------------------------------------
+// Load the client policies from mbclients.cfg. Each line has the format:
+//   <client ip | default> <high | normal | low> [requests per second] [burst]
+// A rate of 0 means no limit. Clients not listed use the default policy
+//-----------------------------------------------------------------------------
+void loadClientPolicies()
+{
+    unsigned char log_msg[1000];
+    char line[1024];
+
+    pthread_mutex_lock(&clientsLock);
+    num_client_policies = 0;
+    default_policy.priority = MB_PRIORITY_NORMAL;
+    default_policy.rate = 0;
+    default_policy.burst = 0;
+
+    FILE *cfgfile = fopen("mbclients.cfg", "r");
+    if (cfgfile != NULL)
+    {
+        while (fgets(line, sizeof(line), cfgfile) != NULL)
+        {
+            char ip[100], priority[20];
+            double rate = 0, burst = 0;
+
+            if (line[0] == '#') continue;
+            if (sscanf(line, "%99s %19s %lf %lf", ip, priority, &rate, &burst) < 2) continue;
+
+            struct MB_client_policy policy;
+            strncpy(policy.ip, ip, INET_ADDRSTRLEN - 1);
+            policy.ip[INET_ADDRSTRLEN - 1] = '\0';
+            policy.rate = (rate > 0) ? rate : 0;
+            policy.burst = (burst >= 1) ? burst : 1;
+            if (!strcmp(priority, "high")) policy.priority = MB_PRIORITY_HIGH;
+            else if (!strcmp(priority, "low")) policy.priority = MB_PRIORITY_LOW;
+            else policy.priority = MB_PRIORITY_NORMAL;
+
+            if (!strcmp(policy.ip, "default"))
+            {
+                default_policy = policy;
+            }
+            else if (num_client_policies < MAX_CLIENT_POLICIES)
+            {
+                client_policies[num_client_policies] = policy;
+                num_client_policies++;
+            }
+        }
+        fclose(cfgfile);
+
+        sprintf(log_msg, "Modbus Server: loaded %d client policies\n", num_client_policies);
+        log(log_msg);
+    }
+    pthread_mutex_unlock(&clientsLock);
+}
+
+//-----------------------------------------------------------------------------
+// Returns the client slot at the position provided. TCP slots come first,
+// followed by the UDP slots, so that both tables can be listed in one loop
+//-----------------------------------------------------------------------------
+struct MB_client *clientSlot(int index)
+{
+    if (index < MAX_MB_CLIENTS) return &mb_clients[index];
+    return &udp_clients[index - MAX_MB_CLIENTS];
+}
+
+//-----------------------------------------------------------------------------
+// Apply the policy of the IP provided to a client slot and reset its
+// counters. Must be called with clientsLock held
+//-----------------------------------------------------------------------------
+void initClient(struct MB_client *client, const char *ip, int fd)
+{
+    struct MB_client_policy *policy = &default_policy;
+    for (int i = 0; i < num_client_policies; i++)
+    {
+        if (!strcmp(client_policies[i].ip, ip)) policy = &client_policies[i];
+    }
+
+    client->in_use = true;
+    client->fd = fd;
+    strncpy(client->ip, ip, INET_ADDRSTRLEN);
+    client->priority = policy->priority;
+    client->rate = policy->rate;
+    client->burst = policy->burst;
+    client->tokens = policy->burst;
+    clock_gettime(CLOCK_MONOTONIC, &client->last_refill);
+    client->requests = 0;
+    client->throttled = 0;
+    client->exceptions = 0;
+    client->bytes_in = 0;
+    client->bytes_out = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Allocate a client slot for the IP provided and apply its policy. Returns
+// NULL if all slots are taken
+//-----------------------------------------------------------------------------
+struct MB_client *registerClient(const char *ip, int fd)
+{
+    struct MB_client *client = NULL;
+
+    pthread_mutex_lock(&clientsLock);
+    for (int i = 0; i < MAX_MB_CLIENTS; i++)
+    {
+        if (!mb_clients[i].in_use)
+        {
+            client = &mb_clients[i];
+            break;
+        }
+    }
+
+    if (client != NULL) initClient(client, ip, fd);
+    pthread_mutex_unlock(&clientsLock);
+
+    return client;
+}
+
+//-----------------------------------------------------------------------------
+// Find the slot of a UDP client by its IP, allocating one on the first
+// datagram. UDP clients have their own table, so that any number of source
+// addresses can't take the slots of the TCP clients. When the table is full,
+// the client that has been quiet for the longest time is evicted. Must only
+// be called from the UDP server thread
+//-----------------------------------------------------------------------------
+struct MB_client *findUDPClient(const char *ip, struct timespec *now)
+{
+    struct MB_client *client = NULL;
+
+    pthread_mutex_lock(&clientsLock);
+    for (int i = 0; i < MAX_UDP_CLIENTS; i++)
+    {
+        if (udp_clients[i].in_use && !strcmp(udp_clients[i].ip, ip))
+        {
+            client = &udp_clients[i];
+            break;
+        }
+    }
+
+    if (client == NULL)
+    {
+        for (int i = 0; i < MAX_UDP_CLIENTS; i++)
+        {
+            struct MB_client *slot = &udp_clients[i];
+            if (!slot->in_use)
+            {
+                client = slot;
+                break;
+            }
+            if (client == NULL || slot->last_seen.tv_sec < client->last_seen.tv_sec ||
+                (slot->last_seen.tv_sec == client->last_seen.tv_sec && slot->last_seen.tv_nsec < client->last_seen.tv_nsec))
+            {
+                client = slot;
+            }
+        }
+        initClient(client, ip, -1);
+    }
+
+    client->last_seen = *now;
+    pthread_mutex_unlock(&clientsLock);
+
+    return client;
+}
+
+//-----------------------------------------------------------------------------
+// Release the slots of all UDP clients
+//-----------------------------------------------------------------------------
+void releaseUDPClients()
+{
+    pthread_mutex_lock(&clientsLock);
+    for (int i = 0; i < MAX_UDP_CLIENTS; i++)
+    {
+        udp_clients[i].in_use = false;
+    }
+    pthread_mutex_unlock(&clientsLock);
+}
+
+//-----------------------------------------------------------------------------
+// Release a client slot
+//-----------------------------------------------------------------------------
+void releaseClient(struct MB_client *client)
+{
+    if (client == NULL) return;
+
+    pthread_mutex_lock(&clientsLock);
+    client->in_use = false;
+    pthread_mutex_unlock(&clientsLock);
+}
+
+//-----------------------------------------------------------------------------
+// Token bucket rate limit. Takes one token from the client's bucket and
+// returns true. If the bucket is empty and 'wait' is set, the calling thread
+// sleeps until a token is available, otherwise false is returned
+//-----------------------------------------------------------------------------
+bool takeToken(struct MB_client *client, bool wait)
+{
+    if (client == NULL || client->rate <= 0) return true;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - client->last_refill.tv_sec) + (now.tv_nsec - client->last_refill.tv_nsec) / 1e9;
+    client->last_refill = now;
+    client->tokens = fmin(client->burst, client->tokens + elapsed * client->rate);
+
+    if (client->tokens >= 1)
+    {
+        client->tokens -= 1;
+        return true;
+    }
+
+    client->throttled++;
+    if (!wait) return false;
+
+    //sleep until the missing fraction of a token was refilled
+    struct timespec delay;
+    double seconds = (1 - client->tokens) / client->rate;
+    delay.tv_sec = (time_t)seconds;
+    delay.tv_nsec = (long)((seconds - delay.tv_sec) * 1e9);
+    nanosleep(&delay, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &client->last_refill);
+    client->tokens = 0;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Update the counters of a client after its request was answered
+//-----------------------------------------------------------------------------
+void recordClientRequest(struct MB_client *client, unsigned char *response, int requestSize, int responseSize)
+{
+    client->bytes_in += requestSize;
+    client->bytes_out += responseSize;
+    if (responseSize >= 8 && (response[7] & 0x80)) client->exceptions++;
+}
+
+//-----------------------------------------------------------------------------
+// Print the list of connected clients with their counters. Returns the number
+// of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printModbusClients(char *buffer, int size)
+{
+    const char *priority_names[MB_NUM_PRIORITIES] = {"low", "normal", "high"};
+    int count = 0;
+
+    pthread_mutex_lock(&clientsLock);
+    for (int i = 0; i < MAX_MB_CLIENTS + MAX_UDP_CLIENTS && count < size; i++)
+    {
+        struct MB_client *client = clientSlot(i);
+        if (!client->in_use) continue;
+
+        count += snprintf(&buffer[count], size - count,
+                          "%s %s %s requests=%llu throttled=%llu exceptions=%llu bytes_in=%llu bytes_out=%llu\n",
+                          client->ip, client->fd < 0 ? "udp" : "tcp", priority_names[client->priority],
+                          (unsigned long long)client->requests.load(),
+                          (unsigned long long)client->throttled.load(),
+                          (unsigned long long)client->exceptions.load(),
+                          (unsigned long long)client->bytes_in.load(),
+                          (unsigned long long)client->bytes_out.load());
+    }
+    pthread_mutex_unlock(&clientsLock);
+
+    return (count < size) ? count : size - 1;
+}
+
+//-----------------------------------------------------------------------------
+// Print the connected clients and their counters in the Prometheus text
+// format. Returns the number of chars written on the buffer
+//-----------------------------------------------------------------------------
+int printModbusClientMetrics(char *buffer, int size)
+{
+    const char *names[] = {"openplc_modbus_client_requests_total", "openplc_modbus_client_throttled_total",
+                           "openplc_modbus_client_exceptions_total", "openplc_modbus_client_request_bytes_total",
+                           "openplc_modbus_client_response_bytes_total"};
+    int count = 0;
+    int connected = 0;
+
+    pthread_mutex_lock(&clientsLock);
+    for (int i = 0; i < MAX_MB_CLIENTS + MAX_UDP_CLIENTS; i++)
+    {
+        if (clientSlot(i)->in_use) connected++;
+    }
+    count += snprintf(&buffer[count], size - count, "# TYPE openplc_modbus_clients gauge\nopenplc_modbus_clients %d\n", connected);
+
+    for (int c = 0; c < 5 && count < size; c++)
+    {
+        count += snprintf(&buffer[count], size - count, "# TYPE %s counter\n", names[c]);
+        for (int i = 0; i < MAX_MB_CLIENTS + MAX_UDP_CLIENTS && count < size; i++)
+        {
+            struct MB_client *client = clientSlot(i);
+            std::atomic<uint64_t> *counters[] = {&client->requests, &client->throttled, &client->exceptions,
+                                                 &client->bytes_in, &client->bytes_out};
+            if (!client->in_use) continue;
+
+            count += snprintf(&buffer[count], size - count, "%s{client=\"%d\",ip=\"%s\",transport=\"%s\"} %llu\n",
+                              names[c], i, client->ip, client->fd < 0 ? "udp" : "tcp",
+                              (unsigned long long)counters[c]->load());
+        }
+    }
+    pthread_mutex_unlock(&clientsLock);
+
+    return (count < size) ? count : size - 1;
+}
+
 //-----------------------------------------------------------------------------
 // Create the socket and bind it. Returns the file descriptor for the socket
 // created.
@@ -131,20 +483,19 @@ int createSocket(int port)
 // Blocking call. Wait here for the client to connect. Returns the file
 // descriptor to communicate with the client.
 //-----------------------------------------------------------------------------
-int waitForClient(int socket_fd)
+int waitForClient(int socket_fd, struct sockaddr_in *client_addr)
 {
     unsigned char log_msg[1000];
-    int client_fd;
-    struct sockaddr_in client_addr;
+    int client_fd = -1;
     socklen_t client_len;
 
     sprintf(log_msg, "Modbus Server: waiting for new client...\n");
     log(log_msg);
 
-    client_len = sizeof(client_addr);
+    client_len = sizeof(*client_addr);
     while (run_modbus)
     {
-        client_fd = accept(socket_fd, (struct sockaddr *)&client_addr, &client_len); //non-blocking call
+        client_fd = accept(socket_fd, (struct sockaddr *)client_addr, &client_len); //non-blocking call
         if (client_fd > 0)
         {
             SetSocketBlockingEnabled(client_fd, true);
@@ -171,10 +522,18 @@ int listenToClient(int client_fd, unsigned char *buffer)
 //-----------------------------------------------------------------------------
 // Process client's request
 //-----------------------------------------------------------------------------
-void processMessage(unsigned char *buffer, int bufferSize, int client_fd)
+void processMessage(unsigned char *buffer, int bufferSize, struct MB_client *client, struct timespec *received)
 {
+    //a client over its rate limit waits here, without holding any lock
+    takeToken(client, true);
+    client->requests++;
+
+    unsigned char function_code = (bufferSize >= 8) ? buffer[7] : 0;
     int messageSize = processModbusMessage(buffer, bufferSize);
-    write(client_fd, buffer, messageSize);
+    write(client->fd, buffer, messageSize);
+
+    recordClientRequest(client, buffer, bufferSize, messageSize);
+    recordModbusRequest(function_code, buffer, bufferSize, messageSize, received);
 }
 
 //-----------------------------------------------------------------------------
@@ -183,12 +542,14 @@ void processMessage(unsigned char *buffer, int bufferSize, int client_fd)
 void *handleConnections(void *arguments)
 {
     unsigned char log_msg[1000];
-    int client_fd = *(int *)arguments;
+    struct MB_client *client = (struct MB_client *)arguments;
+    int client_fd = client->fd;
     unsigned char buffer[1024];
     int messageSize;
 
-    sprintf(log_msg, "Modbus Server: Thread created for client ID: %d\n", client_fd);
+    sprintf(log_msg, "Modbus Server: Thread created for client ID: %d (%s)\n", client_fd, client->ip);
     log(log_msg);
+    setModbusClientPriority(client->priority);
 
     while(run_modbus)
     {
@@ -212,10 +573,13 @@ void *handleConnections(void *arguments)
             break;
         }
 
-        processMessage(buffer, messageSize, client_fd);
+        struct timespec received;
+        clock_gettime(CLOCK_MONOTONIC, &received);
+        processMessage(buffer, messageSize, client, &received);
     }
     //printf("Debug: Closing client socket and calling pthread_exit in server.cpp\n");
     close(client_fd);
+    releaseClient(client);
     sprintf(log_msg, "Terminating Modbus connections thread\r\n");
     log(log_msg);
     pthread_exit(NULL);
@@ -233,10 +597,12 @@ void startServer(int port)
 
     socket_fd = createSocket(port);
     mapUnusedIO();
+    loadClientPolicies();
     
     while(run_modbus)
     {
-        client_fd = waitForClient(socket_fd); //block until a client connects
+        struct sockaddr_in client_addr;
+        client_fd = waitForClient(socket_fd, &client_addr); //block until a client connects
         if (client_fd < 0)
         {
             sprintf(log_msg, "Modbus Server: Error accepting client!\n");
@@ -245,17 +611,32 @@ void startServer(int port)
 
         else
         {
-            int arguments[1];
+            char client_ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, INET_ADDRSTRLEN);
+
+            struct MB_client *client = registerClient(client_ip, client_fd);
+            if (client == NULL)
+            {
+                sprintf(log_msg, "Modbus Server: Too many clients. Rejecting %s\n", client_ip);
+                log(log_msg);
+                close(client_fd);
+                continue;
+            }
+
             pthread_t thread;
             int ret = -1;
             sprintf(log_msg, "Modbus Server: Client accepted! Creating thread for the new client ID: %d...\n", client_fd);
             log(log_msg);
-            arguments[0] = client_fd;
-            ret = pthread_create(&thread, NULL, handleConnections, arguments);
+            ret = pthread_create(&thread, NULL, handleConnections, client);
             if (ret==0) 
             {
                 pthread_detach(thread);
             }
+            else
+            {
+                close(client_fd);
+                releaseClient(client);
+            }
         }
     }
     close(socket_fd);
@@ -263,3 +644,169 @@ void startServer(int port)
     sprintf(log_msg, "Terminating Modbus thread\r\n");
     log(log_msg);
 }
+
+//-----------------------------------------------------------------------------
+// Create the UDP socket and bind it. Returns the file descriptor for the
+// socket created.
+//-----------------------------------------------------------------------------
+int createSocketUDP(int port)
+{
+    unsigned char log_msg[1000];
+    int socket_fd;
+    struct sockaddr_in server_addr;
+
+    //Create UDP Socket
+    socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socket_fd < 0)
+    {
+        sprintf(log_msg, "Modbus UDP Server: error creating datagram socket => %s\n", strerror(errno));
+        log(log_msg);
+        return -1;
+    }
+
+    //Set SO_REUSEADDR
+    int enable = 1;
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0)
+        perror("setsockopt(SO_REUSEADDR) failed");
+
+    SetSocketBlockingEnabled(socket_fd, false);
+
+    //Initialize Server Struct
+    bzero((char *) &server_addr, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    //Bind socket
+    if (bind(socket_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        sprintf(log_msg, "Modbus UDP Server: error binding socket => %s\n", strerror(errno));
+        log(log_msg);
+        close(socket_fd);
+        return -1;
+    }
+
+    sprintf(log_msg, "Modbus UDP Server: Listening on port %d\n", port);
+    log(log_msg);
+
+    return socket_fd;
+}
+
+//-----------------------------------------------------------------------------
+// Process a request received by the UDP server. The UDP server can't hold a
+// client back like the TCP threads do, so a client over its rate limit gets
+// a Slave Device Busy exception instead. Returns the size of the response
+//-----------------------------------------------------------------------------
+int processDatagram(unsigned char *buffer, int bufferSize, struct sockaddr_in *address, struct timespec *received)
+{
+    char client_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address->sin_addr, client_ip, INET_ADDRSTRLEN);
+    unsigned char function_code = (bufferSize >= 8) ? buffer[7] : 0;
+    int messageSize;
+
+    struct MB_client *client = findUDPClient(client_ip, received);
+    client->requests++;
+    if (takeToken(client, false))
+    {
+        setModbusClientPriority(client->priority);
+        messageSize = processModbusMessage(buffer, bufferSize);
+    }
+    else
+    {
+        messageSize = modbusBusyResponse(buffer, bufferSize);
+    }
+    recordClientRequest(client, buffer, bufferSize, messageSize);
+
+    recordModbusRequest(function_code, buffer, bufferSize, messageSize, received);
+    return messageSize;
+}
+
+//-----------------------------------------------------------------------------
+// Function to start the Modbus/UDP server. Every datagram carries exactly one
+// Modbus/TCP frame (MBAP header + PDU), which is processed by the same engine
+// used by the TCP server. On Linux, requests are received and answered in
+// batches with recvmmsg() and sendmmsg(), so a burst of requests costs one
+// system call each way.
+//-----------------------------------------------------------------------------
+void startServerUDP(int port)
+{
+    unsigned char log_msg[1000];
+    unsigned char buffers[UDP_BATCH_SIZE][1024];
+    struct sockaddr_in addresses[UDP_BATCH_SIZE];
+    struct iovec iovecs[UDP_BATCH_SIZE];
+    int socket_fd;
+
+    socket_fd = createSocketUDP(port);
+    if (socket_fd < 0) return;
+    mapUnusedIO();
+    loadClientPolicies();
+
+    struct pollfd pfd;
+    pfd.fd = socket_fd;
+    pfd.events = POLLIN;
+
+    while (run_modbus_udp)
+    {
+        //wake up periodically to check if the server must be stopped
+        if (poll(&pfd, 1, 100) <= 0) continue;
+
+#ifdef __linux__
+        struct mmsghdr msgs[UDP_BATCH_SIZE];
+        for (int i = 0; i < UDP_BATCH_SIZE; i++)
+        {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = sizeof(buffers[i]);
+            bzero(&msgs[i].msg_hdr, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_name = &addresses[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received = recvmmsg(socket_fd, msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (received <= 0) continue;
+
+        struct timespec received_at;
+        clock_gettime(CLOCK_MONOTONIC, &received_at);
+
+        //responses are written in place and sent back to their sources
+        int responses = 0;
+        for (int i = 0; i < received; i++)
+        {
+            int messageSize = processDatagram(buffers[i], msgs[i].msg_len, &addresses[i], &received_at);
+            if (messageSize <= 0) continue;
+
+            iovecs[i].iov_len = messageSize;
+            if (responses != i) msgs[responses].msg_hdr = msgs[i].msg_hdr;
+            responses++;
+        }
+
+        int sent = 0;
+        while (sent < responses)
+        {
+            int ret = sendmmsg(socket_fd, &msgs[sent], responses - sent, 0);
+            if (ret <= 0) break;
+            sent += ret;
+        }
+#else
+        for (int i = 0; i < UDP_BATCH_SIZE; i++)
+        {
+            socklen_t address_len = sizeof(addresses[i]);
+            int messageSize = recvfrom(socket_fd, buffers[i], sizeof(buffers[i]), MSG_DONTWAIT,
+                                       (struct sockaddr *)&addresses[i], &address_len);
+            if (messageSize <= 0) break;
+
+            struct timespec received_at;
+            clock_gettime(CLOCK_MONOTONIC, &received_at);
+            messageSize = processDatagram(buffers[i], messageSize, &addresses[i], &received_at);
+            if (messageSize > 0)
+                sendto(socket_fd, buffers[i], messageSize, 0, (struct sockaddr *)&addresses[i], address_len);
+        }
+#endif
+    }
+
+    close(socket_fd);
+    releaseUDPClients();
+    sprintf(log_msg, "Terminating Modbus UDP thread\r\n");
+    log(log_msg);
+}
@@ -157,6 +157,17 @@ class runtime:
             except:
                 print("Error connecting to OpenPLC runtime")
 
+    def reload_modbus_master(self):
+        if (self.status() == "Running"):
+            try:
+                s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+                s.connect(('localhost', 43628))
+                s.send('reload_modbus_master()\n')
+                data = s.recv(1000)
+                s.close()
+            except:
+                print("Error connecting to OpenPLC runtime")
+
     def start_dnp3(self, port_num):
         if (self.status() == "Running"):
             try:
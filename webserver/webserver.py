@@ -130,7 +130,10 @@ def generate_mbconfig():
                 mbconfig += 'device' + str(device_counter) + '.Holding_Registers_Size = "' + str(row[20]) + '"\n'
                 device_counter += 1
                 
-            with open('./mbconfig.cfg', 'w+') as f: f.write(mbconfig)
+            #the runtime may be reading the file, so it's replaced in one step
+            with open('./mbconfig.cfg.tmp', 'w+') as f: f.write(mbconfig)
+            os.rename('./mbconfig.cfg.tmp', './mbconfig.cfg')
+            openplc_runtime.reload_modbus_master()
             
         except Error as e:
             print("error connecting to the database" + str(e))